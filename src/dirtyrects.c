@@ -0,0 +1,266 @@
+/*  dirtyrects.c
+ *
+ *  Tracking of the changed screen regions.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "mazecore/mazehelpers.h"
+#include "dirtyrects.h"
+
+#define DIRTY_MAX_RECTS 64
+
+// Extra cost of one more rectangle, in pixels. Two rectangles are merged
+// when their union costs less than pushing them separately, so distant
+// ones (a fast diagonal move of the ball) stay apart.
+#define DIRTY_RECT_COST 512
+
+typedef struct {
+    int x1, y1, x2, y2; // x2, y2 exclusive
+} DirtyRect;
+
+static DirtyRect rects[DIRTY_MAX_RECTS];
+static int rects_count = 0;
+static bool all_dirty = false;
+static DirtyStats stats = {0};
+static SDL_Rect prev_view;
+static bool have_prev_view = false;
+
+//------------------------------------------------------------------------------
+
+static int Area(const DirtyRect *r)
+{
+    return (r->x2 - r->x1) * (r->y2 - r->y1);
+}
+
+static DirtyRect Union(const DirtyRect *a, const DirtyRect *b)
+{
+    DirtyRect u;
+    u.x1 = min(a->x1, b->x1);
+    u.y1 = min(a->y1, b->y1);
+    u.x2 = max(a->x2, b->x2);
+    u.y2 = max(a->y2, b->y2);
+    return u;
+}
+
+// merge the pair with the biggest saving until no merge saves anything
+static void MergeRects()
+{
+    while (rects_count > 1)
+    {
+        int best_i = -1, best_j = -1;
+        int best_saving = -1;
+        for (int i=0; i<rects_count; i++)
+        {
+            for (int j=i+1; j<rects_count; j++)
+            {
+                DirtyRect u = Union(&rects[i], &rects[j]);
+                int saving = Area(&rects[i]) + Area(&rects[j]) + DIRTY_RECT_COST - Area(&u);
+                if (saving > best_saving)
+                {
+                    best_saving = saving;
+                    best_i = i;
+                    best_j = j;
+                }
+            }
+        }
+        if (best_i < 0)
+            break;
+
+        rects[best_i] = Union(&rects[best_i], &rects[best_j]);
+        rects[best_j] = rects[--rects_count];
+    }
+}
+
+// move the w x h area at the origin of the surface by dx, dy
+static void ScrollSurface(SDL_Surface *s, int w, int h, int dx, int dy)
+{
+    if (SDL_MUSTLOCK(s))
+        if (SDL_LockSurface(s) < 0)
+            return;
+
+    const int bpp = s->format->BytesPerPixel;
+    const int cw = w - abs(dx), ch = h - abs(dy);
+    const int sx = max(-dx, 0), sy = max(-dy, 0);
+    const int tx = max(dx, 0), ty = max(dy, 0);
+    Uint8 *pixels = (Uint8*)s->pixels;
+    for (int i=0; i<ch; i++)
+    {
+        //rows in the order that doesn't overwrite the ones still to move
+        int y = (dy > 0 ? ch-1-i : i);
+        memmove(pixels + (ty+y)*s->pitch + tx*bpp,
+                pixels + (sy+y)*s->pitch + sx*bpp, cw*bpp);
+    }
+
+    if (SDL_MUSTLOCK(s))
+        SDL_UnlockSurface(s);
+}
+
+//------------------------------------------------------------------------------
+
+void dirty_add(int x, int y, int w, int h)
+{
+    if (all_dirty || w <= 0 || h <= 0)
+        return;
+    if (rects_count == DIRTY_MAX_RECTS)
+    {
+        all_dirty = true;
+        return;
+    }
+
+    DirtyRect *r = &rects[rects_count++];
+    r->x1 = x;
+    r->y1 = y;
+    r->x2 = x + w;
+    r->y2 = y + h;
+}
+
+void dirty_add_rect(const SDL_Rect *r)
+{
+    dirty_add(r->x, r->y, r->w, r->h);
+}
+
+void dirty_add_all()
+{
+    all_dirty = true;
+}
+
+void dirty_copy_view(SDL_Surface *world, const SDL_Rect *view, SDL_Surface *disp)
+{
+    const int w = min(view->w, disp->w), h = min(view->h, disp->h);
+    const int dx = (have_prev_view ? view->x - prev_view.x : 0);
+    const int dy = (have_prev_view ? view->y - prev_view.y : 0);
+    const bool scrolled = (dx != 0 || dy != 0);
+    prev_view = *view;
+    have_prev_view = true;
+
+    stats.copied = 0;
+    if (scrolled && (abs(dx) >= w || abs(dy) >= h))
+        all_dirty = true;
+
+    if (all_dirty)
+    {
+        SDL_Rect src = {view->x, view->y, w, h};
+        SDL_Rect dst = {0, 0, w, h};
+        SDL_BlitSurface(world, &src, disp, &dst);
+        stats.copied = w * h;
+        return;
+    }
+
+    //reuse the part of the previous frame still in view
+    if (scrolled)
+    {
+        ScrollSurface(disp, w, h, -dx, -dy);
+        if (dx > 0)
+            dirty_add(view->x + w - dx, view->y, dx, h);
+        else if (dx < 0)
+            dirty_add(view->x, view->y, -dx, h);
+        if (dy > 0)
+            dirty_add(view->x, view->y + h - dy, w, dy);
+        else if (dy < 0)
+            dirty_add(view->x, view->y, w, -dy);
+        if (all_dirty)
+        {
+            dirty_copy_view(world, view, disp);
+            return;
+        }
+    }
+
+    //copy the changed parts, keep them in display coordinates
+    int n = 0;
+    for (int i=0; i<rects_count; i++)
+    {
+        DirtyRect r = rects[i];
+        clamp_min(r.x1, view->x);
+        clamp_min(r.y1, view->y);
+        clamp_max(r.x2, view->x + w);
+        clamp_max(r.y2, view->y + h);
+        if (r.x1 >= r.x2 || r.y1 >= r.y2)
+            continue;
+
+        SDL_Rect src = {r.x1, r.y1, r.x2 - r.x1, r.y2 - r.y1};
+        SDL_Rect dst = {r.x1 - view->x, r.y1 - view->y, src.w, src.h};
+        SDL_BlitSurface(world, &src, disp, &dst);
+        stats.copied += src.w * src.h;
+
+        rects[n].x1 = r.x1 - view->x;
+        rects[n].y1 = r.y1 - view->y;
+        rects[n].x2 = r.x2 - view->x;
+        rects[n].y2 = r.y2 - view->y;
+        n++;
+    }
+    rects_count = n;
+
+    //the whole display has moved
+    if (scrolled)
+        all_dirty = true;
+}
+
+void dirty_flush(SDL_Surface *surf)
+{
+    stats.rects = 0;
+    stats.pixels = 0;
+    stats.full = all_dirty;
+
+    if (all_dirty)
+    {
+        SDL_Flip(surf);
+        stats.pixels = surf->w * surf->h;
+    }
+    else
+    {
+        //clip to the surface, SDL doesn't accept rectangles outside of it
+        int n = 0;
+        for (int i=0; i<rects_count; i++)
+        {
+            DirtyRect *r = &rects[i];
+            clamp_min(r->x1, 0);
+            clamp_min(r->y1, 0);
+            clamp_max(r->x2, surf->w);
+            clamp_max(r->y2, surf->h);
+            if (r->x1 < r->x2 && r->y1 < r->y2)
+                rects[n++] = *r;
+        }
+        rects_count = n;
+        MergeRects();
+
+        SDL_Rect update[DIRTY_MAX_RECTS];
+        for (int i=0; i<rects_count; i++)
+        {
+            update[i].x = rects[i].x1;
+            update[i].y = rects[i].y1;
+            update[i].w = rects[i].x2 - rects[i].x1;
+            update[i].h = rects[i].y2 - rects[i].y1;
+            stats.pixels += update[i].w * update[i].h;
+        }
+        if (rects_count > 0)
+            SDL_UpdateRects(surf, rects_count, update);
+        stats.rects = rects_count;
+    }
+
+    rects_count = 0;
+    all_dirty = false;
+}
+
+DirtyStats dirty_get_stats()
+{
+    return stats;
+}
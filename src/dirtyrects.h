@@ -0,0 +1,53 @@
+/*  dirtyrects.h
+ *
+ *  Tracking of the changed screen regions.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef DIRTYRECTS_H
+#define DIRTYRECTS_H
+
+#include <stdbool.h>
+#include <SDL/SDL.h>
+
+typedef struct {
+    int rects;    // rectangles passed to SDL_UpdateRects
+    int pixels;   // pixels pushed to the display
+    int copied;   // pixels copied into the viewport by dirty_copy_view
+    bool full;    // the whole surface was flipped
+} DirtyStats;
+
+// Everything drawn to the screen during a frame is reported with dirty_add,
+// dirty_flush then merges the rectangles where one update is cheaper than
+// two and presents them with a single SDL_UpdateRects call.
+//
+// In the scrolling mode the rectangles are in the coordinates of the level
+// surface. dirty_copy_view brings them into the viewport: after a scroll the
+// display is moved in place and only the uncovered strips are copied, the
+// pending rectangles are then in display coordinates.
+
+void dirty_add(int x, int y, int w, int h);
+void dirty_add_rect(const SDL_Rect *r);
+void dirty_add_all();
+void dirty_copy_view(SDL_Surface *world, const SDL_Rect *view, SDL_Surface *disp);
+void dirty_flush(SDL_Surface *surf);
+DirtyStats dirty_get_stats();
+
+#endif /* DIRTYRECTS_H */
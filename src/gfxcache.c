@@ -0,0 +1,323 @@
+/*  gfxcache.c
+ *
+ *  Cache of rasterized vector images.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <glib.h>
+#include <SDL/SDL_thread.h>
+#include "misc/hash.h"
+#include "misc/rawimage.h"
+#include "gfxcache.h"
+
+#define LOG_MODULE "GfxCache"
+#include "logging.h"
+
+#define GFX_CACHE_MANIFEST "manifest"
+#define GFX_CACHE_MAGIC "mokomaze-gfx-cache"
+#define GFX_CACHE_VERSION 2
+#define GFX_CACHE_BUDGET (32*1024*1024)
+
+typedef struct {
+    uint64_t key;
+    uint64_t source_hash;
+    int width, height, bpp;
+    bool rot;
+    long size;
+    unsigned long used;
+} GfxCacheEntry;
+
+static char *cache_dir = NULL;
+static GHashTable *entries = NULL;
+static long total_size = 0;
+static unsigned long use_counter = 0;
+static bool dirty = false;
+static SDL_mutex *lock = NULL;
+
+//------------------------------------------------------------------------------
+
+static char *GetEntryFile(uint64_t key)
+{
+    int max_overhead = 32;
+    char *fname = (char*)malloc(strlen(cache_dir) + strlen("/") + max_overhead + 1);
+    sprintf(fname, "%s/gfx-%016" PRIx64 ".raw", cache_dir, key);
+    return fname;
+}
+
+static char *GetManifestFile()
+{
+    char *fname = (char*)malloc(strlen(cache_dir) + strlen("/") + strlen(GFX_CACHE_MANIFEST) + 1);
+    sprintf(fname, "%s/%s", cache_dir, GFX_CACHE_MANIFEST);
+    return fname;
+}
+
+static void RemoveEntry(GfxCacheEntry *e)
+{
+    char *fname = GetEntryFile(e->key);
+    unlink(fname);
+    free(fname);
+    total_size -= e->size;
+    dirty = true;
+    g_hash_table_remove(entries, &e->key);
+}
+
+// The cache is started over without a known manifest, so every file but
+// the manifest is unlisted: images of the earlier versions named after the
+// source file, levels rendered before they were kept here, entries of an
+// older manifest.
+static void RemoveUnlistedFiles()
+{
+    DIR *dir = opendir(cache_dir);
+    if (dir == NULL)
+        return;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] != '.' && strcmp(entry->d_name, GFX_CACHE_MANIFEST))
+        {
+            char *fname = (char*)malloc(strlen(cache_dir) + strlen("/") + strlen(entry->d_name) + 1);
+            sprintf(fname, "%s/%s", cache_dir, entry->d_name);
+            unlink(fname);
+            free(fname);
+        }
+    }
+    closedir(dir);
+}
+
+static void LoadManifest()
+{
+    char *fname = GetManifestFile();
+    FILE *f = fopen(fname, "r");
+    free(fname);
+    if (!f)
+    {
+        RemoveUnlistedFiles();
+        return;
+    }
+
+    char magic[32] = {0};
+    int version = 0;
+    if (fscanf(f, "%31s %d", magic, &version) == 2 &&
+        !strcmp(magic, GFX_CACHE_MAGIC) && version == GFX_CACHE_VERSION)
+    {
+        GfxCacheEntry e;
+        int rot;
+        while (fscanf(f, "%" SCNx64 " %" SCNx64 " %d %d %d %d %ld %lu",
+                      &e.key, &e.source_hash, &e.width, &e.height, &e.bpp,
+                      &rot, &e.size, &e.used) == 8)
+        {
+            e.rot = rot;
+            GfxCacheEntry *ne = g_new(GfxCacheEntry, 1);
+            *ne = e;
+            g_hash_table_replace(entries, &ne->key, NULL);
+            total_size += e.size;
+            if (e.used > use_counter)
+                use_counter = e.used;
+        }
+    }
+    else
+    {
+        log_warning("unknown manifest format, the cache is started over");
+        RemoveUnlistedFiles();
+        dirty = true;
+    }
+    fclose(f);
+}
+
+static void Evict()
+{
+    while (total_size > GFX_CACHE_BUDGET && g_hash_table_size(entries) > 0)
+    {
+        GfxCacheEntry *lru = NULL;
+        GHashTableIter iter;
+        gpointer key;
+        g_hash_table_iter_init(&iter, entries);
+        while (g_hash_table_iter_next(&iter, &key, NULL))
+        {
+            GfxCacheEntry *e = (GfxCacheEntry*)key;
+            if (!lru || e->used < lru->used)
+                lru = e;
+        }
+        log_info("removing entry %016" PRIx64 " (%ld bytes)", lru->key, lru->size);
+        RemoveEntry(lru);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void gfx_cache_open(const char *dir)
+{
+    gfx_cache_close();
+    //the entry is its own key, the key field comes first
+    entries = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+    lock = SDL_CreateMutex();
+    if (!dir)
+        return;
+
+    cache_dir = strdup(dir);
+    LoadManifest();
+    log_info("%u entries, %ld bytes", g_hash_table_size(entries), total_size);
+}
+
+uint64_t gfx_cache_key(uint64_t source_hash, int width, int height, bool rot, int bpp)
+{
+    int32_t params[4] = {width, height, rot, bpp};
+    return hash_data(source_hash, params, sizeof(params));
+}
+
+SDL_Surface *gfx_cache_load(uint64_t key, int width, int height,
+                            const SDL_PixelFormat *opaque_format,
+                            const SDL_PixelFormat *alpha_format)
+{
+    if (!cache_dir)
+        return NULL;
+    SDL_LockMutex(lock);
+    bool found = g_hash_table_lookup_extended(entries, &key, NULL, NULL);
+    SDL_UnlockMutex(lock);
+    if (!found)
+        return NULL;
+
+    char *fname = GetEntryFile(key);
+    SDL_Surface *res = raw_image_load(fname, width, height, opaque_format, alpha_format);
+    free(fname);
+    return res;
+}
+
+void gfx_cache_touch(uint64_t key)
+{
+    if (!entries)
+        return;
+    GfxCacheEntry *e = NULL;
+    SDL_LockMutex(lock);
+    if (g_hash_table_lookup_extended(entries, &key, (gpointer*)&e, NULL))
+    {
+        e->used = ++use_counter;
+        dirty = true;
+    }
+    SDL_UnlockMutex(lock);
+}
+
+bool gfx_cache_store(uint64_t key, uint64_t source_hash, bool rot, SDL_Surface *surf)
+{
+    if (!cache_dir)
+        return false;
+
+    SDL_LockMutex(lock);
+    char *fname = GetEntryFile(key);
+    bool ok = (raw_image_save(surf, fname) == 0);
+    free(fname);
+    if (!ok)
+    {
+        SDL_UnlockMutex(lock);
+        return false;
+    }
+
+    GfxCacheEntry *old = NULL;
+    if (g_hash_table_lookup_extended(entries, &key, (gpointer*)&old, NULL))
+    {
+        total_size -= old->size;
+        g_hash_table_remove(entries, &key);
+    }
+
+    GfxCacheEntry *e = g_new(GfxCacheEntry, 1);
+    e->key = key;
+    e->source_hash = source_hash;
+    e->width = surf->w;
+    e->height = surf->h;
+    e->bpp = surf->format->BitsPerPixel;
+    e->rot = rot;
+    e->size = raw_image_file_size(surf);
+    e->used = ++use_counter;
+    g_hash_table_replace(entries, &e->key, NULL);
+    total_size += e->size;
+    dirty = true;
+
+    Evict();
+    SDL_UnlockMutex(lock);
+    return true;
+}
+
+void gfx_cache_sync()
+{
+    if (!cache_dir)
+        return;
+    SDL_LockMutex(lock);
+    if (!dirty)
+    {
+        SDL_UnlockMutex(lock);
+        return;
+    }
+
+    char *fname = GetManifestFile();
+    char *tmp_fname = (char*)malloc(strlen(fname) + strlen(".tmp") + 1);
+    sprintf(tmp_fname, "%s.tmp", fname);
+
+    bool ok = false;
+    FILE *f = fopen(tmp_fname, "w");
+    if (f)
+    {
+        fprintf(f, "%s %d\n", GFX_CACHE_MAGIC, GFX_CACHE_VERSION);
+        GHashTableIter iter;
+        gpointer key;
+        g_hash_table_iter_init(&iter, entries);
+        while (g_hash_table_iter_next(&iter, &key, NULL))
+        {
+            GfxCacheEntry *e = (GfxCacheEntry*)key;
+            fprintf(f, "%016" PRIx64 " %016" PRIx64 " %d %d %d %d %ld %lu\n",
+                    e->key, e->source_hash, e->width, e->height, e->bpp,
+                    (int)e->rot, e->size, e->used);
+        }
+        ok = (fclose(f) == 0);
+        ok = ok && (rename(tmp_fname, fname) == 0);
+        if (!ok)
+            remove(tmp_fname);
+    }
+
+    if (ok)
+        dirty = false;
+    else
+        log_error("can't write manifest `%s'", fname);
+    free(tmp_fname);
+    free(fname);
+    SDL_UnlockMutex(lock);
+}
+
+void gfx_cache_close()
+{
+    gfx_cache_sync();
+    if (entries)
+        g_hash_table_destroy(entries);
+    entries = NULL;
+    if (lock)
+        SDL_DestroyMutex(lock);
+    lock = NULL;
+    free(cache_dir);
+    cache_dir = NULL;
+    total_size = 0;
+    use_counter = 0;
+    dirty = false;
+}
@@ -0,0 +1,54 @@
+/*  gfxcache.h
+ *
+ *  Cache of rasterized vector images.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef GFXCACHE_H
+#define GFXCACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <SDL/SDL.h>
+
+// Rasterized images in the cache directory, one raw image file per entry,
+// listed in a manifest with the hash of the source content, the size,
+// rotation and bit depth of the raster, the file size and the last use.
+// Entries are looked up by the key built from all of these, the least
+// recently used ones are removed when the cache outgrows its budget.
+//
+// A loaded image must be in one of the given display formats, see rawimage.h,
+// and is freed with raw_image_free.
+//
+// The rendered levels are kept here too, stored and loaded by the prerender
+// thread, so everything but opening and closing may be called from any
+// thread.
+
+void gfx_cache_open(const char *dir);
+uint64_t gfx_cache_key(uint64_t source_hash, int width, int height, bool rot, int bpp);
+SDL_Surface *gfx_cache_load(uint64_t key, int width, int height,
+                            const SDL_PixelFormat *opaque_format,
+                            const SDL_PixelFormat *alpha_format);
+void gfx_cache_touch(uint64_t key);
+bool gfx_cache_store(uint64_t key, uint64_t source_hash, bool rot, SDL_Surface *surf);
+void gfx_cache_sync();
+void gfx_cache_close();
+
+#endif /* GFXCACHE_H */
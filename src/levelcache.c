@@ -0,0 +1,231 @@
+/*  levelcache.c
+ *
+ *  Cache of rendered level images.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "misc/hash.h"
+#include "misc/rawimage.h"
+#include "gfxcache.h"
+#include "levelcache.h"
+
+#define LOG_MODULE "LevelCache"
+#include "logging.h"
+
+typedef struct {
+    bool taken;
+    uint64_t hash;      // of the level content, see LevelHash
+    unsigned long used; // use_counter at the last access
+    size_t size;
+    void *pixels;
+} LevelCacheEntry;
+
+static LevelCacheEntry *entries = NULL;
+static int entries_count = 0;
+static unsigned long use_counter = 0;
+static bool cache_disk = false;
+static char *cache_prefix = NULL;
+
+//------------------------------------------------------------------------------
+
+static size_t SurfaceSize(const SDL_Surface *s)
+{
+    return (size_t)s->pitch * s->h;
+}
+
+// The prefix and everything the level image is rendered from: its boxes,
+// holes and the final hole, in window coordinates. An edited level gets a new
+// image, an unchanged one keeps it when the rest of the pack changes.
+static uint64_t LevelHash(const Level *lvl)
+{
+    uint64_t h = hash_data(HASH_INIT, cache_prefix, strlen(cache_prefix));
+    h = hash_data(h, &lvl->boxes_count, sizeof(lvl->boxes_count));
+    h = hash_data(h, lvl->boxes, lvl->boxes_count * sizeof(Box));
+    h = hash_data(h, &lvl->holes_count, sizeof(lvl->holes_count));
+    h = hash_data(h, lvl->holes, lvl->holes_count * sizeof(Point));
+    h = hash_data(h, &lvl->fins_count, sizeof(lvl->fins_count));
+    h = hash_data(h, lvl->fins, lvl->fins_count * sizeof(Point));
+    //the final image is drawn into the level only when there are no keys
+    bool has_keys = (lvl->keys_count > 0);
+    h = hash_data(h, &has_keys, sizeof(has_keys));
+    return h;
+}
+
+static LevelCacheEntry *FindEntry(uint64_t hash, size_t size)
+{
+    for (int i=0; i<entries_count; i++)
+        if (entries[i].taken && entries[i].hash == hash && entries[i].size == size)
+            return &entries[i];
+    return NULL;
+}
+
+static LevelCacheEntry *FindFreeEntry()
+{
+    LevelCacheEntry *res = NULL;
+    for (int i=0; i<entries_count; i++)
+    {
+        if (!entries[i].taken)
+            return &entries[i];
+        if (!res || entries[i].used < res->used)
+            res = &entries[i];
+    }
+    return res;
+}
+
+static void StoreInMemory(uint64_t hash, const void *pixels, size_t size)
+{
+    LevelCacheEntry *e = FindEntry(hash, size);
+    if (!e)
+        e = FindFreeEntry();
+    if (!e)
+        return;
+
+    if (e->size != size)
+    {
+        free(e->pixels);
+        e->pixels = malloc(size);
+        e->size = (e->pixels ? size : 0);
+        if (!e->pixels)
+        {
+            e->taken = false;
+            return;
+        }
+    }
+    memcpy(e->pixels, pixels, size);
+    e->taken = true;
+    e->hash = hash;
+    e->used = ++use_counter;
+}
+
+//------------------------------------------------------------------------------
+
+// On disk the images are entries of the graphics cache, which keeps them
+// within its budget together with the rasterized images
+
+static uint64_t GetLevelKey(uint64_t hash, const SDL_Surface *s)
+{
+    return gfx_cache_key(hash, s->w, s->h, false, s->format->BitsPerPixel);
+}
+
+static bool LoadFromDisk(int level, uint64_t hash, SDL_Surface *to)
+{
+    uint64_t key = GetLevelKey(hash, to);
+    SDL_Surface *img = gfx_cache_load(key, to->w, to->h, to->format, to->format);
+    if (!img)
+        return false;
+
+    size_t row_size = (size_t)to->w * to->format->BytesPerPixel;
+    for (int y=0; y<to->h; y++)
+        memcpy((Uint8*)to->pixels + y*to->pitch, (Uint8*)img->pixels + y*img->pitch, row_size);
+    raw_image_free(img);
+    gfx_cache_touch(key);
+    log_info("level %d was loaded from cache", level);
+    return true;
+}
+
+static void SaveToDisk(int level, uint64_t hash, SDL_Surface *from)
+{
+    uint64_t key = GetLevelKey(hash, from);
+    if (gfx_cache_store(key, hash, false, from))
+    {
+        gfx_cache_sync();
+        log_info("level %d was cached", level);
+    }
+    else
+        log_error("can't cache level %d", level);
+}
+
+//------------------------------------------------------------------------------
+
+void level_cache_init(int capacity, bool disk, const char *prefix)
+{
+    if (cache_prefix && prefix && !strcmp(cache_prefix, prefix) && capacity == entries_count)
+    {
+        cache_disk = disk;
+        return;
+    }
+
+    level_cache_free();
+    entries_count = capacity;
+    entries = (LevelCacheEntry*)calloc(capacity, sizeof(LevelCacheEntry));
+    cache_disk = disk;
+    cache_prefix = (prefix ? strdup(prefix) : NULL);
+}
+
+bool level_cache_load(int level, const Level *lvl, SDL_Surface *to)
+{
+    if (!cache_prefix)
+        return false;
+    if (SDL_MUSTLOCK(to))
+        if (SDL_LockSurface(to) < 0)
+            return false;
+
+    bool ok = false;
+    uint64_t hash = LevelHash(lvl);
+    LevelCacheEntry *e = FindEntry(hash, SurfaceSize(to));
+    if (e)
+    {
+        memcpy(to->pixels, e->pixels, e->size);
+        e->used = ++use_counter;
+        ok = true;
+    }
+    else if (cache_disk && LoadFromDisk(level, hash, to))
+    {
+        StoreInMemory(hash, to->pixels, SurfaceSize(to));
+        ok = true;
+    }
+
+    if (SDL_MUSTLOCK(to))
+        SDL_UnlockSurface(to);
+    return ok;
+}
+
+void level_cache_store(int level, const Level *lvl, SDL_Surface *from)
+{
+    if (!cache_prefix)
+        return;
+    if (SDL_MUSTLOCK(from))
+        if (SDL_LockSurface(from) < 0)
+            return;
+
+    uint64_t hash = LevelHash(lvl);
+    StoreInMemory(hash, from->pixels, SurfaceSize(from));
+    if (cache_disk)
+        SaveToDisk(level, hash, from);
+
+    if (SDL_MUSTLOCK(from))
+        SDL_UnlockSurface(from);
+}
+
+void level_cache_free()
+{
+    for (int i=0; i<entries_count; i++)
+        free(entries[i].pixels);
+    free(entries);
+    entries = NULL;
+    entries_count = 0;
+    cache_disk = false;
+    free(cache_prefix);
+    cache_prefix = NULL;
+}
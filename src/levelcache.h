@@ -0,0 +1,44 @@
+/*  levelcache.h
+ *
+ *  Cache of rendered level images.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LEVELCACHE_H
+#define LEVELCACHE_H
+
+#include <stdbool.h>
+#include <SDL/SDL.h>
+#include "mazecore/mazetypes.h"
+
+// Rendered level images, kept in memory for the recently used levels and,
+// when disk is set, in the graphics cache. An image is found by the content of
+// its level, as given to the renderer, and the prefix, which names everything
+// else the image depends on: the images of the desk and the walls, the sizes
+// of the config, the resolution, orientation and bit depth. level_cache_init
+// drops the images of the previous prefix from memory, those on disk are left
+// to the eviction of the graphics cache. The level number is only reported.
+
+void level_cache_init(int capacity, bool disk, const char *prefix);
+bool level_cache_load(int level, const Level *lvl, SDL_Surface *to);
+void level_cache_store(int level, const Level *lvl, SDL_Surface *from);
+void level_cache_free();
+
+#endif /* LEVELCACHE_H */
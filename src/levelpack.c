@@ -0,0 +1,306 @@
+/*  levelpack.c
+ *
+ *  Compiled binary levelpacks.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "levelpack.h"
+
+#define LOG_MODULE "Levelpack"
+#include "logging.h"
+
+#define LEVELPACK_MAGIC "MKPK"
+#define LEVELPACK_VERSION 1
+#define LEVELPACK_BYTE_ORDER 0x01020304
+
+// the arrays are used in place, so their layout must be the one of the file
+typedef char levelpack_box_check[(sizeof(Box) == 4*sizeof(int32_t)) ? 1 : -1];
+typedef char levelpack_point_check[(sizeof(Point) == 2*sizeof(int32_t)) ? 1 : -1];
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t levels_count;
+    int32_t wnd_w, wnd_h;
+    int32_t ball_r, hole_r, key_r;
+    int32_t shadow;
+} LevelpackHeader;
+
+typedef struct {
+    uint32_t count;
+    uint32_t offset;
+} LevelpackArray;
+
+typedef struct {
+    LevelpackArray boxes, holes, fins, keys;
+    int32_t init_x, init_y;
+} LevelpackLevel;
+
+//------------------------------------------------------------------------------
+
+static bool ReadHeader(FILE *f, LevelpackHeader *hdr)
+{
+    return (fread(hdr, sizeof(*hdr), 1, f) == 1 &&
+            !memcmp(hdr->magic, LEVELPACK_MAGIC, 4));
+}
+
+bool levelpack_is_binary(const char *fname)
+{
+    FILE *f = fopen(fname, "rb");
+    if (!f)
+        return false;
+    LevelpackHeader hdr;
+    bool res = ReadHeader(f, &hdr);
+    fclose(f);
+    return res;
+}
+
+static bool CheckArray(const LevelpackArray *a, size_t item_size, size_t size)
+{
+    return (a->offset % sizeof(int32_t) == 0 &&
+            a->offset <= size && a->count <= (size - a->offset) / item_size);
+}
+
+// maps the file and checks the header; the table is checked level by level
+static const LevelpackHeader *MapPack(const char *fname, size_t *size)
+{
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0)
+    {
+        log_error("can't open levelpack `%s'", fname);
+        return NULL;
+    }
+
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(LevelpackHeader))
+        data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        log_error("can't map levelpack `%s'", fname);
+        return NULL;
+    }
+
+    *size = st.st_size;
+    const LevelpackHeader *hdr = (const LevelpackHeader*)data;
+    if (memcmp(hdr->magic, LEVELPACK_MAGIC, 4) || hdr->version != LEVELPACK_VERSION ||
+        hdr->byte_order != LEVELPACK_BYTE_ORDER ||
+        hdr->levels_count > (*size - sizeof(LevelpackHeader)) / sizeof(LevelpackLevel))
+    {
+        log_error("levelpack `%s' has unsupported format", fname);
+        munmap(data, *size);
+        return NULL;
+    }
+    return hdr;
+}
+
+static void GetConfig(const LevelpackHeader *hdr, MazeConfig *config)
+{
+    config->wnd_w = hdr->wnd_w;
+    config->wnd_h = hdr->wnd_h;
+    config->ball_r = hdr->ball_r;
+    config->hole_r = hdr->hole_r;
+    config->key_r = hdr->key_r;
+    config->shadow = hdr->shadow;
+}
+
+// points the arrays of the level into the mapping, a level without
+// checkpoints can't be finished and is rejected
+static bool GetLevel(const LevelpackHeader *hdr, size_t size, int n, Level *lvl)
+{
+    const LevelpackLevel *l = &((const LevelpackLevel*)(hdr + 1))[n];
+    if (l->fins.count < 1)
+        return false;
+    if (!CheckArray(&l->boxes, sizeof(Box), size) || !CheckArray(&l->holes, sizeof(Point), size) ||
+        !CheckArray(&l->fins, sizeof(Point), size) || !CheckArray(&l->keys, sizeof(Point), size))
+        return false;
+
+    char *data = (char*)hdr;
+    lvl->boxes_count = l->boxes.count;
+    lvl->boxes = (Box*)(data + l->boxes.offset);
+    lvl->holes_count = l->holes.count;
+    lvl->holes = (Point*)(data + l->holes.offset);
+    lvl->fins_count = l->fins.count;
+    lvl->fins = (Point*)(data + l->fins.offset);
+    lvl->keys_count = l->keys.count;
+    lvl->keys = (Point*)(data + l->keys.offset);
+    lvl->init.x = l->init_x;
+    lvl->init.y = l->init_y;
+    return true;
+}
+
+bool levelpack_load_binary(const char *fname, MazeConfig *config, Level **levels, int *levels_count)
+{
+    size_t size;
+    const LevelpackHeader *hdr = MapPack(fname, &size);
+    if (!hdr)
+        return false;
+
+    Level *res = (Level*)calloc(hdr->levels_count, sizeof(Level));
+    for (uint32_t i=0; i<hdr->levels_count; i++)
+    {
+        if (!GetLevel(hdr, size, i, &res[i]))
+        {
+            log_error("levelpack `%s' is damaged or has no checkpoints at level %u", fname, i+1);
+            free(res);
+            munmap((void*)hdr, size);
+            return false;
+        }
+    }
+
+    GetConfig(hdr, config);
+    *levels = res;
+    *levels_count = hdr->levels_count;
+    //the mapping stays for the lifetime of the levels, that is the process
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+static const LevelpackHeader *open_hdr = NULL;
+static size_t open_size = 0;
+
+bool levelpack_open_binary(const char *fname, MazeConfig *config, int *levels_count)
+{
+    levelpack_close_binary();
+    open_hdr = MapPack(fname, &open_size);
+    if (!open_hdr)
+        return false;
+
+    GetConfig(open_hdr, config);
+    *levels_count = open_hdr->levels_count;
+    return true;
+}
+
+static void *CopyArray(const void *from, size_t size)
+{
+    void *res = malloc(size ? size : 1);
+    memcpy(res, from, size);
+    return res;
+}
+
+bool levelpack_read_binary_level(int n, Level *lvl)
+{
+    Level mapped;
+    if (!open_hdr || n < 0 || (uint32_t)n >= open_hdr->levels_count)
+        return false;
+    if (!GetLevel(open_hdr, open_size, n, &mapped))
+    {
+        log_error("level %d of the levelpack is damaged or has no checkpoints", n+1);
+        return false;
+    }
+
+    // copies, the transformations must not touch the mapped pack
+    *lvl = mapped;
+    lvl->boxes = (Box*)CopyArray(mapped.boxes, mapped.boxes_count * sizeof(Box));
+    lvl->holes = (Point*)CopyArray(mapped.holes, mapped.holes_count * sizeof(Point));
+    lvl->fins = (Point*)CopyArray(mapped.fins, mapped.fins_count * sizeof(Point));
+    lvl->keys = (Point*)CopyArray(mapped.keys, mapped.keys_count * sizeof(Point));
+    return true;
+}
+
+void levelpack_close_binary()
+{
+    if (open_hdr)
+        munmap((void*)open_hdr, open_size);
+    open_hdr = NULL;
+    open_size = 0;
+}
+
+//------------------------------------------------------------------------------
+
+static void PutArray(LevelpackArray *a, int count, size_t item_size, uint32_t *offset)
+{
+    a->count = count;
+    a->offset = (count > 0 ? *offset : 0);
+    *offset += count * item_size;
+}
+
+bool levelpack_write_binary(const char *fname, const MazeConfig *config, const Level *levels, int levels_count)
+{
+    LevelpackHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, LEVELPACK_MAGIC, 4);
+    hdr.version = LEVELPACK_VERSION;
+    hdr.byte_order = LEVELPACK_BYTE_ORDER;
+    hdr.levels_count = levels_count;
+    hdr.wnd_w = config->wnd_w;
+    hdr.wnd_h = config->wnd_h;
+    hdr.ball_r = config->ball_r;
+    hdr.hole_r = config->hole_r;
+    hdr.key_r = config->key_r;
+    hdr.shadow = config->shadow;
+
+    LevelpackLevel *table = (LevelpackLevel*)calloc(levels_count, sizeof(LevelpackLevel));
+    uint32_t offset = sizeof(LevelpackHeader) + levels_count * sizeof(LevelpackLevel);
+    for (int i=0; i<levels_count; i++)
+    {
+        const Level *l = &levels[i];
+        PutArray(&table[i].boxes, l->boxes_count, sizeof(Box), &offset);
+        PutArray(&table[i].holes, l->holes_count, sizeof(Point), &offset);
+        PutArray(&table[i].fins, l->fins_count, sizeof(Point), &offset);
+        PutArray(&table[i].keys, l->keys_count, sizeof(Point), &offset);
+        table[i].init_x = l->init.x;
+        table[i].init_y = l->init.y;
+    }
+
+    // a running game may have the old file mapped, so it's replaced, not rewritten
+    char *tmp_fname = (char*)malloc(strlen(fname) + strlen(".tmp") + 1);
+    sprintf(tmp_fname, "%s.tmp", fname);
+    FILE *f = fopen(tmp_fname, "wb");
+    if (!f)
+    {
+        log_error("can't create levelpack `%s'", tmp_fname);
+        free(tmp_fname);
+        free(table);
+        return false;
+    }
+
+    bool ok = (fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+               fwrite(table, sizeof(LevelpackLevel), levels_count, f) == (size_t)levels_count);
+    for (int i=0; i<levels_count && ok; i++)
+    {
+        const Level *l = &levels[i];
+        ok = (fwrite(l->boxes, sizeof(Box), l->boxes_count, f) == (size_t)l->boxes_count &&
+              fwrite(l->holes, sizeof(Point), l->holes_count, f) == (size_t)l->holes_count &&
+              fwrite(l->fins, sizeof(Point), l->fins_count, f) == (size_t)l->fins_count &&
+              fwrite(l->keys, sizeof(Point), l->keys_count, f) == (size_t)l->keys_count);
+    }
+    ok = (fclose(f) == 0) && ok;
+    ok = ok && (rename(tmp_fname, fname) == 0);
+    if (!ok)
+    {
+        log_error("can't write levelpack `%s'", fname);
+        unlink(tmp_fname);
+    }
+    free(tmp_fname);
+    free(table);
+    return ok;
+}
@@ -0,0 +1,49 @@
+/*  levelpack.h
+ *
+ *  Compiled binary levelpacks.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LEVELPACK_H
+#define LEVELPACK_H
+
+#include <stdbool.h>
+#include "mazecore/mazetypes.h"
+
+#define LEVELPACK_JSON_EXT ".levelpack.json"
+#define LEVELPACK_BINARY_EXT ".levelpack.bin"
+
+// The binary levelpack is the header, a table with the counts and the file
+// offsets of the arrays of every level, and the arrays themselves, packed in
+// the memory layout of Box and Point. The file is mapped into memory;
+// levelpack_load_binary() points all the levels into the mapping.
+
+bool levelpack_is_binary(const char *fname);
+bool levelpack_load_binary(const char *fname, MazeConfig *config, Level **levels, int *levels_count);
+
+// the open pack is indexed only, every level is read with its own copy of
+// the arrays
+bool levelpack_open_binary(const char *fname, MazeConfig *config, int *levels_count);
+bool levelpack_read_binary_level(int n, Level *lvl);
+void levelpack_close_binary();
+
+bool levelpack_write_binary(const char *fname, const MazeConfig *config, const Level *levels, int levels_count);
+
+#endif /* LEVELPACK_H */
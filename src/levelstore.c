@@ -0,0 +1,162 @@
+/*  levelstore.c
+ *
+ *  Decoded levels of the levelpack.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <SDL/SDL_thread.h>
+#include "levelstore.h"
+
+#define LOG_MODULE "LevelStore"
+#include "logging.h"
+
+typedef struct {
+    int level;
+    int holders;        // level_store_get() calls not yet given back
+    unsigned long used; // use_counter at the last access
+    Level lvl;
+} LevelStoreEntry;
+
+// entries are allocated one by one, the levels given out must not move
+static LevelStoreEntry **entries = NULL;
+static int entries_count = 0;
+static int entries_allocated = 0;
+static int entries_capacity = 0; // levels kept when nobody holds them
+static unsigned long use_counter = 0;
+static bool (*load_level)(int n, Level *lvl) = NULL;
+static void (*transform_level)(Level *lvl) = NULL;
+static SDL_mutex *lock = NULL;
+
+//------------------------------------------------------------------------------
+
+static void FreeEntry(LevelStoreEntry *e)
+{
+    free(e->lvl.boxes);
+    free(e->lvl.holes);
+    free(e->lvl.fins);
+    free(e->lvl.keys);
+    free(e);
+}
+
+static void RemoveEntry(int i)
+{
+    FreeEntry(entries[i]);
+    entries[i] = entries[--entries_count];
+}
+
+// drops the least recently used levels nobody holds
+static void Shrink(int capacity)
+{
+    while (entries_count > capacity)
+    {
+        int victim = -1;
+        for (int i=0; i<entries_count; i++)
+            if (entries[i]->holders == 0 && (victim < 0 || entries[i]->used < entries[victim]->used))
+                victim = i;
+        if (victim < 0)
+            return;
+        RemoveEntry(victim);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void level_store_init(int capacity, bool (*load)(int n, Level *lvl), void (*transform)(Level *lvl))
+{
+    level_store_free();
+    entries_capacity = (capacity > 0 ? capacity : 1);
+    entries_allocated = entries_capacity;
+    entries = (LevelStoreEntry**)malloc(entries_allocated * sizeof(LevelStoreEntry*));
+    load_level = load;
+    transform_level = transform;
+    lock = SDL_CreateMutex();
+}
+
+Level *level_store_get(int n)
+{
+    SDL_LockMutex(lock);
+
+    LevelStoreEntry *e = NULL;
+    for (int i=0; i<entries_count && !e; i++)
+        if (entries[i]->level == n)
+            e = entries[i];
+
+    if (!e)
+    {
+        // room for one more, unless all the levels are held; the array grows
+        // then, the capacity stays
+        Shrink(entries_capacity - 1);
+        if (entries_count == entries_allocated)
+        {
+            entries_allocated *= 2;
+            entries = (LevelStoreEntry**)realloc(entries, entries_allocated * sizeof(LevelStoreEntry*));
+        }
+
+        e = (LevelStoreEntry*)calloc(1, sizeof(LevelStoreEntry));
+        e->level = n;
+        if (!load_level(n, &e->lvl))
+        {
+            log_error("level %d can't be decoded", n+1);
+            FreeEntry(e);
+            SDL_UnlockMutex(lock);
+            return NULL;
+        }
+        if (transform_level)
+            transform_level(&e->lvl);
+        log_debug("level %d decoded", n+1);
+        entries[entries_count++] = e;
+    }
+
+    e->holders++;
+    e->used = ++use_counter;
+    SDL_UnlockMutex(lock);
+    return &e->lvl;
+}
+
+void level_store_put(Level *lvl)
+{
+    SDL_LockMutex(lock);
+    for (int i=0; i<entries_count; i++)
+        if (&entries[i]->lvl == lvl)
+        {
+            entries[i]->holders--;
+            break;
+        }
+    // back within the capacity once the levels over it are given back
+    Shrink(entries_capacity);
+    SDL_UnlockMutex(lock);
+}
+
+void level_store_free()
+{
+    for (int i=0; i<entries_count; i++)
+        FreeEntry(entries[i]);
+    free(entries);
+    entries = NULL;
+    entries_count = 0;
+    entries_allocated = 0;
+    entries_capacity = 0;
+    if (lock)
+        SDL_DestroyMutex(lock);
+    lock = NULL;
+}
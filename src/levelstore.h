@@ -0,0 +1,43 @@
+/*  levelstore.h
+ *
+ *  Decoded levels of the levelpack.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LEVELSTORE_H
+#define LEVELSTORE_H
+
+#include <stdbool.h>
+#include "mazecore/mazetypes.h"
+
+// Levels are decoded by load() and prepared for the screen by transform() on
+// the first access, and then kept for the capacity most recently used ones.
+// level_store_get() returns NULL for a level that can't be decoded, nothing
+// is kept of it and it's tried again on the next call. A level from it stays
+// valid until it's given back with level_store_put(). When more levels than
+// the capacity are held the store goes over it, and comes back within it as
+// they are given back. Safe to use from several threads.
+
+void level_store_init(int capacity, bool (*load)(int n, Level *lvl), void (*transform)(Level *lvl));
+Level *level_store_get(int n);
+void level_store_put(Level *lvl);
+void level_store_free();
+
+#endif /* LEVELSTORE_H */
@@ -21,20 +21,27 @@
  */
 
 #include <unistd.h>
-#include <dirent.h>
-#include <sys/stat.h>
 #include <librsvg/rsvg.h>
+#include <libxml/parser.h>
+#include <fontconfig/fontconfig.h>
 #include <SDL/SDL.h>
-#include <SDL/SDL_image.h>
 #include <SDL/SDL_ttf.h>
 #include "render.h"
+#include "levelcache.h"
+#include "levelstore.h"
+#include "gfxcache.h"
+#include "prerender.h"
+#include "dirtyrects.h"
 #include "mazecore/mazecore.h"
 #include "mazecore/mazehelpers.h"
 #include "paramsloader.h"
 #include "input/input.h"
 #include "vibro/vibro.h"
 #include "gui/gui_settings.h"
-#include "misc/IMG_SavePNG.h"
+#include "misc/hash.h"
+#include "misc/rawimage.h"
+#include "misc/workpool.h"
+#include "replay.h"
 #include "fonts.h"
 #include "types.h"
 
@@ -45,9 +52,12 @@ static InputInterface input = {0};
 static VibroInterface vibro = {0};
 static bool input_cal_cycle = false;
 static int disp_x = 0, disp_y = 0;
+static float geom_scale = 1;
+static bool geom_rot = false;
+static int geom_scaled_width = 0;
 
 static int game_levels_count = 0;
-Level *game_levels = NULL;
+Level *game_level = NULL; //of cur_level, held from the level store
 MazeConfig game_config = {0};
 static Prompt arguments = {0};
 static User *user_set = NULL;
@@ -66,6 +76,9 @@ SDL_Surface *fin_pic = NULL, *desk_pic = NULL, *wall_pic = NULL, *render_pic = N
 SDL_Rect desk_rect;
 
 static int LoadImgErrors = 0;
+//the formats ToDisplayFormat converts to, a cached image must be in one
+static const SDL_PixelFormat *opaque_format = NULL, *alpha_format = NULL;
+static SDL_Surface *alpha_probe = NULL;
 static bool can_cache = false;
 static bool ingame = false;
 
@@ -85,161 +98,273 @@ void BumpVibrate(float speed)
     vibro.bump(k);
 }
 
-void ClearCache(char *file, char *file_hash)
+typedef struct {
+    char *fname;
+    int hor_width, hor_height;
+    bool rot, cache;
+    SDL_Surface **res;
+
+    bool failed;
+    bool hashed;
+    bool loaded_from_cache;
+    uint64_t source_hash, key;
+    int ticks;
+} SvgJob;
+
+// Parses and rasterizes an image, may run on a worker thread. Everything
+// touching the shared state (errors counter, cache directory) is left to
+// FinishSvg.
+static void RasterizeSvg(void *arg)
 {
-    DIR *dir;
-    struct dirent *entry;
-
-    log_info("clearing old cache entries of `%s' from directory `%s'", file, cache_dir_full);
+    SvgJob *job = (SvgJob*)arg;
+    char *fname = job->fname;
+    int hor_width = job->hor_width, hor_height = job->hor_height;
+    bool rot = job->rot;
+    SDL_Surface *res = NULL;
+    int start_ticks = SDL_GetTicks();
 
-    dir = opendir(cache_dir_full);
-    if (dir == NULL)
-        return;
+    int res_width = (rot ? hor_height : hor_width);
+    int res_height = (rot ? hor_width : hor_height);
 
-    while ((entry = readdir(dir)) != NULL)
+    if (job->cache && can_cache)
     {
-        if (!strncmp(entry->d_name, file, strlen(file)) && strncmp(entry->d_name, file_hash, strlen(file_hash)))
+        //the cached pixels are in the display format
+        job->source_hash = HASH_INIT;
+        job->hashed = hash_file(&job->source_hash, fname);
+        job->key = gfx_cache_key(job->source_hash, res_width, res_height, rot, disp_bpp);
+        res = (job->hashed ? gfx_cache_load(job->key, res_width, res_height,
+                                              opaque_format, alpha_format) : NULL);
+        if (res)
         {
-            char *cached_file_full = (char*)malloc(strlen(cache_dir_full) + strlen("/") + strlen(entry->d_name) + 1);
-            sprintf(cached_file_full, "%s/%s", cache_dir_full, entry->d_name);
-            unlink(cached_file_full);
-            free(cached_file_full);
+            job->loaded_from_cache = true;
+            *job->res = res;
+            job->ticks = SDL_GetTicks() - start_ticks;
+            return;
         }
     }
 
-    closedir(dir);
+    GError *error = NULL;
+    RsvgHandle *rsvg_handle = rsvg_handle_new_from_file(fname, &error);
+    if (!rsvg_handle)
+    {
+        g_clear_error(&error);
+        job->failed = true;
+        *job->res = NULL;
+        return;
+    }
+
+    RsvgDimensionData dimensions;
+    rsvg_handle_get_dimensions(rsvg_handle, &dimensions);
+    int svg_width = dimensions.width;
+    int svg_height = dimensions.height;
+
+    float svg_koef = (float)svg_width / svg_height;
+    float hor_koef = (float)hor_width / hor_height;
+    float scale = (svg_koef > hor_koef ? (float)hor_height / svg_height : (float)hor_width / svg_width);
+
+    int scaled_width = (int)(svg_width * scale);
+    int scaled_height = (int)(svg_height * scale);
+
+    int stride = res_width * 4; /* 4 bytes/pixel (32bpp RGBA) */
+    void *image = calloc(stride * res_height, 1);
+    cairo_surface_t *cairo_surf = cairo_image_surface_create_for_data(
+            image, CAIRO_FORMAT_ARGB32,
+            res_width, res_height, stride);
+    cairo_t *cr = cairo_create(cairo_surf);
+
+    if (rot)
+    {
+        cairo_translate(cr, -(scaled_height-res_width)/2, res_height+(scaled_width-res_height)/2);
+        cairo_scale(cr, scale, scale);
+        cairo_rotate(cr, -M_PI/2);
+    }
+    else
+    {
+        cairo_translate(cr, -(scaled_width-res_width)/2, -(scaled_height-res_height)/2);
+        cairo_scale(cr, scale, scale);
+    }
+
+    rsvg_handle_render_cairo(rsvg_handle, cr);
+
+    //the pixels stay, they are the ones of the SDL surface
+    cairo_surface_finish(cairo_surf);
+    cairo_destroy(cr);
+    cairo_surface_destroy(cairo_surf);
+    g_object_unref(rsvg_handle);
+
+    uint32_t rmask = 0x00ff0000;
+    uint32_t gmask = 0x0000ff00;
+    uint32_t bmask = 0x000000ff;
+    uint32_t amask = 0xff000000;
+    //Notice that it matches CAIRO_FORMAT_ARGB32
+    res = SDL_CreateRGBSurfaceFrom(
+            (void*) image,
+            res_width, res_height,
+            32, //4 bytes/pixel = 32bpp
+            stride,
+            rmask, gmask, bmask, amask);
+
+    *job->res = res;
+    job->ticks = SDL_GetTicks() - start_ticks;
 }
 
-SDL_Surface *LoadImg(char *file, bool show_errors)
+static bool IsOpaque(SDL_Surface *surf)
 {
-    SDL_Surface *res = IMG_Load(file);
-    if (!res && show_errors)
+    const Uint32 amask = surf->format->Amask;
+    for (int y=0; y<surf->h; y++)
     {
-        log_error("can't load raster image `%s'", file);
+        const Uint32 *row = (const Uint32*)((Uint8*)surf->pixels + y*surf->pitch);
+        for (int x=0; x<surf->w; x++)
+            if ((row[x] & amask) != amask)
+                return false;
     }
-    return res;
+    return true;
 }
 
-SDL_Surface *LoadSvg(char *fname, int hor_width, int hor_height, bool rot, bool cache)
+// Converts a rasterized image to the format of the display, with the blits
+// of SDL, so it's drawn exactly as the original. Opaque images lose alpha.
+static SDL_Surface *ToDisplayFormat(SDL_Surface *res)
 {
-    SDL_Surface *res = NULL;
-    bool skip = false;
+    SDL_Surface *conv = (IsOpaque(res) ? SDL_DisplayFormat(res) : SDL_DisplayFormatAlpha(res));
+    if (!conv)
+        return res;
+
+    void *image = res->pixels;
+    SDL_FreeSurface(res);
+    free(image);
+    return conv;
+}
 
-    GError *error = NULL;
-    RsvgHandle *rsvg_handle = rsvg_handle_new_from_file(fname, &error);
-    if (!rsvg_handle)
+static void FinishSvg(SvgJob *job)
+{
+    if (job->failed)
     {
-        log_error("can't load vector image `%s'", fname);
+        log_error("can't load vector image `%s'", job->fname);
         LoadImgErrors++;
-        skip = true;
+        return;
     }
 
-    if (!skip)
+    if (job->loaded_from_cache)
     {
-        RsvgDimensionData dimensions;
-        rsvg_handle_get_dimensions(rsvg_handle, &dimensions);
-        int svg_width = dimensions.width;
-        int svg_height = dimensions.height;
-
-        float svg_koef = (float)svg_width / svg_height;
-        float hor_koef = (float)hor_width / hor_height;
-        float scale = (svg_koef > hor_koef ? (float)hor_height / svg_height : (float)hor_width / svg_width);
-
-        int scaled_width = (int)(svg_width * scale);
-        int scaled_height = (int)(svg_height * scale);
-
-        int res_width = (rot ? hor_height : hor_width);
-        int res_height = (rot ? hor_width : hor_height);
-
-        bool loaded_from_cache = false;
-        char *cached_file_full = NULL;
-        char *file = NULL;
-        char *file_hash = NULL;
-        if (cache && can_cache)
-        {
-            int mod_time = 0;
-            struct stat st;
-            if (stat(fname, &st) == 0)
-                mod_time = st.st_mtime;
-
-            char *last_slash_ptr = strrchr(fname, '/');
-            file = (last_slash_ptr ? last_slash_ptr + 1 : fname);
-            int max_overhead = 64;
-            cached_file_full = (char*)malloc(strlen(cache_dir_full) + strlen("/") + strlen(file) + max_overhead + 1);
-            file_hash = (char*)malloc(strlen(file) + max_overhead + 1);
-
-            char *state = (rot ? "rotated" : "normal");
-            sprintf(cached_file_full, "%s/%s_%x-%dx%d-%s.png", cache_dir_full, file, mod_time, res_width, res_height, state);
-            sprintf(file_hash, "%s_%x", file, mod_time);
-
-            res = LoadImg(cached_file_full, false);
-            if (res)
-            {
-                log_info("vector image `%s' was loaded from cache `%s'", fname, cached_file_full);
-                loaded_from_cache = true;
-            }
-        }
+        gfx_cache_touch(job->key);
+        log_info("vector image `%s' was loaded from cache", job->fname);
+        return;
+    }
+    if (!job->cache || !*job->res)
+        return;
 
-        if (!loaded_from_cache)
-        {
-            int stride = res_width * 4; /* 4 bytes/pixel (32bpp RGBA) */
-            void *image = calloc(stride * res_height, 1);
-            cairo_surface_t *cairo_surf = cairo_image_surface_create_for_data(
-                    image, CAIRO_FORMAT_ARGB32,
-                    res_width, res_height, stride);
-            cairo_t *cr = cairo_create(cairo_surf);
-
-            if (rot)
-            {
-                cairo_translate(cr, -(scaled_height-res_width)/2, res_height+(scaled_width-res_height)/2);
-                cairo_scale(cr, scale, scale);
-                cairo_rotate(cr, -M_PI/2);
-            }
-            else
-            {
-                cairo_translate(cr, -(scaled_width-res_width)/2, -(scaled_height-res_height)/2);
-                cairo_scale(cr, scale, scale);
-            }
+    *job->res = ToDisplayFormat(*job->res);
+    if (job->hashed)
+    {
+        if (gfx_cache_store(job->key, job->source_hash, job->rot, *job->res))
+            log_info("vector image `%s' was cached", job->fname);
+        else
+            log_error("can't cache vector image `%s'", job->fname);
+    }
+}
 
-            rsvg_handle_render_cairo(rsvg_handle, cr);
-
-            cairo_surface_finish(cairo_surf);
-            cairo_destroy(cr);
-
-            uint32_t rmask = 0x00ff0000;
-            uint32_t gmask = 0x0000ff00;
-            uint32_t bmask = 0x000000ff;
-            uint32_t amask = 0xff000000;
-            //Notice that it matches CAIRO_FORMAT_ARGB32
-            res = SDL_CreateRGBSurfaceFrom(
-                    (void*) image,
-                    res_width, res_height,
-                    32, //4 bytes/pixel = 32bpp
-                    stride,
-                    rmask, gmask, bmask, amask);
-        }
+// librsvg sets up glib, libxml2 and fontconfig on the first use, which isn't
+// safe to do from several threads at once
+static void InitSvg()
+{
+    static bool svg_initialized = false;
+    if (svg_initialized)
+        return;
+#if !GLIB_CHECK_VERSION(2,32,0)
+    if (!g_thread_supported())
+        g_thread_init(NULL);
+#endif
+#if !LIBRSVG_CHECK_VERSION(2,36,0)
+    rsvg_init();
+#endif
+    xmlInitParser();
+    FcInit();
+    //registers the types of the handle
+    g_object_unref(rsvg_handle_new());
+    svg_initialized = true;
+}
+
+// Loads the images concurrently, every one into its own cairo surface
+static void LoadSvgs(SvgJob *jobs, int jobs_count)
+{
+    int start_ticks = SDL_GetTicks();
+    InitSvg();
+
+    if (!alpha_probe)
+    {
+        SDL_Surface *probe = SDL_CreateRGBSurface(SDL_SWSURFACE, 1, 1, 32,
+                                                  0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000);
+        alpha_probe = (probe ? SDL_DisplayFormatAlpha(probe) : NULL);
+        SDL_FreeSurface(probe);
+    }
+    opaque_format = SDL_GetVideoSurface()->format;
+    alpha_format = (alpha_probe ? alpha_probe->format : NULL);
+
+    int threads_count = min(jobs_count, workpool_get_cpus_count());
+    WorkPool *pool = workpool_create(threads_count, NULL, NULL);
+    for (int i=0; i<jobs_count; i++)
+        workpool_submit(pool, RasterizeSvg, &jobs[i]);
+    workpool_wait(pool);
+    workpool_destroy(pool);
 
-        if (cache && can_cache)
+    for (int i=0; i<jobs_count; i++)
+    {
+        FinishSvg(&jobs[i]);
+        if (!jobs[i].failed)
+            log_info("vector image `%s' took %d ms", jobs[i].fname, jobs[i].ticks);
+    }
+    gfx_cache_sync();
+    log_info("%d vector images were loaded in %d ms by %d threads",
+             jobs_count, (int)(SDL_GetTicks() - start_ticks), threads_count);
+}
+
+static void FreeSvgs(SvgJob *jobs, int jobs_count)
+{
+    for (int i=0; i<jobs_count; i++)
+    {
+        SDL_Surface *res = *jobs[i].res;
+        if (!res)
+            continue;
+        if (jobs[i].cache)
+            raw_image_free(res);
+        else
         {
-            if (!loaded_from_cache && res)
-            {
-                if (TouchDir(save_dir_full) && TouchDir(cache_dir_full))
-                {
-                    ClearCache(file, file_hash);
-                    if (IMG_SavePNG(res, cached_file_full) == 0)
-                        log_info("vector image `%s' was cached to `%s'", fname, cached_file_full);
-                    else
-                        log_error("can't cache vector image `%s' to `%s'", fname, cached_file_full);
-                }
-                else
-                    can_cache = false;
-            }
-            free(cached_file_full);
-            free(file_hash);
+            void *image = res->pixels;
+            SDL_FreeSurface(res);
+            free(image);
         }
+        *jobs[i].res = NULL;
     }
-    
-    return res;
+    SDL_FreeSurface(alpha_probe);
+    alpha_probe = NULL;
+    opaque_format = alpha_format = NULL;
+}
+
+//------------------------------------------------------------------------------
+
+#define LEVEL_CACHE_SIZE 6
+
+void InitLevelCache()
+{
+    //a rendered level depends on its own content, which the level cache
+    //hashes as it's loaded, and on the images and the screen
+    uint64_t h = HASH_INIT;
+    hash_file(&h, MDIR "desk.svg");
+    hash_file(&h, MDIR "wall.svg");
+    hash_file(&h, MDIR "openmoko.svg");
+    int config_sizes[] = { game_config.wnd_w, game_config.wnd_h, game_config.hole_r,
+                           game_config.key_r, game_config.shadow };
+    h = hash_data(h, config_sizes, sizeof(config_sizes));
+
+    int max_overhead = 64;
+    char *prefix = (char*)malloc(max_overhead + 1);
+    sprintf(prefix, "%016llx-%dx%d-%d-%s", (unsigned long long)h,
+            game_config.wnd_w, game_config.wnd_h, disp_bpp, (geom_rot ? "rotated" : "normal"));
+
+    //on disk the levels are entries of the graphics cache, opened with the
+    //images; the ones of an older pack are evicted with the rest
+    level_cache_init(LEVEL_CACHE_SIZE, user_set->level_cache_disk && can_cache, prefix);
+    free(prefix);
 }
 
 //------------------------------------------------------------------------------
@@ -323,23 +448,9 @@ void ApplyArguments()
 
 #define swap(x,y) swap_t(int,x,y)
 
-#define rotate(x,y,w) \
-{ \
-    int _tmpx = x; \
-    x = (w-1)-y; \
-    y = _tmpx; \
-}
-
-#define scale(x,y,s) \
-{ \
-    x *= s; y *= s; \
-}
-
-#define scale_rotate(x,y,s,r,w) \
-{ \
-    scale(x, y, s); \
-    if (r) \
-        rotate(x, y, w); \
+static void TransformLevel(Level *lvl)
+{
+    transform_level(lvl, geom_scale, geom_rot, geom_scaled_width);
 }
 
 bool TransformGeom()
@@ -373,46 +484,9 @@ bool TransformGeom()
         disp_y = game_config.wnd_h;
     }
 
-    for (int i=0; i<game_levels_count; i++)
-    {
-        Level *lvl = &game_levels[i];
-        for (int j=0; j<lvl->boxes_count; j++)
-        {
-            Box *box = &lvl->boxes[j];
-            scale(box->x1, box->y1, scale);
-            scale(box->x2, box->y2, scale);
-            if (rot)
-            {
-                rotate(box->x1, box->y1, scaled_width);
-                rotate(box->x2, box->y2, scaled_width);
-                if (box->x1 > box->x2)
-                    swap(box->x1, box->x2);
-                if (box->y1 > box->y2)
-                    swap(box->y1, box->y2);
-            }
-        }
-
-        for (int j=0; j<lvl->fins_count; j++)
-        {
-            Point *p = &lvl->fins[j];
-            scale_rotate(p->x, p->y, scale, rot, scaled_width);
-        }
-
-        for (int j=0; j<lvl->holes_count; j++)
-        {
-            Point *p = &lvl->holes[j];
-            scale_rotate(p->x, p->y, scale, rot, scaled_width);
-        }
-
-        for (int j=0; j<lvl->keys_count; j++)
-        {
-            Point *p = &lvl->keys[j];
-            scale_rotate(p->x, p->y, scale, rot, scaled_width);
-        }
-
-        Point *p = &lvl->init;
-        scale_rotate(p->x, p->y, scale, rot, scaled_width);
-    }
+    geom_scale = scale;
+    geom_rot = rot;
+    geom_scaled_width = scaled_width;
 
     return (pack_koef < 1);
 }
@@ -449,14 +523,56 @@ void SetVibro()
     vibro.init();
 }
 
-void ChangeLevel(int new_level, bool *redraw_all, bool *wasclick)
+void StartRecording()
 {
-    RedrawDesk();
+    ReplayHeader hdr = {{0}};
+    hdr.config = game_config;
+    hdr.scale = geom_scale;
+    hdr.rot = geom_rot;
+    hdr.scaled_width = geom_scaled_width;
+    hdr.fixed_step = user_set->fixed_step;
+    snprintf(hdr.levelpack, sizeof(hdr.levelpack), "%s", GetLevelpackFile());
+    replay_record_start(arguments.record_file, &hdr);
+}
+
+// Makes the level current and renders it; a level that can't be loaded
+// leaves the current one as it was
+bool RenderCurLevel(int new_level)
+{
+    Level *lvl = level_store_get(new_level);
+    if (!lvl)
+    {
+        log_error("level %d can't be loaded", new_level+1);
+        return false;
+    }
+    if (game_level)
+        level_store_put(game_level);
+    game_level = lvl;
     cur_level = new_level;
-    RenderLevel();
+
+    //usually already rendered by the prerender thread, the level is held so
+    //rendering it here can't fail
+    if (!prerender_take(cur_level, &render_pic))
+        RenderLevel();
+
+    int prev_level = cur_level - 1;
+    int next_level = (cur_level+1 < game_levels_count ? cur_level+1 : 0);
+    prerender_request(prev_level, next_level);
+    return true;
+}
+
+void ChangeLevel(int new_level, bool *redraw_all, bool *wasclick)
+{
     RedrawDesk();
-    maze_set_level(cur_level);
-    ResetPrevPos();
+    if (RenderCurLevel(new_level))
+    {
+        RedrawDesk();
+        //the physics is rebuilt here, it isn't prepared by the prerender thread;
+        //the level is held by game_level, so the store has it
+        maze_set_level(cur_level);
+        replay_record_level(cur_level);
+        ResetPrevPos();
+    }
     *redraw_all = true;
     *wasclick = true; //
 }
@@ -465,7 +581,6 @@ void ChangeLevel(int new_level, bool *redraw_all, bool *wasclick)
 void render_window()
 {
     game_config = GetGameConfig();
-    game_levels = GetGameLevels();
     game_levels_count = GetGameLevelsCount();
 
     arguments = GetArguments();
@@ -564,23 +679,40 @@ void render_window()
     SDL_FreeSurface(titleSurface);
 
 //-- load pictures -------------------------------------------------------------
-    SDL_Surface *back_pic     = LoadSvg(MDIR "prev-main.svg", btn_side, btn_side, false, false);
-    SDL_Surface *forward_pic  = LoadSvg(MDIR "next-main.svg", btn_side, btn_side, false, false);
-    SDL_Surface *settings_pic = LoadSvg(MDIR "settings-main.svg", btn_side, btn_side, false, false);
-    SDL_Surface *exit_pic     = LoadSvg(MDIR "close-main.svg", btn_side, btn_side, false, false);
-
-    SDL_Surface *back_i_pic    = LoadSvg(MDIR "prev-grey.svg", btn_side, btn_side, false, false);
-    SDL_Surface *forward_i_pic = LoadSvg(MDIR "next-grey.svg", btn_side, btn_side, false, false);
-
-    SDL_Surface *back_p_pic    = LoadSvg(MDIR "prev-light.svg", btn_side, btn_side, false, false);
-    SDL_Surface *forward_p_pic = LoadSvg(MDIR "next-light.svg", btn_side, btn_side, false, false);
+    SDL_Surface *back_pic, *forward_pic, *settings_pic, *exit_pic;
+    SDL_Surface *back_i_pic, *forward_i_pic;
+    SDL_Surface *back_p_pic, *forward_p_pic;
 
     int tmpx = (rot ? game_config.wnd_h : game_config.wnd_w);
     int tmpy = (rot ? game_config.wnd_w : game_config.wnd_h);
-    desk_pic = LoadSvg(MDIR "desk.svg", tmpx, tmpy, rot, true);
-    wall_pic = LoadSvg(MDIR "wall.svg", tmpx, tmpy, rot, true);
     int hole_d = game_config.hole_r * 2;
-    fin_pic = LoadSvg(MDIR "openmoko.svg", hole_d, hole_d, rot, false);
+
+    //the big ones first, so they don't end up last on a busy thread
+    SvgJob svg_jobs[] = {
+        {MDIR "desk.svg", tmpx, tmpy, rot, true, &desk_pic},
+        {MDIR "wall.svg", tmpx, tmpy, rot, true, &wall_pic},
+        //not cached, DrawBlended needs it in the 32bpp format of cairo
+        {MDIR "openmoko.svg", hole_d, hole_d, rot, false, &fin_pic},
+
+        {MDIR "prev-main.svg", btn_side, btn_side, false, true, &back_pic},
+        {MDIR "next-main.svg", btn_side, btn_side, false, true, &forward_pic},
+        {MDIR "settings-main.svg", btn_side, btn_side, false, true, &settings_pic},
+        {MDIR "close-main.svg", btn_side, btn_side, false, true, &exit_pic},
+
+        {MDIR "prev-grey.svg", btn_side, btn_side, false, true, &back_i_pic},
+        {MDIR "next-grey.svg", btn_side, btn_side, false, true, &forward_i_pic},
+
+        {MDIR "prev-light.svg", btn_side, btn_side, false, true, &back_p_pic},
+        {MDIR "next-light.svg", btn_side, btn_side, false, true, &forward_p_pic},
+    };
+    if (can_cache && TouchDir(save_dir_full) && TouchDir(cache_dir_full))
+        gfx_cache_open(cache_dir_full);
+    else
+    {
+        can_cache = false;
+        gfx_cache_open(NULL);
+    }
+    LoadSvgs(svg_jobs, sizeof(svg_jobs) / sizeof(svg_jobs[0]));
 
     if (LoadImgErrors > 0)
     {
@@ -636,8 +768,6 @@ void render_window()
     screen_rect.y = 0;
     screen_rect.w = disp_x;
     screen_rect.h = disp_y;
-    SDL_Rect disp_rect;
-    disp_rect = screen_rect;
     
     SDL_Color ballColor = {0};
     ballColor.r = 255;
@@ -652,6 +782,11 @@ void render_window()
 
     /* Render initialization */
     InitRender();
+    //levels are transformed to the geometry above as they are loaded
+    #define LEVEL_STORE_SIZE 8
+    level_store_init(LEVEL_STORE_SIZE, LoadGameLevel, TransformLevel);
+    InitLevelCache();
+    prerender_init(render_pic);
 
     /* Input system initialization */
     input_get_dummy(&input);
@@ -665,12 +800,21 @@ void render_window()
     maze_init();
     maze_set_config(game_config);
     maze_set_vibro_callback(BumpVibrate);
-    maze_set_levels_data(game_levels, game_levels_count);
+    maze_set_level_source(level_store_get, level_store_put);
+    maze_set_fixed_step(user_set->fixed_step);
+    if (arguments.record_file)
+        StartRecording();
 
-    cur_level = start_level;
-    RenderLevel();
+    if (!RenderCurLevel(start_level))
+    {
+        log_error("The first level can't be loaded. Exiting.");
+        prerender_shutdown();
+        level_store_free();
+        return;
+    }
     RedrawDesk();
     maze_set_level(cur_level);
+    replay_record_level(cur_level);
     ResetPrevPos();
 
     SDL_Event event;
@@ -679,6 +823,8 @@ void render_window()
     bool ingame_changed = false;
     int prev_ticks = SDL_GetTicks();
     Point mouse = {0};
+    long long pushed_pixels = 0;
+    int pushed_frames = 0;
     
 //== Game Loop =================================================================
     while (!done)
@@ -761,7 +907,8 @@ void render_window()
                         if (cur_level > 0)
                         {
                             SDL_BlitSurface(back_p_pic, NULL, gui_surface, &gui_rect_1);
-                            SDL_UpdateRect(gui_surface, gui_rect_1.x, gui_rect_1.y, gui_rect_1.w, gui_rect_1.h);
+                            dirty_add_rect(&gui_rect_1);
+                            dirty_flush(gui_surface);
 
                             ChangeLevel(cur_level-1, &redraw_all, &wasclick);
 
@@ -776,7 +923,8 @@ void render_window()
                         if (cur_level < game_levels_count - 1)
                         {
                             SDL_BlitSurface(forward_p_pic, NULL, gui_surface, &gui_rect_2);
-                            SDL_UpdateRect(gui_surface, gui_rect_2.x, gui_rect_2.y, gui_rect_2.w, gui_rect_2.h);
+                            dirty_add_rect(&gui_rect_2);
+                            dirty_flush(gui_surface);
 
                             ChangeLevel(cur_level+1, &redraw_all, &wasclick);
 
@@ -837,12 +985,14 @@ void render_window()
                 if (fastchange_dostep < 0)
                 {
                     SDL_BlitSurface(back_p_pic, NULL, gui_surface, &gui_rect_1);
-                    SDL_UpdateRect(gui_surface, gui_rect_1.x, gui_rect_1.y, gui_rect_1.w, gui_rect_1.h);
+                    dirty_add_rect(&gui_rect_1);
+                    dirty_flush(gui_surface);
                 }
                 else
                 {
                     SDL_BlitSurface(forward_p_pic, NULL, gui_surface, &gui_rect_2);
-                    SDL_UpdateRect(gui_surface, gui_rect_2.x, gui_rect_2.y, gui_rect_2.w, gui_rect_2.h);
+                    dirty_add_rect(&gui_rect_2);
+                    dirty_flush(gui_surface);
                 }
 
                 ChangeLevel(new_cur_level, &redraw_all, &wasclick);
@@ -870,6 +1020,8 @@ void render_window()
         input_calibration_adjust(&user_set->input_calibration_data, &acx, &acy, NULL);
         maze_set_speed(user_set->ball_speed);
         maze_set_tilt(acx, acy, 0);
+        replay_record_speed(user_set->ball_speed);
+        replay_record_frame(delta_ticks, acx, acy);
         GameState game_state = maze_step(delta_ticks);
 
         const dReal *R;
@@ -888,43 +1040,11 @@ void render_window()
         UpdateBufAnimation();
         DrawBall(tk_px, tk_py, tk_pz, R, ballColor);
 
-        //update the screen
-        if (!redraw_all && !user_set->scrolling)
-        {
-            int min_px, max_px;
-            int min_py, max_py;
-            if (prev_px <= tk_px)
-            {
-                min_px = prev_px;
-                max_px = tk_px;
-            }
-            else
-            {
-                min_px = tk_px;
-                max_px = prev_px;
-            }
-
-            if (prev_py <= tk_py)
-            {
-                min_py = prev_py;
-                max_py = tk_py;
-            }
-            else
-            {
-                min_py = tk_py;
-                max_py = prev_py;
-            }
-            min_px -= game_config.ball_r;
-            max_px += game_config.ball_r;
-            min_py -= game_config.ball_r;
-            max_py += game_config.ball_r;
-            clamp_min(min_px, 0);
-            clamp_max(max_px, game_config.wnd_w - 1);
-            clamp_min(min_py, 0);
-            clamp_max(max_py, game_config.wnd_h - 1);
-            SDL_UpdateRect(screen, min_px, min_py, max_px - min_px, max_py - min_py);
-            UpdateScreenAnimation();
-        }
+        //collect the changed parts of the screen, old and new ball separately
+        int ball_d = game_config.ball_r * 2 + 1;
+        dirty_add(prev_px - game_config.ball_r, prev_py - game_config.ball_r, ball_d, ball_d);
+        dirty_add(tk_px - game_config.ball_r, tk_py - game_config.ball_r, ball_d, ball_d);
+        UpdateScreenAnimation();
 
         if (user_set->scrolling)
         {
@@ -934,7 +1054,9 @@ void render_window()
             clamp_max(screen_rect.y, tk_py - disp_scroll_border);
             clamp(screen_rect.x, 0, game_config.wnd_w - disp_x);
             clamp(screen_rect.y, 0, game_config.wnd_h - disp_y);
-            SDL_BlitSurface(screen, &screen_rect, disp, &disp_rect);
+            if (redraw_all)
+                dirty_add_all();
+            dirty_copy_view(screen, &screen_rect, disp);
         }
 
         prev_px = tk_px;
@@ -966,16 +1088,13 @@ void render_window()
         }
 //------------------------------------------------------------------------------
 
-        //update the whole screen if needed
-        if (user_set->scrolling)
-        {
-            SDL_Flip(disp);
-        }
-        else if (redraw_all)
-        {
-            SDL_Flip(screen);
-        }
+        //update the screen, the whole one if needed
+        if (redraw_all)
+            dirty_add_all();
+        dirty_flush(user_set->scrolling ? disp : screen);
         redraw_all = false;
+        pushed_pixels += dirty_get_stats().pixels;
+        pushed_frames++;
 
         if (show_settings)
         {
@@ -1000,20 +1119,31 @@ void render_window()
         case GAME_STATE_FAILED:
             RedrawDesk();
             maze_restart_level();
+            replay_record_restart();
             ResetPrevPos();
             redraw_all = true;
             break;
         case GAME_STATE_SAVED:
             RedrawDesk();
             maze_reload_level();
+            replay_record_reload();
             ResetPrevPos();
             redraw_all = true;
             break;
         case GAME_STATE_WIN:
-            if (++cur_level >= game_levels_count) cur_level=0;
-            RenderLevel();
-            RedrawDesk();
-            maze_set_level(cur_level);
+            //when the next level can't be loaded, this one is played again
+            if (RenderCurLevel(cur_level+1 < game_levels_count ? cur_level+1 : 0))
+            {
+                RedrawDesk();
+                maze_set_level(cur_level);
+                replay_record_level(cur_level);
+            }
+            else
+            {
+                RedrawDesk();
+                maze_restart_level();
+                replay_record_restart();
+            }
             ResetPrevPos();
             redraw_all = true;
             break;
@@ -1035,10 +1165,22 @@ void render_window()
         user_set->frame_delay = user_set_new.frame_delay;
     }
     
+    replay_record_stop();
+
+    if (pushed_frames > 0)
+        log_debug("%lld pixels pushed to the display per frame", pushed_pixels / pushed_frames);
+
     user_set->level = cur_level + 1;
     SaveUserSettings();
 
     settings_shutdown();
+    prerender_shutdown();
+    level_cache_free();
+    level_store_free();
+    game_level = NULL;
+    FreeRender();
+    FreeSvgs(svg_jobs, sizeof(svg_jobs) / sizeof(svg_jobs[0]));
+    gfx_cache_close();
 
     SDL_FreeSurface(levelTextSurface);
     TTF_CloseFont(font);
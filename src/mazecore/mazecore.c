@@ -21,149 +21,219 @@
  */
 
 #include <math.h>
+#include <stdlib.h>
 #include <ode/ode.h>
 
 #include "mazecore.h"
 #include "mazehelpers.h"
+#include "mazegrid.h"
 
 #define GRAV_CONST 9.81*1.0
-#define PHYS_SCALE (100.0*game_config.ball_r/23)
+#define PHYS_SCALE (100.0*w->config.ball_r/23)
 #define DEFAULT_FORCE_COEF 0.45
 
-static MazeConfig game_config;
-static Level *game_levels = NULL;
-static int game_levels_count = 0;
-static int cur_level = 0;
-
-static GameState new_game_state;
-static float acx = 0, acy = 0, acz = 0;
-static float force_coef = DEFAULT_FORCE_COEF;
-static int ball_pos_x = 0, ball_pos_y = 0, ball_pos_z = 0;
-static const dReal *ball_rot = NULL;
-
-static Animation final_anim;
-static Animation *keys_anim = NULL;
-static int keys_passed = 0;
-static int save_key = -1;
-
-static void (*vibro_callback)(float) = NULL;
+// wall of a falling hole, the inner radius and the height range around the
+// hole axis, in physical units
+typedef struct {
+    float r;
+    float z1, z2;
+} HoleRing;
+
+#define MAX_FALL_RINGS 3
+#define MAX_STEP_CONTACTS 64
+
+struct MazeWorld {
+    MazeConfig config;
+    Level *levels;
+    int levels_count;
+    int cur_level;
+    // the current level, from levels or held from the level source until
+    // another one is set
+    Level *level;
+    Level *(*get_level)(int n);
+    void (*put_level)(Level *lvl);
+
+    GameState new_game_state;
+    float acx, acy, acz;
+    float force_coef;
+    int ball_pos_x, ball_pos_y, ball_pos_z;
+    const dReal *ball_rot;
+
+    Animation final_anim;
+    Animation *keys_anim;
+    int keys_passed;
+    int save_key;
+
+    void (*vibro_callback)(float);
+    MazeBroadphase broadphase;
+
+    // fixed timestep mode: simulated time not yet stepped, and the pose
+    // before the last step to interpolate the reported ball from
+    bool fixed_step;
+    double accumulator;
+    dReal prev_pos[3];
+    dQuaternion prev_quat;
+    dMatrix3 interp_rot;
+
+    // ring of the last SNAPSHOTS_COUNT snapshots taken every SNAPSHOT_INTERVAL
+    // steps, with the key animations of all of them in one block
+    MazeSnapshot *history;
+    Animation *history_anims;
+    int history_head;
+    int history_count;
+    int snapshot_age;
+
+    // dynamics and collision objects
+    dGeomID plane;
+    dSpaceID space;
+    dWorldID world;
+    dBodyID body;
+    dGeomID geom;
+    dMass mass;
+    dJointGroupID contactgroup;
+
+    // contacts of the current step, their surfaces are set once at creation;
+    // joints are made for all of them after the collision stage
+    dContact contacts[MAX_STEP_CONTACTS];
+    dBodyID contact_bodies[MAX_STEP_CONTACTS][2];
+    int contacts_count;
+    // the strongest wall hit of the current maze_world_step()
+    bool bumped;
+    float max_impact;
+
+    // level walls and window frame; with MAZE_BROADPHASE_GRID they are kept
+    // out of the space and looked up through wall_grid
+    dGeomID *static_geoms;
+    int static_count;
+    MazeGrid wall_grid;
+    int *candidates;
+
+    // holes and keys of the level in window coordinates, for testbump()
+    MazeGrid hole_grid;
+    MazeGrid key_grid;
+
+    bool fall;
+    bool fall_fixed;
+    Point fall_hole;
+    HoleRing fall_rings[MAX_FALL_RINGS];
+    int fall_rings_count;
+
+    MazeStats stats;
+};
+
+static MazeWorld *default_world = NULL;
 
 //==============================================================================
 
-// dynamics and collision objects
-static dGeomID plane;
-static dSpaceID space;
-static dWorldID world;
-static dBodyID body;
-static dGeomID geom;
-static dMass mass;
-static dJointGroupID contactgroup;
-
-static bool fall = false;
-static bool fall_fixed = false;
-static Point fall_hole;
-
-#define BALL_R_PHYS game_config.ball_r/PHYS_SCALE
-#define BALL_SHIFT  game_config.ball_r/100.0
-#define WALL_H_PHYS ((game_config.ball_r+1)*(1+BALL_SHIFT)*2/PHYS_SCALE)
+#define BALL_R_PHYS w->config.ball_r/PHYS_SCALE
+#define BALL_SHIFT  w->config.ball_r/100.0
+#define WALL_H_PHYS ((w->config.ball_r+1)*(1+BALL_SHIFT)*2/PHYS_SCALE)
 #define WALL_W_PHYS BALL_R_PHYS
 
-#define WND_W_PHYS game_config.wnd_w/PHYS_SCALE
-#define WND_H_PHYS game_config.wnd_h/PHYS_SCALE
-#define HOLE_DEPTH_PHYS (game_config.ball_r*2/PHYS_SCALE)
-#define BOX_SHIFT(x) (game_config.hole_r + x*game_config.ball_r)/PHYS_SCALE
+#define WND_W_PHYS w->config.wnd_w/PHYS_SCALE
+#define WND_H_PHYS w->config.wnd_h/PHYS_SCALE
+#define HOLE_DEPTH_PHYS (w->config.ball_r*2/PHYS_SCALE)
+#define BOX_SHIFT(x) (w->config.hole_r + x*w->config.ball_r)/PHYS_SCALE
 #define BOX_SHIFT_CLOSE BOX_SHIFT(1.0/2.0)
 #define BOX_SHIFT_FAR BOX_SHIFT(3.0/2.0)
 #define HOLE_X_PHYS hole.x/PHYS_SCALE
 #define HOLE_Y_PHYS hole.y/PHYS_SCALE
 
-#define CYLINDER_SIDES 16
-void CreateCylinder(Point hole, float r, float h, float z)
+#define SNAPSHOTS_COUNT 32
+#define SNAPSHOT_INTERVAL 8
+
+static void AddHoleRing(MazeWorld *w, float r, float h, float z)
 {
-    for (int i=0; i<CYLINDER_SIDES; i++)
-    {
-        float a = 2*M_PI*i/CYLINDER_SIDES;
-        float x = cos(a);
-        float y = sin(a);
-        dGeomID wall = dCreateBox(space, WALL_W_PHYS, WND_H_PHYS, h);
-        dGeomSetPosition(wall, HOLE_X_PHYS + x*r, HOLE_Y_PHYS + y*r, z);
-        dMatrix3 rot;
-        dRFromAxisAndAngle(rot,0,0,1,a);
-        dGeomSetRotation(wall,rot);
-    }
+    HoleRing *ring = &w->fall_rings[w->fall_rings_count++];
+    ring->r = r - WALL_W_PHYS/2.0;
+    ring->z1 = z - h/2.0;
+    ring->z2 = z + h/2.0;
 }
 
-void GoFall(Point hole)
+static void RemoveHoleRings(MazeWorld *w)
 {
-    dWorldSetGravity(world,0,0, -(GRAV_CONST*0.5)*1.6);
-    dGeomPlaneSetParams(plane, 0,0,1, -HOLE_DEPTH_PHYS);
+    w->fall_rings_count = 0;
+}
 
-    CreateCylinder(hole, BOX_SHIFT_CLOSE, HOLE_DEPTH_PHYS, -HOLE_DEPTH_PHYS/2.0);
-    CreateCylinder(hole, BOX_SHIFT_FAR, WALL_H_PHYS, WALL_H_PHYS/2.0);
+static void GoFall(MazeWorld *w, Point hole)
+{
+    dWorldSetGravity(w->world,0,0, -(GRAV_CONST*0.5)*1.6);
+    dGeomPlaneSetParams(w->plane, 0,0,1, -HOLE_DEPTH_PHYS);
 
-    fall = true;
-    fall_hole = hole;
+    AddHoleRing(w, BOX_SHIFT_CLOSE, HOLE_DEPTH_PHYS, -HOLE_DEPTH_PHYS/2.0);
+    AddHoleRing(w, BOX_SHIFT_FAR, WALL_H_PHYS, WALL_H_PHYS/2.0);
+
+    w->fall = true;
+    w->fall_hole = hole;
 }
 
-void GoFallFixed(Point hole)
+static void GoFallFixed(MazeWorld *w, Point hole)
 {
-    CreateCylinder(hole, BOX_SHIFT_CLOSE, WALL_H_PHYS, WALL_H_PHYS/2.0);
-    fall_fixed = true;
+    AddHoleRing(w, BOX_SHIFT_CLOSE, WALL_H_PHYS, WALL_H_PHYS/2.0);
+    w->fall_fixed = true;
 }
 
-bool testbump(float x, float y)
+static bool testbump(MazeWorld *w, float x, float y)
 {
-    if (fall)
+    Level *lvl = w->level;
+
+    if (w->fall)
     {
-        if (!fall_fixed)
-            if (inbox_r(x,y, fall_hole, game_config.hole_r-game_config.ball_r))
-                GoFallFixed(fall_hole);
+        if (!w->fall_fixed)
+            if (inbox_r(x,y, w->fall_hole, w->config.hole_r-w->config.ball_r))
+                GoFallFixed(w, w->fall_hole);
         return false;
     }
 
-    Point final_hole = game_levels[cur_level].fins[0];
+    Point final_hole = lvl->fins[0];
     float dist = calcdist(x,y, final_hole.x,final_hole.y);
-    if (dist <= game_config.hole_r)
+    if (dist <= w->config.hole_r)
     {
-        GoFall(final_hole);
-        if (keys_passed == game_levels[cur_level].keys_count) //
-            new_game_state = GAME_STATE_WIN;
+        GoFall(w, final_hole);
+        if (w->keys_passed == lvl->keys_count) //
+            w->new_game_state = GAME_STATE_WIN;
         else
-            new_game_state = GAME_STATE_SAVED;
+            w->new_game_state = GAME_STATE_SAVED;
         return true;
     }
 
-    for (int i=0; i<game_levels[cur_level].holes_count; i++)
+    // only the objects of the ball's cell may contain it; cells keep them in
+    // index order, so the first hit is the same as with a full scan
+    int count;
+    const int *items = maze_grid_point(&w->hole_grid, x, y, &count);
+    for (int k=0; k<count; k++)
     {
-        Point hole = game_levels[cur_level].holes[i];
-        if (inbox_r(x,y, hole, game_config.hole_r+1))
+        Point hole = lvl->holes[items[k]];
+        if (inbox_r(x,y, hole, w->config.hole_r+1))
         {
             float dist = calcdist(x,y, hole.x,hole.y);
-            if (dist <= game_config.hole_r)
+            if (dist <= w->config.hole_r)
             {
-                GoFall(hole);
-                new_game_state = GAME_STATE_FAILED;
+                GoFall(w, hole);
+                w->new_game_state = GAME_STATE_FAILED;
                 return true;
             }
         }
     }
 
-    for (int i=0; i<game_levels[cur_level].keys_count; i++)
+    items = maze_grid_point(&w->key_grid, x, y, &count);
+    for (int k=0; k<count; k++)
     {
-        if (keys_anim[i].stage == ANIMATION_NONE)
+        int i = items[k];
+        if (w->keys_anim[i].stage == ANIMATION_NONE)
         {
-            Point key = game_levels[cur_level].keys[i];
-            if (inbox_r(x,y, key, game_config.key_r+1))
+            Point key = lvl->keys[i];
+            if (inbox_r(x,y, key, w->config.key_r+1))
             {
                 float dist = calcdist(x,y, key.x,key.y);
-                if (dist <= game_config.key_r)
+                if (dist <= w->config.key_r)
                 {
-                    keys_anim[i].stage = ANIMATION_PLAYING;
-                    keys_passed++;
-                    save_key = i;
-                    if (keys_passed == game_levels[cur_level].keys_count)
+                    w->keys_anim[i].stage = ANIMATION_PLAYING;
+                    w->keys_passed++;
+                    w->save_key = i;
+                    if (w->keys_passed == lvl->keys_count)
                     {
-                        final_anim.stage = ANIMATION_PLAYING;
+                        w->final_anim.stage = ANIMATION_PLAYING;
                     }
                     return false;
                 }
@@ -174,87 +244,451 @@ bool testbump(float x, float y)
     return false;
 }
 
-// this is called by dSpaceCollide when two objects in space are
-// potentially colliding.
+static void InitContacts(MazeWorld *w)
+{
+    for (int i = 0; i < MAX_STEP_CONTACTS; i++)
+    {
+        w->contacts[i].surface.mode = dContactApprox1 | dContactSoftCFM | dContactSoftERP;
+        w->contacts[i].surface.mu = 0.7f;
+        w->contacts[i].surface.soft_erp = 0.8f;
+        w->contacts[i].surface.soft_cfm = 0.00001f;
+    }
+}
+
+// takes the numc contacts just written after the last accepted ones; the
+// impact speed of a wall hit is taken from the first of them
+static void AddContacts(MazeWorld *w, int numc, dBodyID b1, dBodyID b2, bool bump)
+{
+    if (!numc)
+        return;
+
+    dContact *contact = &w->contacts[w->contacts_count];
+    for (int i = 0; i < numc; i++)
+    {
+        w->contact_bodies[w->contacts_count + i][0] = b1;
+        w->contact_bodies[w->contacts_count + i][1] = b2;
+    }
+    w->contacts_count += numc;
+    w->stats.contacts_made += numc;
+
+    if (bump)
+    {
+        const dReal *Normal = contact[0].geom.normal;
+        const dReal *LinearVel = dBodyGetLinearVel(w->body);
+
+        float vlen = calclen(LinearVel[0], LinearVel[1], LinearVel[2]);
+        float cosa = Normal[0]*LinearVel[0] +
+                     Normal[1]*LinearVel[1] +
+                     Normal[2]*LinearVel[2];
+
+        float impact = -vlen*cosa;
+        if (!w->bumped || impact > w->max_impact)
+            w->max_impact = impact;
+        w->bumped = true;
+    }
+}
+
+static void CreateContactJoints(MazeWorld *w)
+{
+    for (int i = 0; i < w->contacts_count; i++)
+    {
+        dJointID c = dJointCreateContact(w->world, w->contactgroup, &w->contacts[i]);
+        dJointAttach(c, w->contact_bodies[i][0], w->contact_bodies[i][1]);
+    }
+    w->contacts_count = 0;
+}
+
+// this is called by dSpaceCollide (or directly by CollideBall) when two
+// objects are potentially colliding.
 #define MAX_CONTACTS 8
-void nearCallback(void *data, dGeomID o1, dGeomID o2)
+static void nearCallback(void *data, dGeomID o1, dGeomID o2)
 {
+    MazeWorld *w = (MazeWorld*)data;
     dBodyID b1 = dGeomGetBody(o1);
     dBodyID b2 = dGeomGetBody(o2);
 
     if (b1 == b2)
         return;
 
-    dContact contact[MAX_CONTACTS]; // up to MAX_CONTACTS contacts
-    for (int i = 0; i < MAX_CONTACTS; i++)
-    {
-        contact[i].surface.mode = dContactApprox1 | dContactSoftCFM | dContactSoftERP;
-        contact[i].surface.mu = 0.7f;
-        contact[i].surface.soft_erp = 0.8f;
-        contact[i].surface.soft_cfm = 0.00001f;
-    }
+    w->stats.pairs_tested++;
+    int room = MAX_STEP_CONTACTS - w->contacts_count;
+    clamp_max(room, MAX_CONTACTS);
+    if (room <= 0)
+        return;
 
-    int numc = dCollide(o1, o2, MAX_CONTACTS, &contact[0].geom, sizeof(dContact));
-    if (numc)
+    dContact *contact = &w->contacts[w->contacts_count];
+    int numc = dCollide(o1, o2, room, &contact[0].geom, sizeof(dContact));
+    AddContacts(w, numc, b1, b2, (o1!=w->plane) && (o2!=w->plane));
+}
+
+// the walls of the hole the ball is falling into; the cross-section of every
+// ring is the half-strip r <= dist, z1 <= z <= z2 around the hole axis
+static void CollideHole(MazeWorld *w)
+{
+    const dReal *pos = dBodyGetPosition(w->body);
+    float ball_r = BALL_R_PHYS;
+    Point hole = w->fall_hole;
+    float hx = HOLE_X_PHYS;
+    float hy = HOLE_Y_PHYS;
+    float dx = pos[0] - hx;
+    float dy = pos[1] - hy;
+    float dist = sqrt(dx*dx + dy*dy);
+    // unit vector from the axis to the ball
+    float ux = (dist > 0 ? dx/dist : 1);
+    float uy = (dist > 0 ? dy/dist : 0);
+
+    dContact *contact = &w->contacts[w->contacts_count];
+    int numc = 0;
+    for (int i=0; i<w->fall_rings_count; i++)
     {
-        for (int i = 0; i < numc; i++)
+        HoleRing *ring = &w->fall_rings[i];
+        w->stats.pairs_tested++;
+        if (w->contacts_count + numc == MAX_STEP_CONTACTS)
+            break;
+
+        // closest point of the ring section to the ball center
+        float cr = max(dist, ring->r);
+        float cz = pos[2];
+        clamp(cz, ring->z1, ring->z2);
+
+        float nr = dist - cr;
+        float nz = pos[2] - cz;
+        float len = sqrt(nr*nr + nz*nz);
+        float depth;
+        if (len > 0)
         {
-            dJointID c = dJointCreateContact(world, contactgroup, contact + i);
-            dJointAttach(c, b1, b2);
+            if (len >= ball_r)
+                continue;
+            depth = ball_r - len;
+            nr /= len;
+            nz /= len;
         }
-
-        if ((o1!=plane) && (o2!=plane))
+        else
         {
-            const dReal *Normal = contact[0].geom.normal;
-            const dReal *LinearVel = dBodyGetLinearVel(body);
+            // the center is inside the wall, push it back to the axis
+            depth = dist - ring->r + ball_r;
+            nr = -1;
+            nz = 0;
+        }
 
-            float vlen = calclen(LinearVel[0], LinearVel[1], LinearVel[2]);
-            float cosa = Normal[0]*LinearVel[0] +
-                         Normal[1]*LinearVel[1] +
-                         Normal[2]*LinearVel[2];
+        dContactGeom *g = &contact[numc].geom;
+        g->normal[0] = ux*nr;
+        g->normal[1] = uy*nr;
+        g->normal[2] = nz;
+        g->depth = depth;
+        g->pos[0] = hx + ux*cr;
+        g->pos[1] = hy + uy*cr;
+        g->pos[2] = cz;
+        g->g1 = w->geom;
+        g->g2 = 0;
+        numc++;
+    }
 
-            float pvel = vlen*cosa;
-            if (vibro_callback)
-                vibro_callback(-pvel);
-        }
+    AddContacts(w, numc, w->body, 0, true);
+}
+
+// collides the ball with everything near it; the hash space path is kept
+// for comparison, the grid one skips the pairs of static geoms entirely
+static void CollideBall(MazeWorld *w, float do_phys_step)
+{
+    if (w->fall_rings_count > 0)
+        CollideHole(w);
+
+    if (!w->wall_grid.cell_start)
+    {
+        dSpaceCollide(w->space,w,&nearCallback);
+        return;
+    }
+
+    nearCallback(w, w->geom, w->plane);
+
+    // bounds swept over the coming step
+    const dReal *Position = dBodyGetPosition(w->body);
+    const dReal *LinearVel = dBodyGetLinearVel(w->body);
+    float reach = BALL_R_PHYS + calclen(LinearVel[0], LinearVel[1], LinearVel[2])*do_phys_step;
+    GridRect r = { Position[0] - reach, Position[1] - reach,
+                   Position[0] + reach, Position[1] + reach };
+
+    int n = maze_grid_query(&w->wall_grid, r, w->candidates, w->static_count);
+    for (int i=0; i<n; i++)
+        nearCallback(w, w->geom, w->static_geoms[w->candidates[i]]);
+}
+
+static void AddStaticBox(MazeWorld *w, GridRect *rects,
+                         float x, float y, float z, float lx, float ly, float lz)
+{
+    dSpaceID space = (w->broadphase == MAZE_BROADPHASE_HASH ? w->space : 0);
+    dGeomID wall = dCreateBox(space, lx, ly, lz);
+    dGeomSetPosition(wall, x, y, z);
+
+    GridRect r = { x - lx/2.0, y - ly/2.0, x + lx/2.0, y + ly/2.0 };
+    rects[w->static_count] = r;
+    w->static_geoms[w->static_count++] = wall;
+}
+
+#define BOX_WND_HOR(a,b) AddStaticBox(w, rects, WND_W_PHYS/2.0, a*WND_H_PHYS + b*WALL_W_PHYS/2.0, WALL_H_PHYS/2.0, \
+                                      WND_W_PHYS, WALL_W_PHYS, WALL_H_PHYS)
+#define BOX_WND_VER(a,b) AddStaticBox(w, rects, a*WND_W_PHYS + b*WALL_W_PHYS/2.0, WND_H_PHYS/2.0, WALL_H_PHYS/2.0, \
+                                      WALL_W_PHYS, WND_H_PHYS, WALL_H_PHYS)
+#define BOX_WND_TOP AddStaticBox(w, rects, WND_W_PHYS/2.0, WND_H_PHYS/2.0, WALL_H_PHYS+WALL_W_PHYS/2.0, \
+                                 WND_W_PHYS, WND_H_PHYS, WALL_W_PHYS)
+#define WALL_GRID_CELL (BALL_R_PHYS*2)
+#define OBJ_GRID_CELL (max(w->config.hole_r, w->config.key_r)*2 + 2)
+
+static void BuildPointGrid(MazeWorld *w, MazeGrid *g, const Point *pts, int count, int r)
+{
+    GridRect *rects = (GridRect*)malloc((count + 1) * sizeof(GridRect));
+    for (int i=0; i<count; i++)
+    {
+        GridRect rect = { pts[i].x - r, pts[i].y - r, pts[i].x + r, pts[i].y + r };
+        rects[i] = rect;
+    }
+    maze_grid_build(g, 0, 0, w->config.wnd_w, w->config.wnd_h, OBJ_GRID_CELL, rects, count);
+    free(rects);
+}
+
+static void FreeState(MazeWorld *w)
+{
+    if (!w->world)
+        return;
+
+    // geoms outside of the space are not destroyed along with it
+    if (w->wall_grid.cell_start)
+    {
+        for (int i=0; i<w->static_count; i++)
+            dGeomDestroy(w->static_geoms[i]);
+        dGeomDestroy(w->plane);
+        dGeomDestroy(w->geom);
+        maze_grid_free(&w->wall_grid);
+    }
+    maze_grid_free(&w->hole_grid);
+    maze_grid_free(&w->key_grid);
+    free(w->static_geoms);
+    free(w->candidates);
+    w->static_geoms = NULL;
+    w->candidates = NULL;
+    w->static_count = 0;
+
+    dJointGroupDestroy(w->contactgroup);
+    dSpaceDestroy(w->space);
+    dWorldDestroy(w->world);
+    w->world = NULL;
+    w->fall_rings_count = 0;
+}
+
+static void LeaveFall(MazeWorld *w)
+{
+    RemoveHoleRings(w);
+    w->fall = false;
+    w->fall_fixed = false;
+
+    dWorldSetGravity(w->world,0,0, -GRAV_CONST*0.5);
+    dGeomPlaneSetParams(w->plane, 0,0,1, 0);
+}
+
+//------------------------------------------------------------------------------
+
+static void SaveSnapshot(MazeWorld *w, MazeSnapshot *snap)
+{
+    const dReal *pos = dBodyGetPosition(w->body);
+    const dReal *quat = dBodyGetQuaternion(w->body);
+    const dReal *vel = dBodyGetLinearVel(w->body);
+    const dReal *angvel = dBodyGetAngularVel(w->body);
+    for (int j=0; j<3; j++)
+    {
+        snap->pos[j] = pos[j];
+        snap->vel[j] = vel[j];
+        snap->angvel[j] = angvel[j];
+    }
+    for (int j=0; j<4; j++)
+        snap->quat[j] = quat[j];
+
+    snap->level = w->cur_level;
+    snap->step = w->stats.steps;
+    snap->fall = w->fall;
+    snap->fall_fixed = w->fall_fixed;
+    snap->fall_hole = w->fall_hole;
+    snap->new_game_state = w->new_game_state;
+    snap->keys_passed = w->keys_passed;
+    snap->save_key = w->save_key;
+    snap->final_anim = w->final_anim;
+    for (int i=0; i<snap->keys_count; i++)
+        snap->keys_anim[i] = w->keys_anim[i];
+}
+
+static void RestoreSnapshot(MazeWorld *w, const MazeSnapshot *snap)
+{
+    dBodySetPosition(w->body, snap->pos[0],snap->pos[1],snap->pos[2]);
+    dBodySetQuaternion(w->body, snap->quat);
+    dBodySetLinearVel(w->body, snap->vel[0],snap->vel[1],snap->vel[2]);
+    dBodySetAngularVel(w->body, snap->angvel[0],snap->angvel[1],snap->angvel[2]);
+    dBodySetForce(w->body, 0,0,0);
+    dBodySetTorque(w->body, 0,0,0);
+
+    // the fall geometry is rebuilt only when it differs
+    if ( (snap->fall != w->fall) || (snap->fall_fixed != w->fall_fixed) ||
+         (snap->fall && ( (snap->fall_hole.x != w->fall_hole.x) ||
+                          (snap->fall_hole.y != w->fall_hole.y) )) )
+    {
+        LeaveFall(w);
+        if (snap->fall)
+            GoFall(w, snap->fall_hole);
+        if (snap->fall_fixed)
+            GoFallFixed(w, snap->fall_hole);
+    }
+
+    w->new_game_state = snap->new_game_state;
+    w->keys_passed = snap->keys_passed;
+    w->save_key = snap->save_key;
+    w->final_anim = snap->final_anim;
+    for (int i=0; i<snap->keys_count; i++)
+        w->keys_anim[i] = snap->keys_anim[i];
+}
+
+static void PushSnapshot(MazeWorld *w)
+{
+    w->history_head = (w->history_head + 1) % SNAPSHOTS_COUNT;
+    if (w->history_count < SNAPSHOTS_COUNT)
+        w->history_count++;
+    SaveSnapshot(w, &w->history[w->history_head]);
+    w->snapshot_age = 0;
+}
+
+// n-th snapshot back from the latest one
+static MazeSnapshot *GetSnapshot(MazeWorld *w, int n)
+{
+    if ((n < 0) || (n >= w->history_count))
+        return NULL;
+    return &w->history[(w->history_head - n + SNAPSHOTS_COUNT) % SNAPSHOTS_COUNT];
+}
+
+static void NewHistory(MazeWorld *w)
+{
+    int keys_count = w->level->keys_count;
+
+    free(w->history_anims);
+    w->history_anims = (Animation*)malloc((SNAPSHOTS_COUNT*keys_count + 1) * sizeof(Animation));
+    for (int i=0; i<SNAPSHOTS_COUNT; i++)
+    {
+        w->history[i].keys_count = keys_count;
+        w->history[i].keys_anim = w->history_anims + i*keys_count;
     }
+    w->history_head = 0;
+    w->history_count = 0;
+}
+
+//------------------------------------------------------------------------------
+
+static void SavePose(MazeWorld *w)
+{
+    const dReal *pos = dBodyGetPosition(w->body);
+    const dReal *quat = dBodyGetQuaternion(w->body);
+    for (int j=0; j<3; j++)
+        w->prev_pos[j] = pos[j];
+    for (int j=0; j<4; j++)
+        w->prev_quat[j] = quat[j];
 }
 
-#define BOX_WND_HOR wall = dCreateBox(space, WND_W_PHYS, WALL_W_PHYS, WALL_H_PHYS);
-#define BOX_WND_VER wall = dCreateBox(space, WALL_W_PHYS, WND_H_PHYS, WALL_H_PHYS);
-#define BOX_WND_TOP wall = dCreateBox(space, WND_W_PHYS, WND_H_PHYS, WALL_W_PHYS);
+// reports the ball at alpha of the way from the saved pose to the current one
+static void UpdateBallPos(MazeWorld *w, float alpha)
+{
+    const dReal *poss = dGeomGetPosition(w->geom);
+    if (alpha >= 1)
+    {
+        w->ball_rot = dGeomGetRotation(w->geom);
+        w->ball_pos_x = poss[0]*PHYS_SCALE;
+        w->ball_pos_y = poss[1]*PHYS_SCALE;
+        w->ball_pos_z = poss[2]*PHYS_SCALE;
+        return;
+    }
+
+    const dReal *quat = dBodyGetQuaternion(w->body);
+    dQuaternion q;
+    // nlerp along the shorter arc
+    float dot = 0;
+    for (int j=0; j<4; j++)
+        dot += w->prev_quat[j]*quat[j];
+    float qs = (dot < 0 ? -1 : 1);
+    float qlen = 0;
+    for (int j=0; j<4; j++)
+    {
+        q[j] = w->prev_quat[j] + (qs*quat[j] - w->prev_quat[j])*alpha;
+        qlen += q[j]*q[j];
+    }
+    qlen = sqrt(qlen);
+    for (int j=0; j<4; j++)
+        q[j] /= qlen;
+    dQtoR(q, w->interp_rot);
+
+    w->ball_rot = w->interp_rot;
+    w->ball_pos_x = (w->prev_pos[0] + (poss[0] - w->prev_pos[0])*alpha)*PHYS_SCALE;
+    w->ball_pos_y = (w->prev_pos[1] + (poss[1] - w->prev_pos[1])*alpha)*PHYS_SCALE;
+    w->ball_pos_z = (w->prev_pos[2] + (poss[2] - w->prev_pos[2])*alpha)*PHYS_SCALE;
+}
+
+// puts the ball to the start point (or to the last passed key) and drops
+// everything the previous fall has added; the level geometry is kept
+static void ResetState(MazeWorld *w)
+{
+    Level *lvl = w->level;
+
+    LeaveFall(w);
+    dJointGroupEmpty(w->contactgroup);
+
+    // set initial position
+    int ix, iy;
+    if (w->save_key<0)
+    {
+        ix = lvl->init.x;
+        iy = lvl->init.y;
+    }
+    else
+    {
+        ix = lvl->keys[w->save_key].x;
+        iy = lvl->keys[w->save_key].y;
+    }
+
+    dMatrix3 rot;
+    dRSetIdentity(rot);
+    dBodySetRotation(w->body, rot);
+    dBodySetLinearVel(w->body, 0,0,0);
+    dBodySetAngularVel(w->body, 0,0,0);
+    dBodySetForce(w->body, 0,0,0);
+    dBodySetTorque(w->body, 0,0,0);
+    dBodySetPosition( w->body, ix/PHYS_SCALE, iy/PHYS_SCALE,
+                      BALL_R_PHYS*(1+BALL_SHIFT) );
 
-#define BOX_POS_HOR(a,b) dGeomSetPosition(wall, WND_W_PHYS/2.0, a*WND_H_PHYS + b*WALL_W_PHYS/2.0, WALL_H_PHYS/2.0);
-#define BOX_POS_VER(a,b) dGeomSetPosition(wall, a*WND_W_PHYS + b*WALL_W_PHYS/2.0, WND_H_PHYS/2.0, WALL_H_PHYS/2.0);
-#define BOX_POS_TOP dGeomSetPosition(wall, WND_W_PHYS/2.0, WND_H_PHYS/2.0, WALL_H_PHYS+WALL_W_PHYS/2.0);
+    w->accumulator = 0;
+    SavePose(w);
+    UpdateBallPos(w, 1);
+
+    w->history_count = 0;
+    PushSnapshot(w);
+}
 
-void InitState()
+// builds the static geometry of the current level, called on level change only
+static void InitState(MazeWorld *w)
 {
-    dGeomID wall;
-    
-    float px, py;
-    px = game_levels[cur_level].init.x;
-    py = game_levels[cur_level].init.y;
+    Level *lvl = w->level;
+    bool grid = (w->broadphase == MAZE_BROADPHASE_GRID);
 
-    static bool first_init = true;
-    if (!first_init)
-        dWorldDestroy(world);
-    first_init = false;
+    FreeState(w);
 
-    fall = false;
-    fall_fixed = false;
+    w->world = dWorldCreate();
+    w->space = dHashSpaceCreate(0);
+    dWorldSetCFM(w->world,1e-5);
+    w->plane = dCreatePlane(grid ? 0 : w->space,0,0,1,0);
 
-    world = dWorldCreate();
-    space = dHashSpaceCreate(0);
-    dWorldSetGravity(world,0,0, -GRAV_CONST*0.5);
-    dWorldSetCFM(world,1e-5);
-    plane = dCreatePlane(space,0,0,1,0);
+    dWorldSetContactSurfaceLayer(w->world, 0.00001f);
+    dWorldSetContactMaxCorrectingVel(w->world,1);
 
-    dWorldSetContactSurfaceLayer(world, 0.00001f);
-    dWorldSetContactMaxCorrectingVel(world,1);
+    int b_co = lvl->boxes_count;
+    Box *bxs = lvl->boxes;
 
-    int b_co = game_levels[cur_level].boxes_count;
-    Box *bxs = game_levels[cur_level].boxes;
+    int static_max = b_co + 5;
+    GridRect *rects = (GridRect*)malloc(static_max * sizeof(GridRect));
+    w->static_geoms = (dGeomID*)malloc(static_max * sizeof(dGeomID));
+    w->candidates = (int*)malloc(static_max * sizeof(int));
 
     for (int i=0; i<b_co; i++)
     {
@@ -263,44 +697,41 @@ void InitState()
         boxr_y=(bxs[i].y2 + bxs[i].y1)/2.0;
         boxr_w=(bxs[i].x2 - bxs[i].x1);
         boxr_h=(bxs[i].y2 - bxs[i].y1);
-        wall = dCreateBox(space, boxr_w/PHYS_SCALE, boxr_h/PHYS_SCALE, WALL_H_PHYS);
-        dGeomSetPosition(wall, boxr_x/PHYS_SCALE, boxr_y/PHYS_SCALE, WALL_H_PHYS/2.0);
+        AddStaticBox(w, rects, boxr_x/PHYS_SCALE, boxr_y/PHYS_SCALE, WALL_H_PHYS/2.0,
+                     boxr_w/PHYS_SCALE, boxr_h/PHYS_SCALE, WALL_H_PHYS);
     }
 
-    BOX_WND_HOR; BOX_POS_HOR( 0,-1);
-    BOX_WND_HOR; BOX_POS_HOR( 1, 1);
-    BOX_WND_VER; BOX_POS_VER( 0,-1);
-    BOX_WND_VER; BOX_POS_VER( 1, 1);
+    BOX_WND_HOR( 0,-1);
+    BOX_WND_HOR( 1, 1);
+    BOX_WND_VER( 0,-1);
+    BOX_WND_VER( 1, 1);
     //-- top -------------------------------------------------------------------
-    BOX_WND_TOP; BOX_POS_TOP;
+    BOX_WND_TOP;
     //--------------------------------------------------------------------------
 
-    contactgroup = dJointGroupCreate(0);
+    if (grid)
+        maze_grid_build(&w->wall_grid, 0, 0, WND_W_PHYS, WND_H_PHYS, WALL_GRID_CELL,
+                        rects, w->static_count);
+    free(rects);
+
+    // the same margins as inbox_r() uses in testbump()
+    BuildPointGrid(w, &w->hole_grid, lvl->holes, lvl->holes_count, w->config.hole_r+1);
+    BuildPointGrid(w, &w->key_grid, lvl->keys, lvl->keys_count, w->config.key_r+1);
+
+    w->contactgroup = dJointGroupCreate(0);
     // create object
-    body = dBodyCreate(world);
-    geom = dCreateSphere(space, BALL_R_PHYS);
-    dMassSetSphere(&mass,1,BALL_R_PHYS);
-    dBodySetMass(body,&mass);
-    dGeomSetBody(geom,body);
-    // set initial position
-    int ix, iy;
-    if (save_key<0)
-    {
-        ix = px;
-        iy = py;
-    }
-    else
-    {
-        ix = game_levels[cur_level].keys[save_key].x;
-        iy = game_levels[cur_level].keys[save_key].y;
-    }
-    dBodySetPosition( body, ix/PHYS_SCALE, iy/PHYS_SCALE,
-                      BALL_R_PHYS*(1+BALL_SHIFT) );
+    w->body = dBodyCreate(w->world);
+    w->geom = dCreateSphere(grid ? 0 : w->space, BALL_R_PHYS);
+    dMassSetSphere(&w->mass,1,BALL_R_PHYS);
+    dBodySetMass(w->body,&w->mass);
+    dGeomSetBody(w->geom,w->body);
+
+    ResetState(w);
 }
 
 //------------------------------------------------------------------------------
 
-void ZeroAnim(Animation *anim)
+static void ZeroAnim(Animation *anim)
 {
     anim->stage = ANIMATION_NONE;
     anim->time = 0;
@@ -308,27 +739,28 @@ void ZeroAnim(Animation *anim)
     anim->played = false;
 }
 
-void ZeroAnims()
+static void ZeroAnims(MazeWorld *w)
 {
-    for (int i=0; i<game_levels[cur_level].keys_count; i++)
+    for (int i=0; i<w->level->keys_count; i++)
     {
-        ZeroAnim(&keys_anim[i]);
+        ZeroAnim(&w->keys_anim[i]);
     }
-    ZeroAnim(&final_anim);
+    ZeroAnim(&w->final_anim);
 
-    keys_passed = 0;
-    save_key = -1;
+    w->keys_passed = 0;
+    w->save_key = -1;
 }
 
-void NewAnim()
+static void NewAnim(MazeWorld *w)
 {
-    if (keys_anim) free(keys_anim);
-    keys_anim = (Animation*)malloc(game_levels[cur_level].keys_count * sizeof(Animation));
-    ZeroAnims();
+    free(w->keys_anim);
+    w->keys_anim = (Animation*)malloc(w->level->keys_count * sizeof(Animation));
+    ZeroAnims(w);
+    NewHistory(w);
 }
 
 #define MAX_ANIM_TIME 0.3
-void UpdateAnim(Animation *anim, float do_phys_step)
+static void UpdateAnim(Animation *anim, float do_phys_step)
 {
     if (anim->stage == ANIMATION_PLAYING)
     {
@@ -349,23 +781,25 @@ void UpdateAnim(Animation *anim, float do_phys_step)
     }
 }
 
-void UpdateAnims(float do_phys_step)
+static void UpdateAnims(MazeWorld *w, float do_phys_step)
 {
-    for (int i=0; i<game_levels[cur_level].keys_count; i++)
+    Level *lvl = w->level;
+
+    for (int i=0; i<lvl->keys_count; i++)
     {
-        UpdateAnim(&keys_anim[i], do_phys_step);
+        UpdateAnim(&w->keys_anim[i], do_phys_step);
     }
 
-    if ( (game_levels[cur_level].keys_count > 0) &&
-         (keys_passed == game_levels[cur_level].keys_count) )
+    if ( (lvl->keys_count > 0) &&
+         (w->keys_passed == lvl->keys_count) )
     {
-        UpdateAnim(&final_anim, do_phys_step);
+        UpdateAnim(&w->final_anim, do_phys_step);
     }
 }
 
 //------------------------------------------------------------------------------
 
-float get_phys_step(int delta_ticks)
+static float get_phys_step(int delta_ticks)
 {
     #define STEP_QUANT 0.013/30.0
     float do_phys_step = STEP_QUANT * delta_ticks;
@@ -374,206 +808,467 @@ float get_phys_step(int delta_ticks)
     return do_phys_step;
 }
 
-#define PHYS_MIN_FALL_VEL 0.09
-GameState maze_step(int delta_ticks)
+// one ODE step of dt; once a step has produced NaN and the world was rolled
+// back, the following steps of the same frame go without the driving forces
+static void PhysStep(MazeWorld *w, float dt, bool *wnanc)
 {
-    float do_phys_step = get_phys_step(delta_ticks);
+    float forcex = w->acx*w->force_coef;
+    float forcey = w->acy*w->force_coef;
 
-    float forcex = acx*force_coef;
-    float forcey = acy*force_coef;
+    if (++w->snapshot_age >= SNAPSHOT_INTERVAL)
+        PushSnapshot(w);
 
-    const dReal *poss = NULL;
-    bool wnanc = false;
-    for (int i=0; i<3; i++)
+    const dReal *Position = dBodyGetPosition(w->body);
+    const dReal *LinearVel = dBodyGetLinearVel(w->body);
+    const dReal *AngularVel = dBodyGetAngularVel(w->body);
+
+    if (!*wnanc)
     {
-        const dReal *Position = dBodyGetPosition(body);
-        const dReal *Rotation = dBodyGetRotation(body);
-        const dReal *Quaternion = dBodyGetQuaternion(body);
-        const dReal *LinearVel = dBodyGetLinearVel(body);
-        const dReal *AngularVel = dBodyGetAngularVel(body);
-
-        dReal xPosition[3];
-        dReal xRotation[12];
-        dReal xQuaternion[4];
-        dReal xLinearVel[3];
-        dReal xAngularVel[3];
-
-        for (int j=0; j<3; j++)
+        if (!w->fall)
         {
-            xPosition[j] = Position[j];
-            xLinearVel[j] = LinearVel[j];
-            xAngularVel[j] = AngularVel[j];
+            dBodyAddForce(w->body, forcex, 0, 0);
+            dBodyAddForce(w->body, 0, forcey, 0);
         }
-        for (int j=0; j<12; j++)
+        else //fall
         {
-            xRotation[j] = Rotation[j];
-        }
-        for (int j=0; j<4; j++)
-        {
-            xQuaternion[j] = Quaternion[j];
-        }
-
-        if (!wnanc)
-        {
-            if (!fall)
+            float cpx = Position[0]*PHYS_SCALE;
+            float cpy = Position[1]*PHYS_SCALE;
+            float tkdi = calcdist(w->fall_hole.x,w->fall_hole.y, cpx,cpy);
+            float tkmin = w->config.hole_r - w->config.ball_r/2.0;
+            if (tkdi > tkmin)
             {
-                dBodyAddForce(body, forcex, 0, 0);
-                dBodyAddForce(body, 0, forcey, 0);
-            }
-            else //fall
-            {
-                float cpx = Position[0]*PHYS_SCALE;
-                float cpy = Position[1]*PHYS_SCALE;
-                float tkdi = calcdist(fall_hole.x,fall_hole.y, cpx,cpy);
-                float tkmin = game_config.hole_r - game_config.ball_r/2.0;
-                if (tkdi > tkmin)
-                {
-                    float tfx, tfy;
-                    float fo = 0.2 * (tkdi-tkmin)/(game_config.ball_r/2.0);
-                    tfx = ((fall_hole.x - cpx) / tkdi) * fo;
-                    tfy = ((fall_hole.y - cpy) / tkdi) * fo;
-                    dBodyAddForce(body, tfx, tfy, 0);
-                }
+                float tfx, tfy;
+                float fo = 0.2 * (tkdi-tkmin)/(w->config.ball_r/2.0);
+                tfx = ((w->fall_hole.x - cpx) / tkdi) * fo;
+                tfy = ((w->fall_hole.y - cpy) / tkdi) * fo;
+                dBodyAddForce(w->body, tfx, tfy, 0);
             }
+        }
 
-            int qu;
-            float qacx = (fall ? 0 : acx);
-            float qacy = (fall ? 0 : acy);
-            float qk = (fall ? 4.5 : 1);
+        int qu;
+        float qacx = (w->fall ? 0 : w->acx);
+        float qacy = (w->fall ? 0 : w->acy);
+        float qk = (w->fall ? 4.5 : 1);
 
-            qu = -sign(LinearVel[0], 0.002);
-            if (qu!=0) dBodyAddForce(body, qk*qu*0.0017*( 0.5*GRAV_CONST*cos(asin(qacx)) ), 0, 0);
+        qu = -sign(LinearVel[0], 0.002);
+        if (qu!=0) dBodyAddForce(w->body, qk*qu*0.0017*( 0.5*GRAV_CONST*cos(asin(qacx)) ), 0, 0);
 
-            qu = -sign(LinearVel[1], 0.002);
-            if (qu!=0) dBodyAddForce(body, 0, qk*qu*0.0017*( 0.5*GRAV_CONST*cos(asin(qacy)) ), 0);
+        qu = -sign(LinearVel[1], 0.002);
+        if (qu!=0) dBodyAddForce(w->body, 0, qk*qu*0.0017*( 0.5*GRAV_CONST*cos(asin(qacy)) ), 0);
 
-            qu = -sign(AngularVel[2], 0.003);
-            if (qu!=0) dBodyAddTorque(body, 0,0, qu*0.0005);
-        }
+        qu = -sign(AngularVel[2], 0.003);
+        if (qu!=0) dBodyAddTorque(w->body, 0,0, qu*0.0005);
+    }
 
-        dSpaceCollide(space,0,&nearCallback);
-        dWorldStep(world, do_phys_step);
-        dJointGroupEmpty(contactgroup);
+    CollideBall(w, dt);
+    CreateContactJoints(w);
+    dWorldStep(w->world, dt);
+    dJointGroupEmpty(w->contactgroup);
+    w->stats.steps++;
+    w->stats.sim_time += dt;
 
-        poss = dGeomGetPosition(geom);
+    const dReal *poss = dGeomGetPosition(w->geom);
 
-        bool nanc = false;
-        for (int j=0; j<3; j++)
+    bool nanc = false;
+    for (int j=0; j<3; j++)
+    {
+        if (!(poss[j] <= 0.0) && !(poss[j] > 0.0))
         {
-            if (!(poss[j] <= 0.0) && !(poss[j] > 0.0))
-            {
-                //poss[j] is NaN
-                nanc = true;
-                break;
-            }
+            //poss[j] is NaN
+            nanc = true;
+            break;
         }
+    }
 
-        if (nanc)
-        {
-            dBodySetPosition(body, xPosition[0],xPosition[1],xPosition[2]);
-            dBodySetRotation(body, xRotation);
-            dBodySetQuaternion(body, xQuaternion);
-            dBodySetLinearVel(body, xLinearVel[0],xLinearVel[1],xLinearVel[2]);
-            dBodySetAngularVel(body, xAngularVel[0],xAngularVel[1],xAngularVel[2]);
-            wnanc = true;
-        }
-    } //for
+    if (nanc)
+    {
+        // back to the latest snapshot, at most SNAPSHOT_INTERVAL steps ago
+        RestoreSnapshot(w, GetSnapshot(w, 0));
+        *wnanc = true;
+        w->stats.nan_rollbacks++;
+    }
+}
 
-    //determining new position of the ball
-    poss = dGeomGetPosition(geom);
-    ball_rot = dGeomGetRotation(geom);
-    ball_pos_x = poss[0]*PHYS_SCALE;
-    ball_pos_y = poss[1]*PHYS_SCALE;
-    ball_pos_z = poss[2]*PHYS_SCALE;
+// tests the ball against holes and keys and advances the animations
+#define PHYS_MIN_FALL_VEL 0.09
+static GameState CheckState(MazeWorld *w, float anim_step)
+{
+    const dReal *poss = dGeomGetPosition(w->geom);
+    int x = poss[0]*PHYS_SCALE;
+    int y = poss[1]*PHYS_SCALE;
+    int z = poss[2]*PHYS_SCALE;
 
     //test if it falls out
-    testbump(ball_pos_x, ball_pos_y);
+    testbump(w, x, y);
 
     GameState game_state = GAME_STATE_NORMAL;
-    if (fall)
+    if (w->fall)
     {
-        const dReal *lv = dBodyGetLinearVel(body);
+        const dReal *lv = dBodyGetLinearVel(w->body);
         if ( calclen(lv[0],lv[1],lv[2]) < PHYS_MIN_FALL_VEL )
-            if (ball_pos_z <= -game_config.ball_r*3.0/4.0)
-                game_state = new_game_state;
+            if (z <= -w->config.ball_r*3.0/4.0)
+                game_state = w->new_game_state;
+    }
+
+    UpdateAnims(w, anim_step);
+
+    return game_state;
+}
+
+// the fixed step is the variable one of a 16 ms frame; a frame may not take
+// more than FIXED_MAX_STEPS of them, the rest of its time is dropped
+#define FIXED_STEP (STEP_QUANT * 16)
+#define FIXED_MAX_STEPS 16
+static GameState FixedStep(MazeWorld *w, int delta_ticks)
+{
+    w->accumulator += 3 * get_phys_step(delta_ticks);
+
+    GameState game_state = GAME_STATE_NORMAL;
+    bool wnanc = false;
+    int steps = 0;
+    while (w->accumulator >= FIXED_STEP)
+    {
+        if (steps++ == FIXED_MAX_STEPS)
+        {
+            w->accumulator = 0;
+            break;
+        }
+
+        SavePose(w);
+        PhysStep(w, FIXED_STEP, &wnanc);
+        w->accumulator -= FIXED_STEP;
+
+        game_state = CheckState(w, FIXED_STEP / 3);
+        if (game_state != GAME_STATE_NORMAL)
+            break;
     }
 
-    UpdateAnims(do_phys_step);
+    UpdateBallPos(w, w->accumulator / FIXED_STEP);
+    return game_state;
+}
+
+static GameState VariableStep(MazeWorld *w, int delta_ticks)
+{
+    float do_phys_step = get_phys_step(delta_ticks);
+
+    bool wnanc = false;
+    for (int i=0; i<3; i++)
+        PhysStep(w, do_phys_step, &wnanc);
+
+    //determining new position of the ball
+    UpdateBallPos(w, 1);
+
+    return CheckState(w, do_phys_step);
+}
+
+GameState maze_world_step(MazeWorld *w, int delta_ticks)
+{
+    w->bumped = false;
+    GameState game_state = (w->fixed_step ? FixedStep(w, delta_ticks) :
+                                            VariableStep(w, delta_ticks));
+
+    // one report per frame, not one per contact
+    if (w->bumped && w->vibro_callback)
+        w->vibro_callback(w->max_impact);
 
     return game_state;
 }
 
-void maze_set_level(int n)
+//------------------------------------------------------------------------------
+
+MazeWorld *maze_world_create(MazeConfig cfg, Level *lvls, int levels_count)
+{
+    MazeWorld *w = (MazeWorld*)calloc(1, sizeof(MazeWorld));
+    if (!w)
+        return NULL;
+
+    w->config = cfg;
+    w->levels = lvls;
+    w->levels_count = levels_count;
+    w->force_coef = DEFAULT_FORCE_COEF;
+    w->save_key = -1;
+    InitContacts(w);
+    w->history = (MazeSnapshot*)calloc(SNAPSHOTS_COUNT, sizeof(MazeSnapshot));
+    return w;
+}
+
+void maze_world_destroy(MazeWorld *w)
+{
+    if (!w)
+        return;
+
+    FreeState(w);
+    if (w->level && w->put_level)
+        w->put_level(w->level);
+    free(w->keys_anim);
+    free(w->history);
+    free(w->history_anims);
+    free(w);
+}
+
+bool maze_world_set_level(MazeWorld *w, int n)
+{
+    // the previous level is given back only when the new one is set up, so
+    // setting the same level again doesn't make the source reload it
+    Level *lvl = (w->get_level ? w->get_level(n) : &w->levels[n]);
+    if (!lvl)
+        return false;
+
+    Level *prev = w->level;
+    w->cur_level = n;
+    w->level = lvl;
+    NewAnim(w);
+    InitState(w);
+    if (prev && w->put_level)
+        w->put_level(prev);
+    return true;
+}
+
+void maze_world_restart_level(MazeWorld *w)
+{
+    ZeroAnims(w);
+    ResetState(w);
+}
+
+void maze_world_reload_level(MazeWorld *w)
 {
-    cur_level = n;
-    NewAnim();
-    InitState();
+    ResetState(w);
+}
+
+int maze_world_get_level(MazeWorld *w)
+{
+    return w->cur_level;
+}
+
+void maze_world_set_level_source(MazeWorld *w, Level *(*get)(int n), void (*put)(Level *lvl))
+{
+    w->get_level = get;
+    w->put_level = put;
+}
+
+void maze_world_set_vibro_callback(MazeWorld *w, void (*f)(float))
+{
+    w->vibro_callback = f;
+}
+
+void maze_world_set_tilt(MazeWorld *w, float x, float y, float z)
+{
+    w->acx = x;
+    w->acy = y;
+    w->acz = z;
+}
+
+void maze_world_set_speed(MazeWorld *w, float s)
+{
+    w->force_coef = DEFAULT_FORCE_COEF * s;
+}
+
+void maze_world_set_broadphase(MazeWorld *w, MazeBroadphase broadphase)
+{
+    w->broadphase = broadphase;
+}
+
+MazeSnapshot *maze_world_snapshot_new(MazeWorld *w)
+{
+    if (!w->level)
+        return NULL;
+
+    MazeSnapshot *snap = (MazeSnapshot*)calloc(1, sizeof(MazeSnapshot));
+    snap->keys_count = w->level->keys_count;
+    snap->keys_anim = (Animation*)calloc(snap->keys_count + 1, sizeof(Animation));
+    return snap;
+}
+
+void maze_snapshot_free(MazeSnapshot *snap)
+{
+    if (!snap)
+        return;
+    free(snap->keys_anim);
+    free(snap);
+}
+
+bool maze_world_snapshot_save(MazeWorld *w, MazeSnapshot *snap)
+{
+    if (!w->level || !snap || snap->keys_count != w->level->keys_count)
+        return false;
+    SaveSnapshot(w, snap);
+    return true;
+}
+
+bool maze_world_snapshot_restore(MazeWorld *w, const MazeSnapshot *snap)
+{
+    if ( !w->level || !snap || (snap->level != w->cur_level) ||
+         (snap->keys_count != w->level->keys_count) )
+        return false;
+
+    RestoreSnapshot(w, snap);
+    dJointGroupEmpty(w->contactgroup);
+    w->accumulator = 0;
+    SavePose(w);
+    UpdateBallPos(w, 1);
+    return true;
+}
+
+bool maze_world_rewind(MazeWorld *w, int n)
+{
+    MazeSnapshot *snap = GetSnapshot(w, n);
+    if (!snap)
+        return false;
+
+    // the older snapshots are dropped, stepping goes on from this one
+    maze_world_snapshot_restore(w, snap);
+    w->history_count -= n;
+    w->history_head = (w->history_head - n + SNAPSHOTS_COUNT) % SNAPSHOTS_COUNT;
+    w->snapshot_age = 0;
+    return true;
+}
+
+void maze_world_set_fixed_step(MazeWorld *w, bool fixed)
+{
+    w->fixed_step = fixed;
+    w->accumulator = 0;
+}
+
+void maze_world_get_ball(MazeWorld *w, int *x, int *y, int *z, const dReal **rot)
+{
+    if (x) *x = w->ball_pos_x;
+    if (y) *y = w->ball_pos_y;
+    if (z) *z = w->ball_pos_z;
+    if (rot) *rot = w->ball_rot;
+}
+
+void maze_world_get_animations(MazeWorld *w, Animation **keys, Animation *final)
+{
+    *keys = w->keys_anim;
+    *final = w->final_anim;
+}
+
+bool maze_world_is_keys_passed(MazeWorld *w)
+{
+    Level *lvl = w->level;
+    return ( (lvl->keys_count > 0) &&
+             (w->keys_passed == lvl->keys_count) );
+}
+
+void maze_world_get_stats(MazeWorld *w, MazeStats *stats)
+{
+    *stats = w->stats;
+}
+
+//------------------------------------------------------------------------------
+//-- Default world --------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+GameState maze_step(int delta_ticks)
+{
+    return maze_world_step(default_world, delta_ticks);
+}
+
+bool maze_set_level(int n)
+{
+    return maze_world_set_level(default_world, n);
 }
 
 void maze_restart_level()
 {
-    ZeroAnims();
-    InitState();
+    maze_world_restart_level(default_world);
 }
 
 void maze_reload_level()
 {
-    InitState();
+    maze_world_reload_level(default_world);
 }
 
 void maze_set_config(MazeConfig cfg)
 {
-    game_config = cfg;
+    default_world->config = cfg;
 }
 
 void maze_set_levels_data(Level *lvls, int levels_count)
 {
-    game_levels = lvls;
-    game_levels_count = levels_count;
+    default_world->levels = lvls;
+    default_world->levels_count = levels_count;
+}
+
+void maze_set_level_source(Level *(*get)(int n), void (*put)(Level *lvl))
+{
+    maze_world_set_level_source(default_world, get, put);
 }
 
 void maze_set_vibro_callback(void (*f)(float))
 {
-    vibro_callback = f;
+    maze_world_set_vibro_callback(default_world, f);
 }
 
 void maze_set_tilt(float x, float y, float z)
 {
-    acx = x;
-    acy = y;
-    acz = z;
+    maze_world_set_tilt(default_world, x, y, z);
 }
 
 void maze_set_speed(float s)
 {
-    force_coef = DEFAULT_FORCE_COEF * s;
+    maze_world_set_speed(default_world, s);
+}
+
+void maze_set_fixed_step(bool fixed)
+{
+    maze_world_set_fixed_step(default_world, fixed);
 }
 
 void maze_get_ball(int *x, int *y, int *z, const dReal **rot)
 {
-    if (x) *x = ball_pos_x;
-    if (y) *y = ball_pos_y;
-    if (z) *z = ball_pos_z;
-    if (rot) *rot = ball_rot;
+    maze_world_get_ball(default_world, x, y, z, rot);
 }
 
 void maze_get_animations(Animation **keys, Animation *final)
 {
-    *keys = keys_anim;
-    *final = final_anim;
+    maze_world_get_animations(default_world, keys, final);
 }
 
 bool maze_is_keys_passed()
 {
-    return ( (game_levels[cur_level].keys_count > 0) &&
-             (keys_passed == game_levels[cur_level].keys_count) );
+    return maze_world_is_keys_passed(default_world);
 }
 
+bool maze_snapshot_save(MazeSnapshot *snap)
+{
+    return maze_world_snapshot_save(default_world, snap);
+}
+
+bool maze_snapshot_restore(const MazeSnapshot *snap)
+{
+    return maze_world_snapshot_restore(default_world, snap);
+}
+
+bool maze_rewind(int n)
+{
+    return maze_world_rewind(default_world, n);
+}
+
+//------------------------------------------------------------------------------
+
 void maze_init()
 {
-    dInitODE();
+    dInitODE2(0);
+    dAllocateODEDataForThread(dAllocateMaskAll);
+
+    MazeConfig cfg = {0};
+    default_world = maze_world_create(cfg, NULL, 0);
 }
 
 void maze_quit()
 {
+    maze_world_destroy(default_world);
+    default_world = NULL;
+    dCloseODE();
+}
+
+void maze_thread_init()
+{
+    dAllocateODEDataForThread(dAllocateMaskAll);
+}
+
+void maze_thread_quit()
+{
+    dCleanupODEAllDataForThread();
 }
@@ -25,19 +25,67 @@
 
 #include "mazetypes.h"
 
+typedef struct MazeWorld MazeWorld;
+
+MazeWorld *maze_world_create(MazeConfig cfg, Level *lvls, int levels_count);
+void maze_world_destroy(MazeWorld *w);
+GameState maze_world_step(MazeWorld *w, int delta_ticks);
+// false if the level source has no level n, the world stays on its level
+bool maze_world_set_level(MazeWorld *w, int n);
+void maze_world_restart_level(MazeWorld *w);
+void maze_world_reload_level(MazeWorld *w);
+int maze_world_get_level(MazeWorld *w);
+// levels are taken from get() instead of the array given at creation; the
+// world holds the level it got until another one is set and then gives it
+// back with put()
+void maze_world_set_level_source(MazeWorld *w, Level *(*get)(int n), void (*put)(Level *lvl));
+void maze_world_set_vibro_callback(MazeWorld *w, void (*f)(float));
+void maze_world_set_tilt(MazeWorld *w, float x, float y, float z);
+void maze_world_set_speed(MazeWorld *w, float s);
+// takes effect on the next maze_world_set_level()
+void maze_world_set_broadphase(MazeWorld *w, MazeBroadphase broadphase);
+// steps of a constant size, as many as the elapsed time needs; the ball is then
+// reported interpolated between the last two steps
+void maze_world_set_fixed_step(MazeWorld *w, bool fixed);
+void maze_world_get_ball(MazeWorld *w, int *x, int *y, int *z, const dReal **rot);
+void maze_world_get_animations(MazeWorld *w, Animation **keys, Animation *final);
+bool maze_world_is_keys_passed(MazeWorld *w);
+void maze_world_get_stats(MazeWorld *w, MazeStats *stats);
+
+// snapshots are sized for the level current at maze_world_snapshot_new() and
+// can be restored on that level only; there are none before a level is set
+MazeSnapshot *maze_world_snapshot_new(MazeWorld *w);
+void maze_snapshot_free(MazeSnapshot *snap);
+bool maze_world_snapshot_save(MazeWorld *w, MazeSnapshot *snap);
+bool maze_world_snapshot_restore(MazeWorld *w, const MazeSnapshot *snap);
+// goes back to the n-th latest of the snapshots the world takes by itself
+// every few steps (0 is the latest one)
+bool maze_world_rewind(MazeWorld *w, int n);
+
+// thin wrappers over the default world, created by maze_init()
 GameState maze_step(int delta_ticks);
-void maze_set_level(int n);
+bool maze_set_level(int n);
 void maze_restart_level();
 void maze_reload_level();
 void maze_set_config(MazeConfig cfg);
 void maze_set_levels_data(Level *lvls, int levels_count);
+void maze_set_level_source(Level *(*get)(int n), void (*put)(Level *lvl));
 void maze_set_vibro_callback(void (*f)(float));
 void maze_set_tilt(float x, float y, float z);
 void maze_set_speed(float s);
+void maze_set_fixed_step(bool fixed);
 void maze_get_ball(int *x, int *y, int *z, const dReal **rot);
 void maze_get_animations(Animation **keys, Animation *final);
 bool maze_is_keys_passed();
+bool maze_snapshot_save(MazeSnapshot *snap);
+bool maze_snapshot_restore(const MazeSnapshot *snap);
+bool maze_rewind(int n);
+
+// maze_init() must be called once per process before any world is created,
+// maze_thread_init() once by every other thread that steps a world
 void maze_init();
 void maze_quit();
+void maze_thread_init();
+void maze_thread_quit();
 
 #endif
@@ -0,0 +1,139 @@
+/*  mazegrid.c
+ *
+ *  Uniform grid over static level objects.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "mazegrid.h"
+#include "mazehelpers.h"
+
+static int cell_x(const MazeGrid *g, float x)
+{
+    int c = (int)floor((x - g->x0) / g->cell);
+    clamp(c, 0, g->cols-1);
+    return c;
+}
+
+static int cell_y(const MazeGrid *g, float y)
+{
+    int c = (int)floor((y - g->y0) / g->cell);
+    clamp(c, 0, g->rows-1);
+    return c;
+}
+
+void maze_grid_build(MazeGrid *g, float x0, float y0, float w, float h, float cell,
+                     const GridRect *rects, int count)
+{
+    g->x0 = x0;
+    g->y0 = y0;
+    g->cell = cell;
+    g->cols = (int)ceil(w / cell);
+    g->rows = (int)ceil(h / cell);
+    clamp_min(g->cols, 1);
+    clamp_min(g->rows, 1);
+
+    int cells_count = g->cols * g->rows;
+    g->cell_start = (int*)calloc(cells_count + 1, sizeof(int));
+
+    // counting pass, then prefix sums, then filling pass (in index order)
+    for (int i=0; i<count; i++)
+    {
+        int cx1 = cell_x(g, rects[i].x1), cx2 = cell_x(g, rects[i].x2);
+        int cy1 = cell_y(g, rects[i].y1), cy2 = cell_y(g, rects[i].y2);
+        for (int cy=cy1; cy<=cy2; cy++)
+            for (int cx=cx1; cx<=cx2; cx++)
+                g->cell_start[cy*g->cols + cx + 1]++;
+    }
+    for (int c=0; c<cells_count; c++)
+        g->cell_start[c+1] += g->cell_start[c];
+
+    g->items = (int*)malloc((g->cell_start[cells_count] + 1) * sizeof(int));
+    int *fill = (int*)malloc(cells_count * sizeof(int));
+    memcpy(fill, g->cell_start, cells_count * sizeof(int));
+    for (int i=0; i<count; i++)
+    {
+        int cx1 = cell_x(g, rects[i].x1), cx2 = cell_x(g, rects[i].x2);
+        int cy1 = cell_y(g, rects[i].y1), cy2 = cell_y(g, rects[i].y2);
+        for (int cy=cy1; cy<=cy2; cy++)
+            for (int cx=cx1; cx<=cx2; cx++)
+                g->items[fill[cy*g->cols + cx]++] = i;
+    }
+    free(fill);
+
+    g->items_count = count;
+    g->stamps = (unsigned int*)calloc(count + 1, sizeof(unsigned int));
+    g->stamp = 0;
+}
+
+void maze_grid_free(MazeGrid *g)
+{
+    free(g->cell_start);
+    free(g->items);
+    free(g->stamps);
+    memset(g, 0, sizeof(MazeGrid));
+}
+
+// collects every item whose cells overlap r, each item once
+int maze_grid_query(MazeGrid *g, GridRect r, int *out, int max_out)
+{
+    if (!g->cell_start)
+        return 0;
+
+    if (++g->stamp == 0)
+    {
+        memset(g->stamps, 0, g->items_count * sizeof(unsigned int));
+        g->stamp = 1;
+    }
+
+    int n = 0;
+    int cx1 = cell_x(g, r.x1), cx2 = cell_x(g, r.x2);
+    int cy1 = cell_y(g, r.y1), cy2 = cell_y(g, r.y2);
+    for (int cy=cy1; cy<=cy2; cy++)
+        for (int cx=cx1; cx<=cx2; cx++)
+        {
+            int c = cy*g->cols + cx;
+            for (int k=g->cell_start[c]; k<g->cell_start[c+1]; k++)
+            {
+                int item = g->items[k];
+                if (g->stamps[item] != g->stamp && n < max_out)
+                {
+                    g->stamps[item] = g->stamp;
+                    out[n++] = item;
+                }
+            }
+        }
+    return n;
+}
+
+// items of the single cell containing (x, y), in increasing index order
+const int *maze_grid_point(const MazeGrid *g, float x, float y, int *count)
+{
+    if (!g->cell_start)
+    {
+        *count = 0;
+        return NULL;
+    }
+
+    int c = cell_y(g, y)*g->cols + cell_x(g, x);
+    *count = g->cell_start[c+1] - g->cell_start[c];
+    return g->items + g->cell_start[c];
+}
@@ -0,0 +1,58 @@
+/*  mazegrid.h
+ *
+ *  Uniform grid over static level objects.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MAZEGRID_H
+#define MAZEGRID_H
+
+#include "mazetypes.h"
+
+typedef struct {
+    float x1;
+    float y1;
+
+    float x2;
+    float y2;
+} GridRect;
+
+// Items are stored per cell in increasing index order. Objects lying partly
+// outside the gridded area are kept in the border cells, queries are clamped
+// the same way, so nothing is lost at the edges.
+typedef struct {
+    float x0, y0;
+    float cell;
+    int cols, rows;
+
+    int *cell_start; // cols*rows+1 offsets into items
+    int *items;
+
+    int items_count;
+    unsigned int *stamps;
+    unsigned int stamp;
+} MazeGrid;
+
+void maze_grid_build(MazeGrid *g, float x0, float y0, float w, float h, float cell,
+                     const GridRect *rects, int count);
+void maze_grid_free(MazeGrid *g);
+int maze_grid_query(MazeGrid *g, GridRect r, int *out, int max_out);
+const int *maze_grid_point(const MazeGrid *g, float x, float y, int *count);
+
+#endif //MAZEGRID_H
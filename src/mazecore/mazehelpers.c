@@ -38,3 +38,71 @@ bool inbox_r(int x, int y, Point center, int r)
     return ( (x>=center.x-r) && (x<=center.x+r) &&
              (y>=center.y-r) && (y<=center.y+r) );
 }
+
+#define swap(x,y) \
+{ \
+    int _tmpx = x; \
+    x = y; \
+    y = _tmpx; \
+}
+
+#define rotate(x,y,w) \
+{ \
+    int _tmpx = x; \
+    x = (w-1)-y; \
+    y = _tmpx; \
+}
+
+#define scale(x,y,s) \
+{ \
+    x *= s; y *= s; \
+}
+
+#define scale_rotate(x,y,s,r,w) \
+{ \
+    scale(x, y, s); \
+    if (r) \
+        rotate(x, y, w); \
+}
+
+// fits the level coordinates to the display: scales them and optionally
+// rotates by 90 degrees within the scaled width
+void transform_level(Level *lvl, float scale, bool rot, int scaled_width)
+{
+    for (int j=0; j<lvl->boxes_count; j++)
+    {
+        Box *box = &lvl->boxes[j];
+        scale(box->x1, box->y1, scale);
+        scale(box->x2, box->y2, scale);
+        if (rot)
+        {
+            rotate(box->x1, box->y1, scaled_width);
+            rotate(box->x2, box->y2, scaled_width);
+            if (box->x1 > box->x2)
+                swap(box->x1, box->x2);
+            if (box->y1 > box->y2)
+                swap(box->y1, box->y2);
+        }
+    }
+
+    for (int j=0; j<lvl->fins_count; j++)
+    {
+        Point *p = &lvl->fins[j];
+        scale_rotate(p->x, p->y, scale, rot, scaled_width);
+    }
+
+    for (int j=0; j<lvl->holes_count; j++)
+    {
+        Point *p = &lvl->holes[j];
+        scale_rotate(p->x, p->y, scale, rot, scaled_width);
+    }
+
+    for (int j=0; j<lvl->keys_count; j++)
+    {
+        Point *p = &lvl->keys[j];
+        scale_rotate(p->x, p->y, scale, rot, scaled_width);
+    }
+
+    Point *p = &lvl->init;
+    scale_rotate(p->x, p->y, scale, rot, scaled_width);
+}
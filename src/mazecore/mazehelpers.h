@@ -35,5 +35,6 @@
 int sign(float x, float delta);
 bool inbox(float x, float y, Box box);
 bool inbox_r(int x, int y, Point center, int r);
+void transform_level(Level *lvl, float scale, bool rot, int scaled_width);
 
 #endif //MAZEHELPERS_H
\ No newline at end of file
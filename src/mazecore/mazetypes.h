@@ -45,6 +45,19 @@ typedef struct {
     bool played;
 } Animation;
 
+typedef enum {
+    MAZE_BROADPHASE_GRID,
+    MAZE_BROADPHASE_HASH
+} MazeBroadphase;
+
+typedef struct {
+    unsigned long steps;
+    unsigned long nan_rollbacks;
+    double sim_time;
+    unsigned long pairs_tested;  // collision pairs passed to the narrow phase
+    unsigned long contacts_made;
+} MazeStats;
+
 //------------------------------------------------------------------------------
 
 typedef struct {
@@ -88,4 +101,28 @@ typedef struct {
     Point *keys;
 } Level;
 
+//------------------------------------------------------------------------------
+
+// state of the ball and the level progress, enough to continue from
+typedef struct {
+    int level;
+    unsigned long step;
+
+    dReal pos[3];
+    dQuaternion quat;
+    dReal vel[3];
+    dReal angvel[3];
+
+    bool fall;
+    bool fall_fixed;
+    Point fall_hole;
+    GameState new_game_state;
+
+    int keys_passed;
+    int save_key;
+    Animation final_anim;
+    int keys_count;
+    Animation *keys_anim;
+} MazeSnapshot;
+
 #endif /* MAZETYPES_H */
@@ -0,0 +1,54 @@
+/*  hash.c
+ *
+ *  FNV-1a hashing of memory blocks and files.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include "hash.h"
+
+#define FNV_PRIME 0x100000001b3ULL
+
+uint64_t hash_data(uint64_t h, const void *data, size_t size)
+{
+    const uint8_t *p = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        h ^= p[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+bool hash_file(uint64_t *h, const char *fname)
+{
+    FILE *f = fopen(fname, "rb");
+    if (!f)
+        return false;
+
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        *h = hash_data(*h, buf, n);
+
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
@@ -0,0 +1,37 @@
+/*  hash.h
+ *
+ *  FNV-1a hashing of memory blocks and files.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define HASH_INIT 0xcbf29ce484222325ULL
+
+// 64-bit FNV-1a; pass HASH_INIT or a previous result to continue hashing
+uint64_t hash_data(uint64_t h, const void *data, size_t size);
+bool hash_file(uint64_t *h, const char *fname);
+
+#endif /* HASH_H */
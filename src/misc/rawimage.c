@@ -0,0 +1,187 @@
+/*  rawimage.c
+ *
+ *  Uncompressed images in the pixel format of the display.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include "rawimage.h"
+
+#define RAW_IMAGE_MAGIC "MKRI"
+#define RAW_IMAGE_VERSION 1
+
+// 64 bytes, so the pixels stay aligned in the mapping
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t width, height;
+    uint32_t bpp, pitch;
+    uint32_t rmask, gmask, bmask, amask;
+    uint32_t reserved[6];
+} RawImageHeader;
+
+// The mappings behind the loaded surfaces, images are loaded on the workers
+typedef struct RawImageMapping {
+    SDL_Surface *surface;
+    void *data;
+    size_t size;
+    struct RawImageMapping *next;
+} RawImageMapping;
+
+static RawImageMapping *mappings = NULL;
+static pthread_mutex_t mappings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int raw_image_save(SDL_Surface *surface, const char *fname)
+{
+    RawImageHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, RAW_IMAGE_MAGIC, 4);
+    hdr.version = RAW_IMAGE_VERSION;
+    hdr.width = surface->w;
+    hdr.height = surface->h;
+    hdr.bpp = surface->format->BitsPerPixel;
+    hdr.pitch = surface->pitch;
+    hdr.rmask = surface->format->Rmask;
+    hdr.gmask = surface->format->Gmask;
+    hdr.bmask = surface->format->Bmask;
+    hdr.amask = surface->format->Amask;
+
+    if (SDL_MUSTLOCK(surface))
+        if (SDL_LockSurface(surface) < 0)
+            return -1;
+
+    //written under a temporary name, a concurrent reader never maps a part
+    char *tmp_fname = (char*)malloc(strlen(fname) + strlen(".tmp") + 1);
+    sprintf(tmp_fname, "%s.tmp", fname);
+    bool ok = false;
+    FILE *f = fopen(tmp_fname, "wb");
+    if (f)
+    {
+        ok = (fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+              fwrite(surface->pixels, (size_t)surface->pitch * surface->h, 1, f) == 1);
+        ok = (fclose(f) == 0) && ok;
+        ok = ok && (rename(tmp_fname, fname) == 0);
+        if (!ok)
+            remove(tmp_fname);
+    }
+    free(tmp_fname);
+
+    if (SDL_MUSTLOCK(surface))
+        SDL_UnlockSurface(surface);
+    return (ok ? 0 : -1);
+}
+
+long raw_image_file_size(const SDL_Surface *surface)
+{
+    return (long)sizeof(RawImageHeader) + (long)surface->pitch * surface->h;
+}
+
+static bool SameFormat(const RawImageHeader *hdr, const SDL_PixelFormat *format)
+{
+    return (format &&
+            hdr->bpp == format->BitsPerPixel &&
+            hdr->rmask == format->Rmask && hdr->gmask == format->Gmask &&
+            hdr->bmask == format->Bmask && hdr->amask == format->Amask);
+}
+
+SDL_Surface *raw_image_load(const char *fname, int width, int height,
+                            const SDL_PixelFormat *opaque_format,
+                            const SDL_PixelFormat *alpha_format)
+{
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(RawImageHeader))
+        data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return NULL;
+
+    const RawImageHeader *hdr = (const RawImageHeader*)data;
+    bool valid = (!memcmp(hdr->magic, RAW_IMAGE_MAGIC, 4) &&
+                  hdr->version == RAW_IMAGE_VERSION &&
+                  hdr->width == (uint32_t)width && hdr->height == (uint32_t)height &&
+                  (hdr->bpp == 16 || hdr->bpp == 32) &&
+                  SameFormat(hdr, (hdr->amask ? alpha_format : opaque_format)) &&
+                  hdr->pitch >= hdr->width * hdr->bpp / 8 &&
+                  sizeof(RawImageHeader) + (off_t)hdr->pitch * hdr->height <= st.st_size);
+
+    SDL_Surface *res = NULL;
+    RawImageMapping *m = NULL;
+    if (valid)
+        res = SDL_CreateRGBSurfaceFrom((Uint8*)data + sizeof(RawImageHeader),
+                                       hdr->width, hdr->height, hdr->bpp, hdr->pitch,
+                                       hdr->rmask, hdr->gmask, hdr->bmask, hdr->amask);
+    if (res)
+        m = (RawImageMapping*)malloc(sizeof(RawImageMapping));
+    if (!m)
+    {
+        if (res)
+            SDL_FreeSurface(res);
+        munmap(data, st.st_size);
+        return NULL;
+    }
+
+    m->surface = res;
+    m->data = data;
+    m->size = st.st_size;
+    pthread_mutex_lock(&mappings_lock);
+    m->next = mappings;
+    mappings = m;
+    pthread_mutex_unlock(&mappings_lock);
+    return res;
+}
+
+// Surfaces not loaded by raw_image_load are just freed
+void raw_image_free(SDL_Surface *surface)
+{
+    if (!surface)
+        return;
+
+    RawImageMapping *m = NULL;
+    pthread_mutex_lock(&mappings_lock);
+    for (RawImageMapping **p = &mappings; *p; p = &(*p)->next)
+        if ((*p)->surface == surface)
+        {
+            m = *p;
+            *p = m->next;
+            break;
+        }
+    pthread_mutex_unlock(&mappings_lock);
+
+    SDL_FreeSurface(surface);
+    if (m)
+    {
+        munmap(m->data, m->size);
+        free(m);
+    }
+}
@@ -0,0 +1,44 @@
+/*  rawimage.h
+ *
+ *  Uncompressed images in the pixel format of the display.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RAWIMAGE_H
+#define RAWIMAGE_H
+
+#include <SDL/SDL.h>
+
+// The pixels of a surface as they are in memory, after a small header with
+// the size and the channel masks. A loaded image is mapped from the file and
+// used by the surface directly, raw_image_free releases both of them.
+//
+// An image is only loaded in the format the display converts to: the opaque
+// format if it has no alpha, the alpha format otherwise. Any other file was
+// written for another display and is rejected, so it gets rasterized again.
+
+int raw_image_save(SDL_Surface *surface, const char *fname);
+long raw_image_file_size(const SDL_Surface *surface);
+SDL_Surface *raw_image_load(const char *fname, int width, int height,
+                            const SDL_PixelFormat *opaque_format,
+                            const SDL_PixelFormat *alpha_format);
+void raw_image_free(SDL_Surface *surface);
+
+#endif /* RAWIMAGE_H */
@@ -0,0 +1,272 @@
+/*  workpool.c
+ *
+ *  Work-stealing thread pool.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "workpool.h"
+
+typedef struct {
+    WorkFunc func;
+    void *arg;
+} WorkItem;
+
+// Every worker owns a deque: the owner takes the newest item from the back,
+// idle workers steal the oldest one from the front.
+typedef struct {
+    pthread_mutex_t lock;
+    WorkItem *items;
+    int start;
+    int count;
+    int size;
+} WorkQueue;
+
+typedef struct {
+    WorkPool *pool;
+    int index;
+} WorkerArg;
+
+struct WorkPool {
+    int threads_count;
+    pthread_t *threads;
+    WorkerArg *args;
+    WorkQueue *queues;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    int queued;     // submitted but not yet reserved by a worker
+    int running;    // reserved but not yet finished
+    int next_queue;
+    bool quit;
+
+    void (*thread_init)();
+    void (*thread_quit)();
+};
+
+//------------------------------------------------------------------------------
+
+static void queue_push(WorkQueue *q, WorkItem item)
+{
+    pthread_mutex_lock(&q->lock);
+    if (q->start + q->count == q->size)
+    {
+        if (q->start > 0)
+        {
+            memmove(q->items, q->items + q->start, q->count * sizeof(WorkItem));
+            q->start = 0;
+        }
+        else
+        {
+            q->size = (q->size ? q->size * 2 : 16);
+            q->items = (WorkItem*)realloc(q->items, q->size * sizeof(WorkItem));
+        }
+    }
+    q->items[q->start + q->count] = item;
+    q->count++;
+    pthread_mutex_unlock(&q->lock);
+}
+
+static bool queue_pop_back(WorkQueue *q, WorkItem *item)
+{
+    bool res = false;
+    pthread_mutex_lock(&q->lock);
+    if (q->count > 0)
+    {
+        q->count--;
+        *item = q->items[q->start + q->count];
+        res = true;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return res;
+}
+
+static bool queue_pop_front(WorkQueue *q, WorkItem *item)
+{
+    bool res = false;
+    pthread_mutex_lock(&q->lock);
+    if (q->count > 0)
+    {
+        *item = q->items[q->start];
+        q->start++;
+        q->count--;
+        if (q->count == 0)
+            q->start = 0;
+        res = true;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return res;
+}
+
+//------------------------------------------------------------------------------
+
+static void take_item(WorkPool *pool, int self, WorkItem *item)
+{
+    // the caller has reserved an item, so some queue is guaranteed to hold it
+    for (;;)
+    {
+        if (queue_pop_back(&pool->queues[self], item))
+            return;
+        for (int i=1; i<pool->threads_count; i++)
+        {
+            int victim = (self + i) % pool->threads_count;
+            if (queue_pop_front(&pool->queues[victim], item))
+                return;
+        }
+    }
+}
+
+static void *worker(void *data)
+{
+    WorkerArg *arg = (WorkerArg*)data;
+    WorkPool *pool = arg->pool;
+
+    if (pool->thread_init)
+        pool->thread_init();
+
+    for (;;)
+    {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->queued == 0 && !pool->quit)
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        if (pool->queued == 0)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        pool->queued--;
+        pool->running++;
+        pthread_mutex_unlock(&pool->lock);
+
+        WorkItem item;
+        take_item(pool, arg->index, &item);
+        item.func(item.arg);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->running--;
+        if (pool->queued == 0 && pool->running == 0)
+            pthread_cond_broadcast(&pool->done_cond);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    if (pool->thread_quit)
+        pool->thread_quit();
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+
+WorkPool *workpool_create(int threads_count, void (*thread_init)(), void (*thread_quit)())
+{
+    if (threads_count < 1)
+        threads_count = 1;
+
+    WorkPool *pool = (WorkPool*)calloc(1, sizeof(WorkPool));
+    pool->threads_count = threads_count;
+    pool->thread_init = thread_init;
+    pool->thread_quit = thread_quit;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    pool->queues = (WorkQueue*)calloc(threads_count, sizeof(WorkQueue));
+    for (int i=0; i<threads_count; i++)
+        pthread_mutex_init(&pool->queues[i].lock, NULL);
+
+    pool->threads = (pthread_t*)calloc(threads_count, sizeof(pthread_t));
+    pool->args = (WorkerArg*)calloc(threads_count, sizeof(WorkerArg));
+    for (int i=0; i<threads_count; i++)
+    {
+        pool->args[i].pool = pool;
+        pool->args[i].index = i;
+        pthread_create(&pool->threads[i], NULL, worker, &pool->args[i]);
+    }
+
+    return pool;
+}
+
+void workpool_submit(WorkPool *pool, WorkFunc func, void *arg)
+{
+    WorkItem item;
+    item.func = func;
+    item.arg = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    int n = pool->next_queue;
+    pool->next_queue = (n + 1) % pool->threads_count;
+    pthread_mutex_unlock(&pool->lock);
+
+    queue_push(&pool->queues[n], item);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->queued++;
+    pthread_cond_signal(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void workpool_wait(WorkPool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (pool->queued > 0 || pool->running > 0)
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void workpool_destroy(WorkPool *pool)
+{
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i=0; i<pool->threads_count; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    for (int i=0; i<pool->threads_count; i++)
+    {
+        pthread_mutex_destroy(&pool->queues[i].lock);
+        free(pool->queues[i].items);
+    }
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_mutex_destroy(&pool->lock);
+
+    free(pool->queues);
+    free(pool->args);
+    free(pool->threads);
+    free(pool);
+}
+
+int workpool_get_threads_count(WorkPool *pool)
+{
+    return pool->threads_count;
+}
+
+int workpool_get_cpus_count()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0 ? (int)n : 1);
+}
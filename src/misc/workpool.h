@@ -0,0 +1,39 @@
+/*  workpool.h
+ *
+ *  Work-stealing thread pool.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include <stdbool.h>
+
+typedef struct WorkPool WorkPool;
+typedef void (*WorkFunc)(void *arg);
+
+// thread_init/thread_quit (may be NULL) run once in every worker thread
+WorkPool *workpool_create(int threads_count, void (*thread_init)(), void (*thread_quit)());
+void workpool_submit(WorkPool *pool, WorkFunc func, void *arg);
+void workpool_wait(WorkPool *pool);
+void workpool_destroy(WorkPool *pool);
+int workpool_get_threads_count(WorkPool *pool);
+int workpool_get_cpus_count();
+
+#endif /* WORKPOOL_H */
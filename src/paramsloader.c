@@ -24,12 +24,15 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <glib-object.h>
 #include <json-glib/json-glib.h>
 #include <argtable2.h>
 #include "types.h"
 #include "paramsloader.h"
+#include "levelpack.h"
 
 #define LOG_MODULE "Loader"
 #include "logging.h"
@@ -48,6 +51,7 @@ static Prompt arguments = {0};
 static char *save_dir_full = NULL;
 static char *cache_dir_full = NULL;
 static char *save_file_full = NULL;
+static char *levelpack_file = NULL;
 static bool can_save = false;
 
 static JsonParser *parser = NULL;
@@ -239,15 +243,8 @@ bool load_json(const char *fname)
     return root_object;
 }
 
-bool load_levelpack()
+void parse_requirements(JsonObject *requirements_object)
 {
-    const char *fname = MDIR LEVELPACK_DEFAULT ".levelpack.json";
-    log_info("Loading levelpack file `%s'", fname);
-    if (!load_json(fname))
-        return false;
-
-    JsonObject *requirements_object = _json_object_get_member_object(root_object, "requirements");
-
     JsonObject *pack_window_object = _json_object_get_member_object(requirements_object, "window");
     game_config.wnd_w = _json_object_get_member_int(pack_window_object, "width");
     game_config.wnd_h = _json_object_get_member_int(pack_window_object, "height");
@@ -263,6 +260,109 @@ bool load_levelpack()
 
     JsonObject *box_object = _json_object_get_member_object(requirements_object, "box");
     game_config.shadow = _json_object_get_member_int(box_object, "shadow");
+}
+
+// a level is only finished on a checkpoint, one without them is rejected
+// before anything is allocated
+bool parse_level(JsonObject *level_object, Level *level)
+{
+    JsonNode *fins_node = _json_object_get_member(level_object, "checkpoints");
+    JsonArray *fins_array = _json_node_get_array(fins_node);
+    int fins_count = _json_array_get_length(fins_array);
+    if (fins_count < 1)
+        return false;
+
+    JsonNode *boxes_node = _json_object_get_member(level_object, "boxes");
+    if (boxes_node)
+    {
+        JsonArray *boxes_array = _json_node_get_array(boxes_node);
+        int boxes_count = _json_array_get_length(boxes_array);
+        level->boxes_count = boxes_count;
+        level->boxes = (Box*)malloc(sizeof(Box) * boxes_count);
+        for (int j=0; j<boxes_count; j++)
+        {
+            JsonNode *box_node = _json_array_get_element(boxes_array, j);
+            JsonObject *box_object = _json_node_get_object(box_node);
+            Box *box = &level->boxes[j];
+            box->x1 = _json_object_get_member_int(box_object, "x1");
+            box->y1 = _json_object_get_member_int(box_object, "y1");
+            box->x2 = _json_object_get_member_int(box_object, "x2");
+            box->y2 = _json_object_get_member_int(box_object, "y2");
+        }
+    }
+
+    JsonNode *holes_node = _json_object_get_member(level_object, "holes");
+    if (holes_node)
+    {
+        JsonArray *holes_array = _json_node_get_array(holes_node);
+        int holes_count = _json_array_get_length(holes_array);
+        level->holes_count = holes_count;
+        level->holes = (Point*)malloc(sizeof(Point) * holes_count);
+        for (int j=0; j<holes_count; j++)
+        {
+            JsonNode *hole_node = _json_array_get_element(holes_array, j);
+            JsonObject *hole_object = _json_node_get_object(hole_node);
+            Point *hole = &level->holes[j];
+            hole->x = _json_object_get_member_int(hole_object, "x");
+            hole->y = _json_object_get_member_int(hole_object, "y");
+        }
+    }
+
+    JsonNode *keys_node = _json_object_get_member(level_object, "keys");
+    if (keys_node)
+    {
+        JsonArray *keys_array = _json_node_get_array(keys_node);
+        int keys_count = _json_array_get_length(keys_array);
+        level->keys_count = keys_count;
+        level->keys = (Point*)malloc(sizeof(Point) * keys_count);
+        for (int j=0; j<keys_count; j++)
+        {
+            JsonNode *key_node = _json_array_get_element(keys_array, j);
+            JsonObject *key_object = _json_node_get_object(key_node);
+            Point *key = &level->keys[j];
+            key->x = _json_object_get_member_int(key_object, "x");
+            key->y = _json_object_get_member_int(key_object, "y");
+        }
+    }
+
+    level->fins_count = fins_count;
+    level->fins = (Point*)malloc(sizeof(Point) * fins_count);
+    for (int j=0; j<fins_count; j++)
+    {
+        JsonNode *fin_node = _json_array_get_element(fins_array, j);
+        JsonObject *fin_object = _json_node_get_object(fin_node);
+        Point *fin = &level->fins[j];
+        fin->x = _json_object_get_member_int(fin_object, "x");
+        fin->y = _json_object_get_member_int(fin_object, "y");
+    }
+
+    JsonObject *init_object = _json_object_get_member_object(level_object, "init");
+    level->init.x = _json_object_get_member_int(init_object, "x");
+    level->init.y = _json_object_get_member_int(init_object, "y");
+    return true;
+}
+
+bool load_levelpack(const char *fname)
+{
+    log_info("Loading levelpack file `%s'", fname);
+    if (levelpack_is_binary(fname))
+    {
+        if (!levelpack_load_binary(fname, &game_config, &game_levels, &game_levels_count))
+            return false;
+        free(levelpack_file);
+        levelpack_file = strdup(fname);
+        log_info("%d game levels mapped", game_levels_count);
+        return true;
+    }
+
+    if (!load_json(fname))
+        return false;
+
+    free(levelpack_file);
+    levelpack_file = strdup(fname);
+
+    JsonObject *requirements_object = _json_object_get_member_object(root_object, "requirements");
+    parse_requirements(requirements_object);
 
     JsonNode *levels_node = _json_object_get_member(root_object, "levels");
     JsonArray *levels_array = _json_node_get_array(levels_node);
@@ -271,87 +371,276 @@ bool load_levelpack()
     game_levels = (Level*)calloc(levels_count, sizeof(Level));
     for (int i=0; i<levels_count; i++)
     {
-        Level *level = &game_levels[i];
-
         JsonNode *level_node = _json_array_get_element(levels_array, i);
         JsonObject *level_object = _json_node_get_object(level_node);
-
-        JsonNode *boxes_node = _json_object_get_member(level_object, "boxes");
-        if (boxes_node)
+        if (!parse_level(level_object, &game_levels[i]))
         {
-            JsonArray *boxes_array = _json_node_get_array(boxes_node);
-            int boxes_count = _json_array_get_length(boxes_array);
-            level->boxes_count = boxes_count;
-            level->boxes = (Box*)malloc(sizeof(Box) * boxes_count);
-            for (int j=0; j<boxes_count; j++)
-            {
-                JsonNode *box_node = _json_array_get_element(boxes_array, j);
-                JsonObject *box_object = _json_node_get_object(box_node);
-                Box *box = &level->boxes[j];
-                box->x1 = _json_object_get_member_int(box_object, "x1");
-                box->y1 = _json_object_get_member_int(box_object, "y1");
-                box->x2 = _json_object_get_member_int(box_object, "x2");
-                box->y2 = _json_object_get_member_int(box_object, "y2");
-            }
+            log_error("level %d of `%s' has no checkpoints", i + 1, fname);
+            game_levels_count = 0;
+            return false;
         }
+    }
+
+    log_info("%d game levels parsed", levels_count);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Index-only loading: the requirements are parsed at once, the levels only
+// when they are needed. The JSON file is mapped and scanned for the spans of
+// the level objects, without building the document.
+
+typedef struct {
+    size_t offset;
+    size_t length;
+} JsonSpan;
+
+static bool pack_indexed = false;
+static bool pack_binary = false;
+static char *json_data = NULL;
+static size_t json_size = 0;
+static JsonSpan *level_spans = NULL;
+
+static const char* skip_spaces(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+        p++;
+    return p;
+}
 
-        JsonNode *holes_node = _json_object_get_member(level_object, "holes");
-        if (holes_node)
+// p is at the opening quote, the result is after the closing one
+static const char* skip_string(const char *p, const char *end)
+{
+    for (p++; p < end; p++)
+    {
+        if (*p == '\\')
+            p++;
+        else if (*p == '"')
+            return p + 1;
+    }
+    return end;
+}
+
+static const char* skip_value(const char *p, const char *end)
+{
+    int depth = 0;
+    while (p < end)
+    {
+        if (*p == '"')
         {
-            JsonArray *holes_array = _json_node_get_array(holes_node);
-            int holes_count = _json_array_get_length(holes_array);
-            level->holes_count = holes_count;
-            level->holes = (Point*)malloc(sizeof(Point) * holes_count);
-            for (int j=0; j<holes_count; j++)
-            {
-                JsonNode *hole_node = _json_array_get_element(holes_array, j);
-                JsonObject *hole_object = _json_node_get_object(hole_node);
-                Point *hole = &level->holes[j];
-                hole->x = _json_object_get_member_int(hole_object, "x");
-                hole->y = _json_object_get_member_int(hole_object, "y");
-            }
+            p = skip_string(p, end);
+            if (depth == 0)
+                return p;
+            continue;
+        }
+        if (*p == '{' || *p == '[')
+            depth++;
+        else if (*p == '}' || *p == ']')
+        {
+            if (depth == 0)
+                return p;
+            if (--depth == 0)
+                return p + 1;
         }
+        else if (depth == 0 && *p == ',')
+            return p;
+        p++;
+    }
+    return end;
+}
+
+// value of a member of the top-level object
+static bool find_member(const char *name, JsonSpan *span)
+{
+    const char *end = json_data + json_size;
+    const char *p = skip_spaces(json_data, end);
+    if (p == end || *p != '{')
+        return false;
 
-        JsonNode *keys_node = _json_object_get_member(level_object, "keys");
-        if (keys_node)
+    for (p = skip_spaces(p + 1, end); p < end && *p == '"'; )
+    {
+        const char *key = p + 1;
+        p = skip_string(p, end);
+        bool match = ((size_t)(p - 1 - key) == strlen(name) && !strncmp(key, name, strlen(name)));
+        p = skip_spaces(p, end);
+        if (p == end || *p != ':')
+            return false;
+        p = skip_spaces(p + 1, end);
+        const char *value = p;
+        p = skip_value(p, end);
+        if (match)
         {
-            JsonArray *keys_array = _json_node_get_array(keys_node);
-            int keys_count = _json_array_get_length(keys_array);
-            level->keys_count = keys_count;
-            level->keys = (Point*)malloc(sizeof(Point) * keys_count);
-            for (int j=0; j<keys_count; j++)
-            {
-                JsonNode *key_node = _json_array_get_element(keys_array, j);
-                JsonObject *key_object = _json_node_get_object(key_node);
-                Point *key = &level->keys[j];
-                key->x = _json_object_get_member_int(key_object, "x");
-                key->y = _json_object_get_member_int(key_object, "y");
-            }
+            span->offset = value - json_data;
+            span->length = p - value;
+            return true;
         }
+        p = skip_spaces(p, end);
+        if (p < end && *p == ',')
+            p = skip_spaces(p + 1, end);
+    }
+    return false;
+}
+
+static int index_levels(const JsonSpan *levels)
+{
+    const char *end = json_data + levels->offset + levels->length;
+    const char *p = json_data + levels->offset;
+    if (*p != '[')
+        return -1;
 
-        JsonNode *fins_node = _json_object_get_member(level_object, "checkpoints");
-        JsonArray *fins_array = _json_node_get_array(fins_node);
-        int fins_count = _json_array_get_length(fins_array);
-        level->fins_count = fins_count;
-        level->fins = (Point*)malloc(sizeof(Point) * fins_count);
-        for (int j=0; j<fins_count; j++)
+    int count = 0, size = 0;
+    for (p = skip_spaces(p + 1, end); p < end && *p == '{'; )
+    {
+        const char *level = p;
+        p = skip_value(p, end);
+        if (count == size)
         {
-            JsonNode *fin_node = _json_array_get_element(fins_array, j);
-            JsonObject *fin_object = _json_node_get_object(fin_node);
-            Point *fin = &level->fins[j];
-            fin->x = _json_object_get_member_int(fin_object, "x");
-            fin->y = _json_object_get_member_int(fin_object, "y");
+            size = (size ? size * 2 : 256);
+            level_spans = (JsonSpan*)realloc(level_spans, size * sizeof(JsonSpan));
         }
+        level_spans[count].offset = level - json_data;
+        level_spans[count].length = p - level;
+        count++;
+        p = skip_spaces(p, end);
+        if (p < end && *p == ',')
+            p = skip_spaces(p + 1, end);
+    }
+    return count;
+}
 
-        JsonObject *init_object = _json_object_get_member_object(level_object, "init");
-        level->init.x = _json_object_get_member_int(init_object, "x");
-        level->init.y = _json_object_get_member_int(init_object, "y");
+static JsonObject* parse_span(JsonParser *span_parser, const JsonSpan *span)
+{
+    GError *error = NULL;
+    json_parser_load_from_data(span_parser, json_data + span->offset, span->length, &error);
+    if (error)
+    {
+        log_error("Unable to parse: %s", error->message);
+        g_error_free(error);
+        return NULL;
     }
+    return _json_node_get_object(json_parser_get_root(span_parser));
+}
 
-    log_info("%d game levels parsed", levels_count);
+bool open_json_levelpack(const char *fname)
+{
+    int fd = open(fname, O_RDONLY);
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0)
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (fd >= 0)
+        close(fd);
+    if (data == MAP_FAILED)
+    {
+        log_error("can't map levelpack `%s'", fname);
+        return false;
+    }
+    json_data = (char*)data;
+    json_size = st.st_size;
+
+    JsonSpan requirements, levels;
+    JsonObject *requirements_object = NULL;
+    if (find_member("requirements", &requirements) && find_member("levels", &levels))
+        requirements_object = parse_span(parser, &requirements);
+    if (!requirements_object)
+    {
+        log_error("levelpack `%s' has no requirements or levels", fname);
+        return false;
+    }
+    parse_requirements(requirements_object);
+
+    int levels_count = index_levels(&levels);
+    if (levels_count < 0)
+    {
+        log_error("levels of `%s' are not an array", fname);
+        return false;
+    }
+    game_levels_count = levels_count;
     return true;
 }
 
+void close_levelpack()
+{
+    if (json_data)
+        munmap(json_data, json_size);
+    json_data = NULL;
+    json_size = 0;
+    free(level_spans);
+    level_spans = NULL;
+    levelpack_close_binary();
+    pack_indexed = false;
+}
+
+bool open_levelpack(const char *fname)
+{
+    log_info("Opening levelpack file `%s'", fname);
+    close_levelpack();
+    pack_binary = levelpack_is_binary(fname);
+    bool opened = (pack_binary ? levelpack_open_binary(fname, &game_config, &game_levels_count) :
+                                 open_json_levelpack(fname));
+    if (!opened)
+    {
+        close_levelpack();
+        return false;
+    }
+
+    free(levelpack_file);
+    levelpack_file = strdup(fname);
+    pack_indexed = true;
+    log_info("%d game levels indexed", game_levels_count);
+    return true;
+}
+
+bool LoadGameLevel(int n, Level *lvl)
+{
+    memset(lvl, 0, sizeof(Level));
+    if (!pack_indexed || n < 0 || n >= game_levels_count)
+        return false;
+    if (pack_binary)
+        return levelpack_read_binary_level(n, lvl);
+
+    //a parser of its own, levels are loaded by the prerender thread too
+    JsonParser *level_parser = json_parser_new();
+    JsonObject *level_object = parse_span(level_parser, &level_spans[n]);
+    bool ok = (level_object && parse_level(level_object, lvl));
+    if (level_object && !ok)
+        log_error("level %d has no checkpoints", n + 1);
+    g_object_unref(level_parser);
+    return ok;
+}
+
+// a name with a slash is the path of the pack, other names are looked up in
+// the data directory, where the compiled pack is used when it's not older
+// than the JSON one
+bool open_named_levelpack(const char *name)
+{
+    if (strchr(name, '/'))
+        return open_levelpack(name);
+
+    char *json_fname = (char*)malloc(strlen(MDIR) + strlen(name) + strlen(LEVELPACK_JSON_EXT) + 1);
+    sprintf(json_fname, "%s%s%s", MDIR, name, LEVELPACK_JSON_EXT);
+    char *bin_fname = (char*)malloc(strlen(MDIR) + strlen(name) + strlen(LEVELPACK_BINARY_EXT) + 1);
+    sprintf(bin_fname, "%s%s%s", MDIR, name, LEVELPACK_BINARY_EXT);
+
+    struct stat json_st, bin_st;
+    bool json_exists = (stat(json_fname, &json_st) == 0);
+    bool opened = false;
+    if (stat(bin_fname, &bin_st) == 0 && (!json_exists || bin_st.st_mtime >= json_st.st_mtime))
+    {
+        opened = open_levelpack(bin_fname);
+        if (!opened && json_exists)
+            log_warning("falling back to the JSON levelpack");
+    }
+    if (!opened && json_exists)
+        opened = open_levelpack(json_fname);
+    if (!opened && !json_exists)
+        log_error("levelpack `%s' is not found", name);
+
+    free(json_fname);
+    free(bin_fname);
+    return opened;
+}
+
 #define CONFIG_FORMAT 1
 bool load_config(const char *fname)
 {
@@ -377,6 +666,8 @@ bool load_config(const char *fname)
     user_set.scrolling = _json_object_get_member_boolean(root_object, "scrolling");
     user_set.frame_delay = _json_object_get_member_int(root_object, "frame_delay");
     user_set.ball_speed = (float)_json_object_get_member_double(root_object, "ball_speed");
+    user_set.fixed_step = _json_object_get_member_boolean(root_object, "fixed_step");
+    user_set.level_cache_disk = _json_object_get_member_boolean(root_object, "level_cache_disk");
     user_set.bump_min_speed = (float)_json_object_get_member_double(root_object, "bump_min_speed");
     user_set.bump_max_speed = (float)_json_object_get_member_double(root_object, "bump_max_speed");
 
@@ -448,12 +739,27 @@ bool load_params()
     if (!loaded)
         loaded = load_config(CONFIG_FILE);
     if (loaded)
-        loaded = load_levelpack();
+    {
+        loaded = open_named_levelpack(user_set.levelpack);
+        if (!loaded && strcmp(user_set.levelpack, LEVELPACK_DEFAULT))
+        {
+            log_warning("using levelpack `%s' instead", LEVELPACK_DEFAULT);
+            loaded = open_named_levelpack(LEVELPACK_DEFAULT);
+        }
+    }
     g_object_unref(parser);
 
     return loaded;
 }
 
+bool LoadLevelpack(const char *fname)
+{
+    parser = json_parser_new();
+    bool loaded = load_levelpack(fname);
+    g_object_unref(parser);
+    return loaded;
+}
+
 void SetJsonValues()
 {
     _json_object_set_member_string(root_object, "levelpack", user_set.levelpack);
@@ -464,6 +770,8 @@ void SetJsonValues()
     _json_object_set_member_boolean(root_object, "scrolling", user_set.scrolling);
     _json_object_set_member_int(root_object, "frame_delay", user_set.frame_delay);
     _json_object_set_member_double(root_object, "ball_speed", user_set.ball_speed);
+    _json_object_set_member_boolean(root_object, "fixed_step", user_set.fixed_step);
+    _json_object_set_member_boolean(root_object, "level_cache_disk", user_set.level_cache_disk);
     _json_object_set_member_double(root_object, "bump_min_speed", user_set.bump_min_speed);
     _json_object_set_member_double(root_object, "bump_max_speed", user_set.bump_max_speed);
 
@@ -578,6 +886,8 @@ void SaveUserSettings()
     free(user_set.input_joystick_data.fname); //
     free(cache_dir_full);
     free(save_dir_full);
+    free(levelpack_file);
+    free(arguments.record_file);
     free(save_file_full);
 }
 
@@ -594,9 +904,10 @@ void parse_command_line(int argc, char *argv[])
     struct arg_int *bpp    = arg_int0("b","bpp",NULL, "set color depth (16/32 bits/pixel, 0 = auto detect)");
     struct arg_str *scroll = arg_str0("s","scrolling","<boolean>", "scroll game window if the level does not fit to it");
     struct arg_str *fscr   = arg_str0("f","fullscreen","<mode>", "set fullscreen mode ('none', 'ingame' or 'always')");
+    struct arg_file *rec   = arg_file0("r","record","<file>", "record the game to a replay file");
     struct arg_lit *help   = arg_lit0(NULL,"help", "print this help and exit");
     struct arg_end *end    = arg_end (20);
-    void* argtable[] = {input,input1,vibro,cal,cal1,level,geom_x,geom_y,bpp,scroll,fscr,help,end};
+    void* argtable[] = {input,input1,vibro,cal,cal1,level,geom_x,geom_y,bpp,scroll,fscr,rec,help,end};
     const char* progname = "mokomaze";
     int nerrors = 0;
 
@@ -687,6 +998,9 @@ void parse_command_line(int argc, char *argv[])
         arguments.fullscreen_mode = StrToFullscreenMode(fscr_str, false);
     }
 
+    if (rec->count > 0)
+        arguments.record_file = strdup(rec->filename[0]);
+
     /* deallocate each non-null entry in argtable[] */
     arg_freetable(argtable,sizeof(argtable)/sizeof(argtable[0]));
 }
@@ -733,6 +1047,11 @@ User* GetUserSettings()
     return &user_set;
 }
 
+char* GetLevelpackFile()
+{
+    return levelpack_file;
+}
+
 Prompt GetArguments()
 {
     return arguments;
@@ -27,6 +27,8 @@
 
 void parse_command_line(int argc, char *argv[]);
 bool load_params();
+bool LoadLevelpack(const char *fname);
+bool LoadGameLevel(int n, Level *lvl);
 bool TouchDir(char *dir);
 MazeConfig GetGameConfig();
 Level* GetGameLevels();
@@ -36,5 +38,6 @@ Prompt GetArguments();
 void SaveUserSettings();
 char* GetSaveDir();
 char* GetCacheDir();
+char* GetLevelpackFile();
 
 #endif
@@ -0,0 +1,196 @@
+/*  prerender.c
+ *
+ *  Background rendering of the neighbouring levels.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <SDL/SDL.h>
+#include <SDL/SDL_thread.h>
+#include "render.h"
+#include "prerender.h"
+
+#define LOG_MODULE "Prerender"
+#include "logging.h"
+
+#define PRERENDER_SLOTS 2
+
+typedef struct {
+    SDL_Surface *surf;
+    int level;  // level wanted in the slot, -1 for none
+    bool ready; // surf holds the image of the level
+} PrerenderSlot;
+
+static PrerenderSlot slots[PRERENDER_SLOTS];
+static int busy_slot = -1;
+static SDL_Thread *thread = NULL;
+static SDL_mutex *lock = NULL;
+static SDL_cond *wake = NULL, *done = NULL;
+static bool finished = false;
+
+//------------------------------------------------------------------------------
+
+static int FindSlot(int level)
+{
+    for (int i=0; i<PRERENDER_SLOTS; i++)
+        if (slots[i].level == level)
+            return i;
+    return -1;
+}
+
+static int FindPendingSlot()
+{
+    for (int i=0; i<PRERENDER_SLOTS; i++)
+        if (slots[i].level >= 0 && !slots[i].ready)
+            return i;
+    return -1;
+}
+
+static int prerender_work(void *data)
+{
+    SDL_LockMutex(lock);
+    while (!finished)
+    {
+        int n = FindPendingSlot();
+        if (n < 0)
+        {
+            SDL_CondWait(wake, lock);
+            continue;
+        }
+
+        //the surface of the busy slot is left alone by the other functions
+        int level = slots[n].level;
+        busy_slot = n;
+        SDL_UnlockMutex(lock);
+        bool rendered = RenderLevelTo(slots[n].surf, level);
+        SDL_LockMutex(lock);
+        busy_slot = -1;
+        //a level that can't be loaded is dropped, not tried over and over
+        if (slots[n].level == level)
+        {
+            slots[n].ready = rendered;
+            if (!rendered)
+                slots[n].level = -1;
+        }
+        SDL_CondBroadcast(done);
+    }
+    SDL_UnlockMutex(lock);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+void prerender_init(const SDL_Surface *like)
+{
+    for (int i=0; i<PRERENDER_SLOTS; i++)
+    {
+        slots[i].surf = CreateSurface(SDL_SWSURFACE, like->w, like->h, like);
+        slots[i].level = -1;
+        slots[i].ready = false;
+    }
+    busy_slot = -1;
+    finished = false;
+    lock = SDL_CreateMutex();
+    wake = SDL_CreateCond();
+    done = SDL_CreateCond();
+    thread = SDL_CreateThread(prerender_work, NULL);
+    if (!thread)
+        log_warning("can't start the prerender thread, levels will be rendered on change");
+}
+
+void prerender_request(int prev_level, int next_level)
+{
+    if (!thread)
+        return;
+
+    int wanted[PRERENDER_SLOTS] = {next_level, prev_level};
+    SDL_LockMutex(lock);
+    //free the slots of the levels not wanted anymore
+    for (int i=0; i<PRERENDER_SLOTS; i++)
+    {
+        bool keep = false;
+        for (int j=0; j<PRERENDER_SLOTS; j++)
+            keep |= (slots[i].level == wanted[j]);
+        if (!keep)
+        {
+            slots[i].level = -1;
+            slots[i].ready = false;
+        }
+    }
+    for (int j=0; j<PRERENDER_SLOTS; j++)
+    {
+        if (wanted[j] < 0 || FindSlot(wanted[j]) >= 0)
+            continue;
+        int n = FindSlot(-1);
+        slots[n].level = wanted[j];
+        slots[n].ready = false;
+    }
+    SDL_CondSignal(wake);
+    SDL_UnlockMutex(lock);
+}
+
+bool prerender_take(int level, SDL_Surface **surf)
+{
+    if (!thread)
+        return false;
+
+    SDL_LockMutex(lock);
+    int n = FindSlot(level);
+    while (n >= 0 && n == busy_slot)
+    {
+        SDL_CondWait(done, lock);
+        n = FindSlot(level);
+    }
+
+    bool res = (n >= 0 && slots[n].ready);
+    if (res)
+    {
+        SDL_Surface *tmp = *surf;
+        *surf = slots[n].surf;
+        slots[n].surf = tmp;
+    }
+    if (n >= 0)
+    {
+        slots[n].level = -1;
+        slots[n].ready = false;
+    }
+    SDL_UnlockMutex(lock);
+    return res;
+}
+
+void prerender_shutdown()
+{
+    if (thread)
+    {
+        SDL_LockMutex(lock);
+        finished = true;
+        SDL_CondSignal(wake);
+        SDL_UnlockMutex(lock);
+        SDL_WaitThread(thread, NULL);
+        thread = NULL;
+    }
+    SDL_DestroyCond(done);
+    SDL_DestroyCond(wake);
+    SDL_DestroyMutex(lock);
+    for (int i=0; i<PRERENDER_SLOTS; i++)
+    {
+        SDL_FreeSurface(slots[i].surf);
+        slots[i].surf = NULL;
+    }
+}
@@ -0,0 +1,41 @@
+/*  prerender.h
+ *
+ *  Background rendering of the neighbouring levels.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef PRERENDER_H
+#define PRERENDER_H
+
+#include <stdbool.h>
+#include <SDL/SDL.h>
+
+// A worker thread renders the levels next to the current one into spare
+// surfaces of the same format as `like`. At a level change the image is
+// taken by exchanging the surfaces, the old one becomes a spare. Only the
+// images are prepared ahead: maze_set_level() still rebuilds the physics of
+// the level, its geoms and grids, on the caller's thread.
+
+void prerender_init(const SDL_Surface *like);
+void prerender_request(int prev_level, int next_level);
+bool prerender_take(int level, SDL_Surface **surf);
+void prerender_shutdown();
+
+#endif /* PRERENDER_H */
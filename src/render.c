@@ -20,12 +20,18 @@
  *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+#include <SDL/SDL_thread.h>
 #include "render.h"
+#include "render_span.h"
+#include "levelcache.h"
+#include "levelstore.h"
+#include "dirtyrects.h"
 #include "matrix.h"
 #include "mazecore/mazehelpers.h"
 #include "types.h"
 
-extern Level *game_levels;
+extern Level *game_level;
 extern MazeConfig game_config;
 extern int cur_level;
 extern int prev_px, prev_py;
@@ -49,109 +55,150 @@ void **alloc2d(int mi, int mj, int s, int su)
     return res;
 }
 
+void free2d(void **p, int mi)
+{
+    if (!p)
+        return;
+    for(int i=0; i < mi; i++)
+        free(p[i]);
+    free(p);
+}
+
 #define ALLOC2D_DIAM(type, diam) (type**) alloc2d(diam, diam, sizeof(type), sizeof(type*))
 
 #define AA_SAMPLING_STEP 4
 #define AA_SAMPLES_COUNT (AA_SAMPLING_STEP * AA_SAMPLING_STEP)
-void calc_circle(float **zeds, uint8_t **aa, int rad1, int rad2, bool rel)
+#if AA_SAMPLES_COUNT != SPAN_AA_MAX
+#error "coverage tables don't match the span kernels"
+#endif
+static int CircleCoverage(int x, int y, int rad1, int rad2)
 {
-    float zk = rel ? 1.0/rad2 : 1;
-    for (int x = -rad2; x <= rad2; x++)
-    {
-        for (int y = -rad2; y <= rad2; y++)
-        {
-            float xdist = x*x + y*y;
-            int sample_hit = 0;
+    float xdist = x*x + y*y;
+    int sample_hit = 0;
 
-            if ( xdist > sqr(rad2 + 1) ||
-                 ( rad1 > 0 && xdist < sqr(rad1 - 1) ) ) sample_hit = 0;
-            else if ( xdist < sqr(rad2 - 1) &&
-                     ( rad1 == 0 || xdist > sqr(rad1 + 1) ) ) sample_hit = AA_SAMPLES_COUNT;
-            else
+    if ( xdist > sqr(rad2 + 1) ||
+         ( rad1 > 0 && xdist < sqr(rad1 - 1) ) ) sample_hit = 0;
+    else if ( xdist < sqr(rad2 - 1) &&
+             ( rad1 == 0 || xdist > sqr(rad1 + 1) ) ) sample_hit = AA_SAMPLES_COUNT;
+    else
+    {
+        for (int ii = 0; ii < AA_SAMPLING_STEP; ii++)
+            for (int jj = 0; jj < AA_SAMPLING_STEP; jj++)
             {
-                for (int ii = 0; ii < AA_SAMPLING_STEP; ii++)
-                    for (int jj = 0; jj < AA_SAMPLING_STEP; jj++)
-                    {
-                        float rast = sqr(x - 0.3 + 0.2 * ii) + sqr(y - 0.3 + 0.2 * jj);
-                        if ((rast <= rad2 * rad2) && (rast >= rad1 * rad1))
-                            sample_hit++;
-                    }
+                float rast = sqr(x - 0.3 + 0.2 * ii) + sqr(y - 0.3 + 0.2 * jj);
+                if ((rast <= rad2 * rad2) && (rast >= rad1 * rad1))
+                    sample_hit++;
             }
-
-            if (aa) aa[x + rad2][y + rad2] = sample_hit;
-            if (zeds) zeds[x + rad2][y + rad2] = (sample_hit == AA_SAMPLES_COUNT) ? sqrt(rad2 * rad2 - xdist)*zk : -1;
-        }
     }
+    return sample_hit;
 }
 
-//------------------------------------------------------------------------------
-
-#define rshift screen->format->Rshift
-#define gshift screen->format->Gshift
-#define bshift screen->format->Bshift
-#define ashift screen->format->Ashift
+// A circle (or a ring, when rad1 > 0) stored as horizontal runs of pixels,
+// row by row from the top and left to right within a row. A run is either
+// fully covered or an antialiased edge; pixels with no coverage are not
+// stored at all. The per pixel data of all the runs is kept in two
+// contiguous arrays.
+typedef struct {
+    int16_t x, y;   // first pixel, relative to the centre
+    int16_t len;
+    int16_t full;
+    int data;       // first pixel in z[] for full runs, in aa[] for edge ones
+} CircleSpan;
+
+typedef struct {
+    int r;
+    int spans_count;
+    CircleSpan *spans;
+
+    int full_count;
+    float *z;       // height of the fully covered pixels, if requested
+    int edge_count;
+    uint8_t *aa;    // coverage of the edge pixels
+} CircleMask;
+
+static void BuildCircleMask(CircleMask *m, int rad1, int rad2, bool rel, bool with_z)
+{
+    int diam = rad2*2 + 1;
+    m->r = rad2;
+    m->spans_count = m->full_count = m->edge_count = 0;
+    m->spans = (CircleSpan*)malloc(diam*diam * sizeof(CircleSpan));
+    m->z = (with_z ? (float*)malloc(diam*diam * sizeof(float)) : NULL);
+    m->aa = (uint8_t*)malloc(diam*diam);
 
-#define rmask screen->format->Rmask
-#define gmask screen->format->Gmask
-#define bmask screen->format->Bmask
-#define amask screen->format->Amask
+    float zk = rel ? 1.0/rad2 : 1;
+    for (int y = -rad2; y <= rad2; y++)
+    {
+        CircleSpan *cur = NULL;
+        for (int x = -rad2; x <= rad2; x++)
+        {
+            int sample_hit = CircleCoverage(x, y, rad1, rad2);
+            if (sample_hit == 0)
+            {
+                cur = NULL;
+                continue;
+            }
 
-#define extract_r(col) ((col & rmask) >> rshift)
-#define extract_g(col) ((col & gmask) >> gshift)
-#define extract_b(col) ((col & bmask) >> bshift)
-#define extract_a(col) ((col & amask) >> ashift)
+            bool full = (sample_hit == AA_SAMPLES_COUNT);
+            if (cur == NULL || cur->full != full)
+            {
+                cur = &m->spans[m->spans_count++];
+                cur->x = x; cur->y = y;
+                cur->len = 0;
+                cur->full = full;
+                cur->data = (full ? m->full_count : m->edge_count);
+            }
+            cur->len++;
 
-#define max_r (rmask >> rshift)
-#define max_g (gmask >> gshift)
-#define max_b (bmask >> bshift)
-#define max_a (amask >> ashift)
+            if (full)
+            {
+                float xdist = x*x + y*y;
+                if (m->z) m->z[m->full_count] = sqrt(rad2 * rad2 - xdist)*zk;
+                m->full_count++;
+            }
+            else
+                m->aa[m->edge_count++] = sample_hit;
+        }
+    }
 
-Uint32 GetPixel(SDL_Surface *surf, int adr)
-{
-    if (disp_bpp == 32)
-        return ((Uint32*)surf->pixels)[adr];
-    else
-        return ((Uint16*)surf->pixels)[adr];
+    m->spans = (CircleSpan*)realloc(m->spans, m->spans_count * sizeof(CircleSpan));
+    if (m->z) m->z = (float*)realloc(m->z, (m->full_count + 1) * sizeof(float));
+    m->aa = (uint8_t*)realloc(m->aa, m->edge_count + 1);
 }
 
-void PutPixel(SDL_Surface *surf, int adr, Uint32 col)
+static void FreeCircleMask(CircleMask *m)
 {
-    if (disp_bpp == 32)
-        ((Uint32*)surf->pixels)[adr] = col;
-    else
-        ((Uint16*)surf->pixels)[adr] = col;
+    free(m->spans);
+    free(m->z);
+    free(m->aa);
+    memset(m, 0, sizeof(CircleMask));
 }
 
-Uint32 ColorToBit(uint8_t c0, uint8_t c1, uint8_t c2)
+// Clips a run of a circle centred at (x0, y0) against a w*h surface. Returns
+// the number of visible pixels, *skip is set to the number cut on the left.
+static inline int ClipSpan(const CircleSpan *s, int x0, int y0, int w, int h, int *skip)
 {
-    return (c0<<rshift) | (c1<<gshift) | (c2<<bshift);
+    int y = y0 + s->y;
+    if (y < 0 || y >= h)
+        return 0;
+    int x1 = x0 + s->x, x2 = x1 + s->len;
+    *skip = 0;
+    if (x1 < 0)
+    {
+        *skip = -x1;
+        x1 = 0;
+    }
+    clamp_max(x2, w);
+    return x2 - x1;
 }
 
-Uint32 ShadeBitColor(Uint32 col, float k)
-{
-    k = 1-k;
-    uint8_t c0, c1, c2;
-    c2 = (uint8_t)(extract_b(col) * k);
-    c1 = (uint8_t)(extract_g(col) * k);
-    c0 = (uint8_t)(extract_r(col) * k);
-    return ColorToBit(c0, c1, c2);
-}
+//------------------------------------------------------------------------------
 
-Uint32 MixBitColor(Uint32 col, SDL_Color mix, float k)
+// channel layout of the display surface, set in InitRender
+static SpanFormat disp_fmt;
+
+void *PixelPtr(SDL_Surface *surf, int adr)
 {
-    uint8_t fc0, fc1, fc2;
-    fc2 = extract_b(col)*(1-k) + mix.b*k;
-    fc1 = extract_g(col)*(1-k) + mix.g*k;
-    fc0 = extract_r(col)*(1-k) + mix.r*k;
-    clamp_max(fc2, max_b);
-    clamp_max(fc1, max_g);
-    clamp_max(fc0, max_r);
-
-    uint8_t c0, c1, c2;
-    c2 = (uint8_t)fc2;
-    c1 = (uint8_t)fc1;
-    c0 = (uint8_t)fc0;
-    return ColorToBit(c0, c1, c2);
+    return (uint8_t*)surf->pixels + adr*(disp_bpp/8);
 }
 
 //------------------------------------------------------------------------------
@@ -166,106 +213,83 @@ SDL_Surface *CreateSurface(Uint32 flags, int width, int height, const SDL_Surfac
 
 void DrawBlended(SDL_Surface *from, SDL_Surface *to, float k)
 {
-    for (int i=0; i<from->w*from->h; i++)
-    {
-        Uint32 c = ((Uint32*)from->pixels)[i];
-        uint8_t a = ((c & from->format->Amask) >> from->format->Ashift) * k;
-        c &= ~from->format->Amask;
-        c |= a << from->format->Ashift;
-        ((Uint32*)to->pixels)[i] = c;
-    }
+    SpanFormat fmt;
+    InitSpanFormat(&fmt, from->format);
+    ScaleAlphaSpan(&fmt, (Uint32*)from->pixels, (Uint32*)to->pixels, from->w*from->h, k);
 }
 
 //------------------------------------------------------------------------------
 
-static float **hole_zeds = NULL;
-static uint8_t **hole_aa = NULL;
-static uint8_t **key_aa = NULL;
-
-void DrawHole(int x0, int y0, int r, float grayk, float shiftk)
+static CircleMask hole_mask;
+static CircleMask key_mask;
+
+// Images of the holes for the (grayk, shiftk) pairs used by the level
+// renderer: colours of the fully covered pixels of hole_mask in the display
+// format. The edges only darken the background, they are drawn from the mask
+// coverage.
+typedef struct {
+    float grayk, shiftk;
+    void *pixels;
+} HoleSprite;
+
+enum { HOLE_SPRITE_PLAIN, HOLE_SPRITE_FINAL, HOLE_SPRITES_COUNT };
+static HoleSprite hole_sprites[HOLE_SPRITES_COUNT] = {
+    { 0.18, 1,    NULL },
+    { 0.85, 0.50, NULL }
+};
+
+static void BuildHoleSprite(HoleSprite *hs)
 {
-    for (int y=-r; y<=r; y++)
+    const SpanFormat f = disp_fmt;
+    const float gray_r = (f.rmask >> f.rshift)*hs->grayk;
+    const float gray_g = (f.gmask >> f.gshift)*hs->grayk;
+    const float gray_b = (f.bmask >> f.bshift)*hs->grayk;
+
+    hs->pixels = malloc((hole_mask.full_count + 1) * (f.bpp/8));
+    for (int i=0; i<hole_mask.full_count; i++)
     {
-        int adr = game_config.wnd_w*(y0+y) + (x0-r);
-        for (int x=-r; x<=r; x++)
-        {
-            if ((y0+y>=0)&&(y0+y<render_pic->h)&&
-                (x0+x>=0)&&(x0+x<render_pic->w))
-            {
-                float k = hole_zeds[x+r][y+r];
-                if (k>=0)
-                {
-                    uint8_t c0,c1,c2;
-                    float kk = k*shiftk;
-                    clamp_max(kk, 1);
-                    c0=(uint8_t)((max_r*grayk)*kk);
-                    c1=(uint8_t)((max_g*grayk)*kk);
-                    c2=(uint8_t)((max_b*grayk)*kk);
-                    Uint32 col = ColorToBit(c0,c1,c2);
-                    PutPixel(render_pic, adr, col);
-                }
-                else
-                {
-                    uint8_t aa_k = hole_aa[x+r][y+r];
-                    if (aa_k>0)
-                    {
-                        Uint32 col = GetPixel(render_pic, adr);
-                        col = ShadeBitColor(col, (float)aa_k/AA_SAMPLES_COUNT);
-                        PutPixel(render_pic, adr, col);
-                    }
-                }
-            }
-            adr++;
-        }
+        float kk = hole_mask.z[i]*hs->shiftk;
+        clamp_max(kk, 1);
+        uint8_t c0 = (uint8_t)(gray_r*kk);
+        uint8_t c1 = (uint8_t)(gray_g*kk);
+        uint8_t c2 = (uint8_t)(gray_b*kk);
+        Uint32 col = (c0<<f.rshift) | (c1<<f.gshift) | (c2<<f.bshift);
+        if (f.bpp == 32)
+            ((Uint32*)hs->pixels)[i] = col;
+        else
+            ((Uint16*)hs->pixels)[i] = col;
     }
 }
 
-void DrawKey(int x0, int y0, int r, float anim)
-{
+// Colours of a key for a quantised animation progress. The key_mask edges mix
+// the colour into the background by their coverage, the rest is filled.
+#define KEY_SPRITE_STEPS 64
+typedef struct {
     SDL_Color mix;
-    mix.unused = 0;
-    mix.r = (uint8_t)( 6.0/31*max_r*(1.0-anim) + 28.0/31*max_r*anim);
-    mix.g = (uint8_t)(24.0/65*max_g*(1.0-anim) + 28.0/65*max_g*anim);
-    mix.b = (uint8_t)(18.0/31*max_b*(1.0-anim) +  0.0/31*max_b*anim);
+    Uint32 color;
+} KeySprite;
 
-    Uint32 def_color = ColorToBit(mix.r, mix.g, mix.b);
-    for (int y=-r; y<=r; y++)
-    {
-        int adr = game_config.wnd_w*(y0+y) + (x0-r);
-        for (int x=-r; x<=r; x++)
-        {
-            if ((y0+y>=0)&&(y0+y<screen->h)&&
-                (x0+x>=0)&&(x0+x<screen->w))
-            {
-                uint8_t aa_k = key_aa[x+r][y+r];
-                if (aa_k>0)
-                {
-                    Uint32 col;
-                    if (aa_k==AA_SAMPLES_COUNT)
-                    {
-                        col = def_color;
-                    }
-                    else
-                    {
-                        col = GetPixel(screen, adr);
-                        col = MixBitColor(col, mix, (float)aa_k/AA_SAMPLES_COUNT);
-                    }
-                    PutPixel(screen, adr, col);
-                }
-            }
-            adr++;
-        }
-    }
+static KeySprite key_sprites[KEY_SPRITE_STEPS + 1];
+
+static void BuildKeySprite(KeySprite *ks, float anim)
+{
+    const SpanFormat f = disp_fmt;
+    const Uint32 max_r = f.rmask >> f.rshift;
+    const Uint32 max_g = f.gmask >> f.gshift;
+    const Uint32 max_b = f.bmask >> f.bshift;
+
+    ks->mix.unused = 0;
+    ks->mix.r = (uint8_t)( 6.0/31*max_r*(1.0-anim) + 28.0/31*max_r*anim);
+    ks->mix.g = (uint8_t)(24.0/65*max_g*(1.0-anim) + 28.0/65*max_g*anim);
+    ks->mix.b = (uint8_t)(18.0/31*max_b*(1.0-anim) +  0.0/31*max_b*anim);
+    ks->color = (ks->mix.r<<f.rshift) | (ks->mix.g<<f.gshift) | (ks->mix.b<<f.bshift);
 }
 
-void TryToShadow(int x, int y, float k)
+static const KeySprite *GetKeySprite(float anim)
 {
-    if ( x<0 || x>=render_pic->w || y<0 || y>=render_pic->h )
-        return;
-    int adr = y*render_pic->w + x;
-    Uint32 col = GetPixel(render_pic, adr);
-    col = ShadeBitColor(col, k);
-    PutPixel(render_pic, adr, col);
+    int i = (int)(anim*KEY_SPRITE_STEPS + 0.5);
+    clamp(i, 0, KEY_SPRITE_STEPS);
+    return &key_sprites[i];
 }
 
 float GetShadowKoef(float r)
@@ -276,82 +300,114 @@ float GetShadowKoef(float r)
     return k;
 }
 
-void RenderLevel()
+// Shadows of the walls. Every pixel closer than game_config.shadow to a wall
+// is darkened once by GetShadowKoef of its distance, measured from the one
+// pixel wide border around the boxes, so the boxes of a level merge into one
+// shadow. The distances come from a transform of the whole surface: the
+// horizontal distance to the nearest border pixel of every row, then the
+// nearest of those within the shadow radius in every column.
+static void RenderShadows(SDL_Surface *to, const Level *lvl)
 {
-//-- Prepare background --------------------------------------------------------
-    SDL_BlitSurface(desk_pic, &desk_rect, render_pic, &desk_rect);
+    const int s = game_config.shadow;
+    if (s <= 0)
+        return;
 
-//-- Generate shadows-----------------------------------------------------------
-    int b_co = game_levels[cur_level].boxes_count;
-    Box *bxs = game_levels[cur_level].boxes;
+    const int w = to->w, h = to->h;
+    //the map has a margin, so the walls outside of the surface cast shadows
+    const int mw = w + 2*s, mh = h + 2*s;
+    const int far = s + 1;
+    uint16_t *hd = (uint16_t*)malloc(mw*mh * sizeof(uint16_t));
+    for (int i=0; i<mw*mh; i++)
+        hd[i] = far;
+
+    //the boxes with their borders
+    int b_co = lvl->boxes_count;
+    Box *bxs = lvl->boxes;
     for (int i=0; i<b_co; i++)
     {
-        Box *b = &bxs[i];
+        int x1 = bxs[i].x1-1+s, x2 = bxs[i].x2+s;
+        int y1 = bxs[i].y1-1+s, y2 = bxs[i].y2+s;
+        clamp_min(x1, 0); clamp_max(x2, mw-1);
+        clamp_min(y1, 0); clamp_max(y2, mh-1);
+        for (int y=y1; y<=y2; y++)
+            for (int x=x1; x<=x2; x++)
+                hd[y*mw + x] = 0;
+    }
 
-        for (int i=0; i<game_config.shadow; i++)
+    //horizontal distances, capped at far
+    for (int y=0; y<mh; y++)
+    {
+        uint16_t *row = hd + y*mw;
+        int d = far;
+        for (int x=0; x<mw; x++)
         {
-            float k = GetShadowKoef(i);
-            for (int y=b->y1; y<b->y2; y++)
-            {
-                TryToShadow(b->x1-1-i, y, k);
-                TryToShadow(b->x2+i, y, k);
-            }
-            for (int x=b->x1; x<b->x2; x++)
+            if (row[x] == 0)
+                d = 0;
+            else
             {
-                TryToShadow(x, b->y1-1-i, k);
-                TryToShadow(x, b->y2+i, k);
+                if (d < far) d++;
+                row[x] = d;
             }
         }
-
-        for (int x=0; x<game_config.shadow; x++)
-            for (int y=0; y<game_config.shadow; y++)
+        d = far;
+        for (int x=mw-1; x>=0; x--)
+        {
+            if (row[x] == 0)
+                d = 0;
+            else
             {
-                float r = calclen(x,y,0);
-                if (r < game_config.shadow-0.5)
-                {
-                    float k = GetShadowKoef(r);
-                    TryToShadow(b->x1-1-x, b->y1-1-y, k);
-                    TryToShadow(b->x2+x, b->y2+y, k);
-                    TryToShadow(b->x1-1-x, b->y2+y, k);
-                    TryToShadow(b->x2+x, b->y1-1-y, k);
-                }
+                if (d < far) d++;
+                clamp_max(row[x], d);
             }
+        }
     }
 
-//-- Draw the walls ------------------------------------------------------------
-    for (int i=0; i<b_co; i++)
+    //shadow factor by squared distance
+    int d2_max = 2*s*s;
+    float *klut = (float*)malloc((d2_max + 1) * sizeof(float));
+    for (int d2=0; d2<=d2_max; d2++)
     {
-        SDL_Rect wall_rect;
-        wall_rect.x = bxs[i].x1; wall_rect.y = bxs[i].y1;
-        wall_rect.w = bxs[i].x2 - bxs[i].x1;
-        wall_rect.h = bxs[i].y2 - bxs[i].y1;
-        SDL_BlitSurface(wall_pic, &wall_rect, render_pic, &wall_rect);
+        float r = sqrt(d2);
+        klut[d2] = (r < s-0.5 ? GetShadowKoef(r) : 0);
+        clamp_min(klut[d2], 0); //small shadows, r past shadow-1
     }
 
-//-- Draw holes ----------------------------------------------------------------
-    for (int i=0; i<game_levels[cur_level].holes_count; i++)
+    //apply row by row, in runs of shaded pixels
+    float *krow = (float*)malloc(w * sizeof(float));
+    for (int y=0; y<h; y++)
     {
-        DrawHole( game_levels[cur_level].holes[i].x,
-                  game_levels[cur_level].holes[i].y,
-                  game_config.hole_r,
-                  0.18, 1 );
-    }
-
-    //final hole
-    DrawHole(game_levels[cur_level].fins[0].x,
-             game_levels[cur_level].fins[0].y,
-             game_config.hole_r,
-             0.85, 0.50);
+        for (int x=0; x<w; x++)
+        {
+            const uint16_t *col = hd + y*mw + x+s;
+            int best = d2_max + 1;
+            for (int dy=0; dy<=2*s; dy++)
+            {
+                int v = col[dy*mw];
+                if (v < far)
+                    clamp_max(best, v*v + (dy-s)*(dy-s));
+            }
+            krow[x] = (best <= d2_max ? klut[best] : 0);
+        }
 
-    if (game_levels[cur_level].keys_count == 0)
-    {
-        SDL_Rect om_rect;
-        int om_x0 = game_levels[cur_level].fins[0].x - fin_pic->w/2;
-        int om_y0 = game_levels[cur_level].fins[0].y - fin_pic->h/2;
-        om_rect.x = om_x0; om_rect.y = om_y0;
-        om_rect.w = fin_pic->w; om_rect.h = fin_pic->h;
-        SDL_BlitSurface(fin_pic, NULL, render_pic, &om_rect);
+        Uint8 *line = (Uint8*)PixelPtr(to, y*w);
+        int x = 0;
+        while (x < w)
+        {
+            if (krow[x] <= 0)
+            {
+                x++;
+                continue;
+            }
+            int x1 = x;
+            while (x < w && krow[x] > 0)
+                x++;
+            ShadeSpanK(&disp_fmt, line + x1*(disp_fmt.bpp/8), krow + x1, x - x1);
+        }
     }
+
+    free(krow);
+    free(klut);
+    free(hd);
 }
 
 void RedrawDesk()
@@ -364,24 +420,74 @@ void RedrawDesk()
 //------------------------------------------------------------------------------
 static float matrix[16];
 static float **a = NULL, **a_1 = NULL;
-static float **zeds = NULL;
-static uint8_t **ball_aa = NULL;
 static int rad = 0;
 
-void texSmooth(uint8_t *c0, uint8_t *c1, uint8_t *c2, SDL_Color secc, float fixx)
+// The ball surface precomputed for its radius: the normals (x, y, z) of the
+// fully covered pixels of the ball mask as contiguous arrays, in the order of
+// its runs. Only the rotation and the texture lookup are done per frame, the
+// stages are kept separate so the loops over the arrays can be vectorised.
+typedef struct {
+    CircleMask mask;
+    int count;
+    float *x, *y, *z;
+    float *x0, *y0, *z0; // rotated normals of the current frame
+    float *ksi, *fi, *fip;
+} BallLut;
+
+static BallLut ball_lut;
+
+static void BuildBallLut(BallLut *lut, int r)
+{
+    BuildCircleMask(&lut->mask, 0, r, false, true);
+    int n = lut->mask.full_count;
+
+    lut->count = n;
+    lut->z = lut->mask.z;
+    float **farrs[] = { &lut->x, &lut->y, &lut->x0, &lut->y0, &lut->z0,
+                        &lut->ksi, &lut->fi, &lut->fip };
+    for (int i = 0; i < (int)(sizeof(farrs)/sizeof(farrs[0])); i++)
+        *farrs[i] = (float*)malloc((n + 1) * sizeof(float));
+
+    for (int k = 0; k < lut->mask.spans_count; k++)
+    {
+        const CircleSpan *s = &lut->mask.spans[k];
+        if (!s->full)
+            continue;
+        for (int j = 0; j < s->len; j++)
+        {
+            lut->x[s->data + j] = s->x + j;
+            lut->y[s->data + j] = s->y;
+        }
+    }
+}
+
+static void FreeBallLut(BallLut *lut)
+{
+    float **farrs[] = { &lut->x, &lut->y, &lut->x0, &lut->y0, &lut->z0,
+                        &lut->ksi, &lut->fi, &lut->fip };
+    for (int i = 0; i < (int)(sizeof(farrs)/sizeof(farrs[0])); i++)
+        free(*farrs[i]);
+    //z is the one of the mask
+    FreeCircleMask(&lut->mask);
+    memset(lut, 0, sizeof(BallLut));
+}
+
+void texSmooth(uint8_t *c0, uint8_t *c1, uint8_t *c2, SDL_Color secc, float fixx, SDL_Color max)
 {
     *c0 = (*c0)*(0.5+fixx) + secc.r*(0.5-fixx);
     *c1 = (*c1)*(0.5+fixx) + secc.g*(0.5-fixx);
     *c2 = (*c2)*(0.5+fixx) + secc.b*(0.5-fixx);
-    clamp_max(*c0, max_r);
-    clamp_max(*c1, max_g);
-    clamp_max(*c2, max_b);
+    clamp_max(*c0, max.r);
+    clamp_max(*c1, max.g);
+    clamp_max(*c2, max.b);
 }
 
 #define COS_PI_4   0.7071
 #define COS_PI_2   0
 #define COS_3PI_4 -COS_PI_4
-void DrawBall(int tk_px, int tk_py, float poss_z, const dReal *R, SDL_Color bcolor)
+// rotation of the ball surface and its texture coordinates, the same for
+// every pixel format
+static void PrepareBall(const dReal *R)
 {
     //prepare to draw the ball
     matrix[0] = R[0];
@@ -413,140 +519,85 @@ void DrawBall(int tk_px, int tk_py, float poss_z, const dReal *R, SDL_Color bcol
 
     MatrixInversion(a, 3, a_1);
 
-    //redraw the ball at new location
-    if (SDL_MUSTLOCK(screen))
-        if (SDL_LockSurface(screen) < 0)
-            return;
-
-    Uint32 bcolor_r = bcolor.r/255.0*max_r;
-    Uint32 bcolor_g = bcolor.g/255.0*max_g;
-    Uint32 bcolor_b = bcolor.b/255.0*max_b;
-    clamp_max(bcolor_r, max_r);
-    clamp_max(bcolor_g, max_g);
-    clamp_max(bcolor_b, max_b);
-    bcolor.r = bcolor_r;
-    bcolor.g = bcolor_g;
-    bcolor.b = bcolor_b;
-
-    uint8_t c0, c1, c2;
-    for (int x = -rad; x <= rad; x++)
+    BallLut *lut = &ball_lut;
+    int n = lut->count;
+
+    //rotate the normals
+    const float m00 = a_1[0][0], m10 = a_1[1][0], m20 = a_1[2][0];
+    const float m01 = a_1[0][1], m11 = a_1[1][1], m21 = a_1[2][1];
+    const float m02 = a_1[0][2], m12 = a_1[1][2], m22 = a_1[2][2];
+    const float *lx = lut->x, *ly = lut->y, *lz = lut->z;
+    float *x0 = lut->x0, *y0 = lut->y0, *z0 = lut->z0;
+    for (int i = 0; i < n; i++)
     {
-        for (int y = -rad; y <= rad; y++)
-        {
-            float z;
+        x0[i] = m00 * lx[i] + m10 * ly[i] + m20 * lz[i];
+        y0[i] = m01 * lx[i] + m11 * ly[i] + m21 * lz[i];
+        z0[i] = m02 * lx[i] + m12 * ly[i] + m22 * lz[i];
+    }
 
-            if ((tk_py + y >= 0) && (tk_py + y < screen->h) &&
-                (tk_px + x >= 0) && (tk_px + x < screen->w))
-            {
-                if ((z = zeds[x + rad][y + rad]) >= 0)
-                {
-                    float x0, y0, z0;
-                    x0 = a_1[0][0] * x + a_1[1][0] * y + a_1[2][0] * z;
-                    y0 = a_1[0][1] * x + a_1[1][1] * y + a_1[2][1] * z;
-                    z0 = a_1[0][2] * x + a_1[1][2] * y + a_1[2][2] * z;
-
-                    float ksi = (float) z0 / rad;
-                    float fi = (x0 != 0 ? (float) y0 / x0 : 0);
-
-                    float fip = (y0 != 0 ? (float) x0 / y0 : 0);
-                    float ksim = ksi - COS_PI_2;
-                    SDL_Color secc;
-
-                    if (ksi >= COS_PI_2)
-                    {
-                        if (fi <= 0)
-                        {
-                            c0 = bcolor.r;
-                            c1 = bcolor.g;
-                            c2 = bcolor.b;
-                            secc.r = max_r * 1;
-                            secc.g = max_g * 1;
-                            secc.b = max_b * 1;
-                        }
-                        else
-                        {
-                            c0 = max_r * 1;
-                            c1 = max_g * 1;
-                            c2 = max_b * 1;
-                            secc.r = bcolor.r;
-                            secc.g = bcolor.g;
-                            secc.b = bcolor.b;
-                        }
-                    }
-                    else
-                    {
-                        if (fi <= 0)
-                        {
-                            c0 = max_r * 1;
-                            c1 = max_g * 1;
-                            c2 = max_b * 1;
-                            secc.r = bcolor.r;
-                            secc.g = bcolor.g;
-                            secc.b = bcolor.b;
-                        }
-                        else
-                        {
-                            c0 = bcolor.r;
-                            c1 = bcolor.g;
-                            c2 = bcolor.b;
-                            secc.r = max_r * 1;
-                            secc.g = max_g * 1;
-                            secc.b = max_b * 1;
-                        }
-                    }
-
-                    if ((fi < 0.04) && (fi >= 0.0))
-                        texSmooth(&c0, &c1, &c2, secc, fi / 0.08);
-                    else
-                    if ((fi>-0.04) && (fi < 0.0))
-                        texSmooth(&c0, &c1, &c2, secc, -fi / 0.08);
-                    else
-
-                    if ((ksim < 0.02) && (ksim >= 0.0))
-                        texSmooth(&c0, &c1, &c2, secc, ksim / 0.04);
-                    else
-                    if ((ksim>-0.02) && (ksim < 0.0))
-                        texSmooth(&c0, &c1, &c2, secc, -ksim / 0.04);
-                    else
-
-                    if ((fip < 0.04) && (fip >= 0.0))
-                        texSmooth(&c0, &c1, &c2, secc, fip / 0.08);
-                    else
-                    if ((fip>-0.04) && (fip < 0.0))
-                        texSmooth(&c0, &c1, &c2, secc, -fip / 0.08);
-
-                    //shader
-                    float mz = (rad - poss_z);
-                    clamp_max(mz, 0.6 * rad);
-                    clamp_min(mz, 0);
-                    float cosa = (z - mz) / rad;
-                    clamp_min(cosa, 0);
-
-                    c0 = (uint8_t) ((float) c0 * cosa);
-                    c1 = (uint8_t) ((float) c1 * cosa);
-                    c2 = (uint8_t) ((float) c2 * cosa);
-
-                    int adr = ((tk_py + y) * screen->w + (tk_px + x));
-                    Uint32 col = ColorToBit(c0,c1,c2);
-                    PutPixel(screen, adr, col);
-                }
-                else
-                {
-                    uint8_t aa_k = ball_aa[x + rad][y + rad];
-                    if (aa_k > 0)
-                    {
-                        int adr = ((tk_py + y) * screen->w + (tk_px + x));
-                        Uint32 col = GetPixel(screen, adr);
-                        col = ShadeBitColor(col, (float)aa_k/AA_SAMPLES_COUNT);
-                        PutPixel(screen, adr, col);
-                    }
-                }
-            }
-        } //for y
-    } //for x
+    //texture coordinates
+    float *ksi = lut->ksi, *fi = lut->fi, *fip = lut->fip;
+    for (int i = 0; i < n; i++)
+    {
+        ksi[i] = z0[i] / rad;
+        fi[i] = (x0[i] != 0 ? y0[i] / x0[i] : 0);
+        fip[i] = (y0[i] != 0 ? x0[i] / y0[i] : 0);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// Level images can be rendered on the prerender thread. SDL keeps the blit
+// mapping in the source surface, so level rendering is serialized by
+// render_lock and takes the final image from a copy nobody else blits.
+static SDL_mutex *render_lock = NULL;
+static SDL_Surface *fin_pic_level = NULL;
+
+#define BPP 16
+#include "render_bpp.h"
+#undef BPP
+
+#define BPP 32
+#include "render_bpp.h"
+#undef BPP
+
+typedef struct {
+    void (*render_level)(SDL_Surface *to, const Level *lvl);
+    void (*draw_ball)(int tk_px, int tk_py, float poss_z, const dReal *R, SDL_Color bcolor);
+    void (*draw_key)(int x0, int y0, float anim);
+} RenderOps;
+
+static const RenderOps render_ops_16 = { RenderLevel16, DrawBall16, DrawKey16 };
+static const RenderOps render_ops_32 = { RenderLevel32, DrawBall32, DrawKey32 };
+static const RenderOps *render_ops = &render_ops_16;
+
+// the cached images are found by the level content, so the level is decoded
+// even when its image is cached
+bool RenderLevelTo(SDL_Surface *to, int level)
+{
+    Level *lvl = level_store_get(level);
+    if (!lvl)
+        return false;
+
+    SDL_LockMutex(render_lock);
+    if (!level_cache_load(level, lvl, to))
+    {
+        render_ops->render_level(to, lvl);
+        level_cache_store(level, lvl, to);
+    }
+    SDL_UnlockMutex(render_lock);
+    level_store_put(lvl);
+    return true;
+}
 
-    if (SDL_MUSTLOCK(screen))
-        SDL_UnlockSurface(screen);
+bool RenderLevel()
+{
+    return RenderLevelTo(render_pic, cur_level);
+}
+
+void DrawBall(int tk_px, int tk_py, float poss_z, const dReal *R, SDL_Color bcolor)
+{
+    render_ops->draw_ball(tk_px, tk_py, poss_z, R, bcolor);
 }
 
 //------------------------------------------------------------------------------
@@ -558,8 +609,11 @@ void UpdateBufAnimation()
     int hx, hy, hr;
     SDL_Rect fin_rect, key_rect;
 
-    hx = game_levels[cur_level].fins[0].x;
-    hy = game_levels[cur_level].fins[0].y;
+    if (!game_level)
+        return;
+
+    hx = game_level->fins[0].x;
+    hy = game_level->fins[0].y;
     hr = game_config.hole_r;
 
     fin_rect.x = hx-hr; fin_rect.y = hy-hr;
@@ -570,10 +624,10 @@ void UpdateBufAnimation()
         SDL_BlitSurface(render_pic, &fin_rect, screen, &fin_rect);
 
     //restore background around keys
-    for (int i=0; i<game_levels[cur_level].keys_count; i++)
+    for (int i=0; i<game_level->keys_count; i++)
     {
-        kx = game_levels[cur_level].keys[i].x;
-        ky = game_levels[cur_level].keys[i].y;
+        kx = game_level->keys[i].x;
+        ky = game_level->keys[i].y;
         kr = game_config.key_r;
 
         key_rect.x = kx-kr; key_rect.y = ky-kr;
@@ -583,17 +637,17 @@ void UpdateBufAnimation()
     }
 
     //draw keys with actual animation stages
-    for (int i=0; i<game_levels[cur_level].keys_count; i++)
+    for (int i=0; i<game_level->keys_count; i++)
     {
-        kx = game_levels[cur_level].keys[i].x;
-        ky = game_levels[cur_level].keys[i].y;
+        kx = game_level->keys[i].x;
+        ky = game_level->keys[i].y;
         kr = game_config.key_r;
 
         key_rect.x = kx-kr; key_rect.y = ky-kr;
         key_rect.w = kr*2+1; key_rect.h = kr*2+1;
 
         float kk = keys_anim[i].progress;
-        DrawKey( kx, ky, kr, kk );
+        render_ops->draw_key( kx, ky, kk );
     }
 
     //draw final hole with actual animation stage
@@ -602,8 +656,8 @@ void UpdateBufAnimation()
         float kk = final_anim.progress;
 
         SDL_Rect om_rect;
-        om_rect.x = game_levels[cur_level].fins[0].x - fin_pic->w/2;
-        om_rect.y = game_levels[cur_level].fins[0].y - fin_pic->h/2;
+        om_rect.x = game_level->fins[0].x - fin_pic->w/2;
+        om_rect.y = game_level->fins[0].y - fin_pic->h/2;
         om_rect.w = fin_pic->w; om_rect.h = fin_pic->h;
 
         if (kk<1)
@@ -621,30 +675,30 @@ void UpdateBufAnimation()
 void UpdateScreenAnimation()
 {
     //updating animation on the screen
-    for (int i=0; i<game_levels[cur_level].keys_count; i++)
+    for (int i=0; i<game_level->keys_count; i++)
     {
         if (keys_anim[i].stage == ANIMATION_PLAYING)
         {
             int kx,ky,kr;
-            kx = game_levels[cur_level].keys[i].x;
-            ky = game_levels[cur_level].keys[i].y;
+            kx = game_level->keys[i].x;
+            ky = game_level->keys[i].y;
             kr = game_config.key_r;
 
             SDL_Rect key_rect;
             key_rect.x=kx-kr; key_rect.y=ky-kr;
             key_rect.w=kr*2+1; key_rect.h=kr*2+1;
 
-            SDL_UpdateRect(screen, key_rect.x, key_rect.y, key_rect.w, key_rect.h);
+            dirty_add_rect(&key_rect);
         }
     }
 
     if (final_anim.stage == ANIMATION_PLAYING)
     {
         SDL_Rect om_rect;
-        om_rect.x = game_levels[cur_level].fins[0].x - fin_pic->w/2;
-        om_rect.y = game_levels[cur_level].fins[0].y - fin_pic->h/2;
+        om_rect.x = game_level->fins[0].x - fin_pic->w/2;
+        om_rect.y = game_level->fins[0].y - fin_pic->h/2;
         om_rect.w = fin_pic->w; om_rect.h = fin_pic->h;
-        SDL_UpdateRect(screen, om_rect.x, om_rect.y, om_rect.w, om_rect.h);
+        dirty_add_rect(&om_rect);
     }
 }
 
@@ -652,30 +706,56 @@ void UpdateScreenAnimation()
 
 void InitRender()
 {
+    InitSpanFormat(&disp_fmt, screen->format);
+    render_ops = (disp_bpp == 32 ? &render_ops_32 : &render_ops_16);
+
     fin_pic_blended = CreateSurface(SDL_SWSURFACE, fin_pic->w, fin_pic->h, fin_pic); // blended final image
+    fin_pic_level = SDL_ConvertSurface(fin_pic, fin_pic->format, fin_pic->flags);
+    render_lock = SDL_CreateMutex();
 
     //init matrices for drawing the ball
     a = ALLOC2D_DIAM(float, 3);
     a_1 = ALLOC2D_DIAM(float, 3);
 
-    //alloc ball z-values array
+    //ball surface
     rad = game_config.ball_r - 1; //
-    int diam = rad * 2 + 1;
-    zeds = ALLOC2D_DIAM(float, diam);
-    ball_aa = ALLOC2D_DIAM(uint8_t, diam);
-    calc_circle(zeds, ball_aa, 0, rad, false);
-
-    //alloc hole z-values array
-    int h_rad = game_config.hole_r;
-    int h_diam = h_rad * 2 + 1;
-    hole_zeds = ALLOC2D_DIAM(float, h_diam);
-    hole_aa = ALLOC2D_DIAM(uint8_t, h_diam);
-    calc_circle(hole_zeds, hole_aa, 0, h_rad, true);
-
-    //alloc array for image of key
+    BuildBallLut(&ball_lut, rad);
+
+    //hole with its relative depth
+    BuildCircleMask(&hole_mask, 0, game_config.hole_r, true, true);
+
+    //image of key
     int k_rad = game_config.key_r;
     int k_rad_v = k_rad * 75 / 100;
-    int k_diam = k_rad * 2 + 1;
-    key_aa = ALLOC2D_DIAM(uint8_t, k_diam);
-    calc_circle(NULL, key_aa, k_rad_v, k_rad, false);
+    BuildCircleMask(&key_mask, k_rad_v, k_rad, false, false);
+
+    //sprites
+    for (int i=0; i<HOLE_SPRITES_COUNT; i++)
+        BuildHoleSprite(&hole_sprites[i]);
+    for (int i=0; i<=KEY_SPRITE_STEPS; i++)
+        BuildKeySprite(&key_sprites[i], (float)i/KEY_SPRITE_STEPS);
+}
+
+// everything InitRender() allocates, so it can be called again
+void FreeRender()
+{
+    SDL_FreeSurface(fin_pic_blended);
+    SDL_FreeSurface(fin_pic_level);
+    fin_pic_blended = fin_pic_level = NULL;
+    if (render_lock)
+        SDL_DestroyMutex(render_lock);
+    render_lock = NULL;
+
+    free2d((void**)a, 3);
+    free2d((void**)a_1, 3);
+    a = a_1 = NULL;
+
+    FreeBallLut(&ball_lut);
+    FreeCircleMask(&hole_mask);
+    FreeCircleMask(&key_mask);
+    for (int i=0; i<HOLE_SPRITES_COUNT; i++)
+    {
+        free(hole_sprites[i].pixels);
+        hole_sprites[i].pixels = NULL;
+    }
 }
@@ -27,11 +27,13 @@
 #include "mazecore/mazecore.h"
 
 SDL_Surface *CreateSurface(Uint32 flags, int width, int height, const SDL_Surface *display);
-void RenderLevel();
+bool RenderLevelTo(SDL_Surface *to, int level);
+bool RenderLevel();
 void RedrawDesk();
 void DrawBall(int tk_px, int tk_py, float poss_z, const dReal *R, SDL_Color bcolor);
 void UpdateBufAnimation();
 void UpdateScreenAnimation();
 void InitRender();
+void FreeRender();
 
 #endif //RENDER_H
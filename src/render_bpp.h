@@ -0,0 +1,238 @@
+/*  render_bpp.h
+ *
+ *  Pixel format specific parts of the graphics engine.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+// This file is included by render.c once for every supported pixel format,
+// with BPP defined to 16 or 32. The functions get the bit depth appended to
+// their names (RenderLevel16, RenderLevel32, ...) and access the surfaces
+// through the matching pixel type, the channel layout is read into locals
+// once per call.
+
+#if BPP == 32
+#define PIXEL_T Uint32
+#elif BPP == 16
+#define PIXEL_T Uint16
+#else
+#error "unsupported pixel format"
+#endif
+
+#define BPP_NAME(name) BPP_NAME_(name, BPP)
+#define BPP_NAME_(name, bpp) BPP_NAME__(name, bpp)
+#define BPP_NAME__(name, bpp) name##bpp
+
+#define TO_BIT(f, c0, c1, c2) ((PIXEL_T)(((c0)<<(f).rshift) | ((c1)<<(f).gshift) | ((c2)<<(f).bshift)))
+
+//------------------------------------------------------------------------------
+
+static void BPP_NAME(DrawHole)(SDL_Surface *to, int x0, int y0, const HoleSprite *hs)
+{
+    const CircleMask *m = &hole_mask;
+    const PIXEL_T *img = (const PIXEL_T*)hs->pixels;
+    for (int i=0; i<m->spans_count; i++)
+    {
+        const CircleSpan *s = &m->spans[i];
+        int skip, len = ClipSpan(s, x0, y0, to->w, to->h, &skip);
+        if (len <= 0)
+            continue;
+
+        PIXEL_T *p = (PIXEL_T*)to->pixels + game_config.wnd_w*(y0+s->y) + x0+s->x+skip;
+        if (s->full)
+            memcpy(p, img + s->data + skip, len * sizeof(PIXEL_T));
+        else
+            ShadeSpanAA(&disp_fmt, p, m->aa + s->data + skip, len);
+    }
+}
+
+static void BPP_NAME(DrawKey)(int x0, int y0, float anim)
+{
+    const KeySprite *ks = GetKeySprite(anim);
+    const PIXEL_T color = ks->color;
+
+    const CircleMask *m = &key_mask;
+    for (int i=0; i<m->spans_count; i++)
+    {
+        const CircleSpan *s = &m->spans[i];
+        int skip, len = ClipSpan(s, x0, y0, screen->w, screen->h, &skip);
+        if (len <= 0)
+            continue;
+
+        PIXEL_T *p = (PIXEL_T*)screen->pixels + game_config.wnd_w*(y0+s->y) + x0+s->x+skip;
+        if (s->full)
+        {
+            for (int j=0; j<len; j++)
+                p[j] = color;
+        }
+        else
+            MixSpanAA(&disp_fmt, p, m->aa + s->data + skip, len, ks->mix);
+    }
+}
+
+static void BPP_NAME(RenderLevel)(SDL_Surface *to, const Level *lvl)
+{
+//-- Prepare background --------------------------------------------------------
+    SDL_BlitSurface(desk_pic, &desk_rect, to, &desk_rect);
+
+//-- Generate shadows-----------------------------------------------------------
+    RenderShadows(to, lvl);
+
+//-- Draw the walls ------------------------------------------------------------
+    int b_co = lvl->boxes_count;
+    Box *bxs = lvl->boxes;
+    for (int i=0; i<b_co; i++)
+    {
+        SDL_Rect wall_rect;
+        wall_rect.x = bxs[i].x1; wall_rect.y = bxs[i].y1;
+        wall_rect.w = bxs[i].x2 - bxs[i].x1;
+        wall_rect.h = bxs[i].y2 - bxs[i].y1;
+        SDL_BlitSurface(wall_pic, &wall_rect, to, &wall_rect);
+    }
+
+//-- Draw holes ----------------------------------------------------------------
+    for (int i=0; i<lvl->holes_count; i++)
+    {
+        BPP_NAME(DrawHole)( to, lvl->holes[i].x,
+                            lvl->holes[i].y,
+                            &hole_sprites[HOLE_SPRITE_PLAIN] );
+    }
+
+    //final hole
+    BPP_NAME(DrawHole)(to, lvl->fins[0].x,
+                       lvl->fins[0].y,
+                       &hole_sprites[HOLE_SPRITE_FINAL]);
+
+    if (lvl->keys_count == 0)
+    {
+        SDL_Rect om_rect;
+        int om_x0 = lvl->fins[0].x - fin_pic_level->w/2;
+        int om_y0 = lvl->fins[0].y - fin_pic_level->h/2;
+        om_rect.x = om_x0; om_rect.y = om_y0;
+        om_rect.w = fin_pic_level->w; om_rect.h = fin_pic_level->h;
+        SDL_BlitSurface(fin_pic_level, NULL, to, &om_rect);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static void BPP_NAME(DrawBall)(int tk_px, int tk_py, float poss_z, const dReal *R, SDL_Color bcolor)
+{
+    PrepareBall(R);
+
+    //redraw the ball at new location
+    if (SDL_MUSTLOCK(screen))
+        if (SDL_LockSurface(screen) < 0)
+            return;
+
+    const SpanFormat f = disp_fmt;
+    SDL_Color white;
+    white.r = (f.rmask >> f.rshift);
+    white.g = (f.gmask >> f.gshift);
+    white.b = (f.bmask >> f.bshift);
+    white.unused = 0;
+
+    Uint32 bcolor_r = bcolor.r/255.0*(f.rmask >> f.rshift);
+    Uint32 bcolor_g = bcolor.g/255.0*(f.gmask >> f.gshift);
+    Uint32 bcolor_b = bcolor.b/255.0*(f.bmask >> f.bshift);
+    clamp_max(bcolor_r, white.r);
+    clamp_max(bcolor_g, white.g);
+    clamp_max(bcolor_b, white.b);
+    bcolor.r = bcolor_r;
+    bcolor.g = bcolor_g;
+    bcolor.b = bcolor_b;
+
+    const BallLut *lut = &ball_lut;
+    const float *lz = lut->z;
+    const float *ksi = lut->ksi, *fi = lut->fi, *fip = lut->fip;
+    PIXEL_T *pixels = (PIXEL_T*)screen->pixels;
+    const int sw = screen->w, sh = screen->h;
+
+    //shader
+    float mz = (rad - poss_z);
+    clamp_max(mz, 0.6 * rad);
+    clamp_min(mz, 0);
+
+    const CircleMask *m = &lut->mask;
+    for (int k = 0; k < m->spans_count; k++)
+    {
+        const CircleSpan *s = &m->spans[k];
+        int skip, len = ClipSpan(s, tk_px, tk_py, sw, sh, &skip);
+        if (len <= 0)
+            continue;
+
+        PIXEL_T *p = pixels + (tk_py + s->y) * sw + tk_px + s->x + skip;
+        if (!s->full)
+        {
+            //antialiased edge
+            ShadeSpanAA(&f, p, m->aa + s->data + skip, len);
+            continue;
+        }
+
+        for (int j = 0; j < len; j++)
+        {
+            int i = s->data + skip + j;
+            float ksim = ksi[i] - COS_PI_2;
+            // white where the sign of ksi matches the one of fi
+            bool light = ((ksi[i] >= COS_PI_2) == (fi[i] > 0));
+            SDL_Color prim = (light ? white : bcolor);
+            SDL_Color secc = (light ? bcolor : white);
+            uint8_t c0 = prim.r, c1 = prim.g, c2 = prim.b;
+
+            float fv = fi[i], fp = fip[i];
+            if ((fv < 0.04) && (fv >= 0.0))
+                texSmooth(&c0, &c1, &c2, secc, fv / 0.08, white);
+            else
+            if ((fv>-0.04) && (fv < 0.0))
+                texSmooth(&c0, &c1, &c2, secc, -fv / 0.08, white);
+            else
+
+            if ((ksim < 0.02) && (ksim >= 0.0))
+                texSmooth(&c0, &c1, &c2, secc, ksim / 0.04, white);
+            else
+            if ((ksim>-0.02) && (ksim < 0.0))
+                texSmooth(&c0, &c1, &c2, secc, -ksim / 0.04, white);
+            else
+
+            if ((fp < 0.04) && (fp >= 0.0))
+                texSmooth(&c0, &c1, &c2, secc, fp / 0.08, white);
+            else
+            if ((fp>-0.04) && (fp < 0.0))
+                texSmooth(&c0, &c1, &c2, secc, -fp / 0.08, white);
+
+            float cosa = (lz[i] - mz) / rad;
+            clamp_min(cosa, 0);
+
+            c0 = (uint8_t) ((float) c0 * cosa);
+            c1 = (uint8_t) ((float) c1 * cosa);
+            c2 = (uint8_t) ((float) c2 * cosa);
+
+            p[j] = TO_BIT(f, c0, c1, c2);
+        }
+    }
+
+    if (SDL_MUSTLOCK(screen))
+        SDL_UnlockSurface(screen);
+}
+
+#undef TO_BIT
+#undef BPP_NAME__
+#undef BPP_NAME_
+#undef BPP_NAME
+#undef PIXEL_T
@@ -0,0 +1,384 @@
+/*  render_span.c
+ *
+ *  Pixel span kernels for the graphics engine.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+#include "render_span.h"
+#include "mazecore/mazehelpers.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SPAN_SSE2
+#endif
+
+//------------------------------------------------------------------------------
+
+void InitSpanFormat(SpanFormat *fmt, const SDL_PixelFormat *pf)
+{
+    fmt->bpp = pf->BitsPerPixel;
+    fmt->rmask = pf->Rmask; fmt->rshift = pf->Rshift;
+    fmt->gmask = pf->Gmask; fmt->gshift = pf->Gshift;
+    fmt->bmask = pf->Bmask; fmt->bshift = pf->Bshift;
+    fmt->amask = pf->Amask; fmt->ashift = pf->Ashift;
+}
+
+static inline Uint32 GetSpanPixel(const SpanFormat *fmt, const void *pixels, int i)
+{
+    if (fmt->bpp == 32)
+        return ((const Uint32*)pixels)[i];
+    else
+        return ((const Uint16*)pixels)[i];
+}
+
+static inline void PutSpanPixel(const SpanFormat *fmt, void *pixels, int i, Uint32 col)
+{
+    if (fmt->bpp == 32)
+        ((Uint32*)pixels)[i] = col;
+    else
+        ((Uint16*)pixels)[i] = col;
+}
+
+#define CHANNEL(fmt, col, ch) (((col) & (fmt)->ch##mask) >> (fmt)->ch##shift)
+#define CHANNEL_MAX(fmt, ch) ((fmt)->ch##mask >> (fmt)->ch##shift)
+
+//------------------------------------------------------------------------------
+//-- Scalar kernels ------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+// channels are scaled in float and truncated to 8 bits
+static void ShadeSpanKScalar(const SpanFormat *fmt, void *pixels, const float *k, int count)
+{
+    for (int i=0; i<count; i++)
+    {
+        float kk = 1-k[i];
+        Uint32 col = GetSpanPixel(fmt, pixels, i);
+        uint8_t c0 = (uint8_t)(CHANNEL(fmt, col, r) * kk);
+        uint8_t c1 = (uint8_t)(CHANNEL(fmt, col, g) * kk);
+        uint8_t c2 = (uint8_t)(CHANNEL(fmt, col, b) * kk);
+        PutSpanPixel(fmt, pixels, i, (c0<<fmt->rshift) | (c1<<fmt->gshift) | (c2<<fmt->bshift));
+    }
+}
+
+// With k = aa/SPAN_AA_MAX every product of the float code is exact, so
+// shading and mixing reduce to integer math with a truncating division.
+static void ShadeSpanAAScalar(const SpanFormat *fmt, void *pixels, const uint8_t *aa, int count)
+{
+    for (int i=0; i<count; i++)
+    {
+        if (aa[i] == 0)
+            continue;
+        Uint32 col = GetSpanPixel(fmt, pixels, i);
+        unsigned int inv = SPAN_AA_MAX - aa[i];
+        Uint32 c0 = CHANNEL(fmt, col, r) * inv / SPAN_AA_MAX;
+        Uint32 c1 = CHANNEL(fmt, col, g) * inv / SPAN_AA_MAX;
+        Uint32 c2 = CHANNEL(fmt, col, b) * inv / SPAN_AA_MAX;
+        PutSpanPixel(fmt, pixels, i, (c0<<fmt->rshift) | (c1<<fmt->gshift) | (c2<<fmt->bshift));
+    }
+}
+
+static void MixSpanAAScalar(const SpanFormat *fmt, void *pixels, const uint8_t *aa, int count, SDL_Color mix)
+{
+    for (int i=0; i<count; i++)
+    {
+        if (aa[i] == 0)
+            continue;
+        Uint32 col = GetSpanPixel(fmt, pixels, i);
+        unsigned int k = aa[i], inv = SPAN_AA_MAX - k;
+        Uint32 c0 = (CHANNEL(fmt, col, r) * inv + mix.r * k) / SPAN_AA_MAX;
+        Uint32 c1 = (CHANNEL(fmt, col, g) * inv + mix.g * k) / SPAN_AA_MAX;
+        Uint32 c2 = (CHANNEL(fmt, col, b) * inv + mix.b * k) / SPAN_AA_MAX;
+        clamp_max(c0, CHANNEL_MAX(fmt, r));
+        clamp_max(c1, CHANNEL_MAX(fmt, g));
+        clamp_max(c2, CHANNEL_MAX(fmt, b));
+        PutSpanPixel(fmt, pixels, i, (c0<<fmt->rshift) | (c1<<fmt->gshift) | (c2<<fmt->bshift));
+    }
+}
+
+static void ScaleAlphaSpanScalar(const SpanFormat *fmt, const Uint32 *from, Uint32 *to, int count, float k)
+{
+    for (int i=0; i<count; i++)
+    {
+        Uint32 c = from[i];
+        uint8_t a = CHANNEL(fmt, c, a) * k;
+        c &= ~fmt->amask;
+        c |= a << fmt->ashift;
+        to[i] = c;
+    }
+}
+
+//------------------------------------------------------------------------------
+//-- SSE2 kernels --------------------------------------------------------------
+//------------------------------------------------------------------------------
+#ifdef SPAN_SSE2
+
+// The vector code works on 4 pixels in 32-bit lanes; 16bpp spans are widened
+// to two such vectors and narrowed back. Channel values stay below 2^8 and
+// their products with coverage below 2^16, so the 16-bit multiply is enough.
+typedef struct {
+    __m128i mask[3];
+    __m128i shift[3];
+    __m128i amask, ashift;
+} SseFormat;
+
+static void InitSseFormat(SseFormat *s, const SpanFormat *fmt)
+{
+    s->mask[0] = _mm_set1_epi32(fmt->rmask); s->shift[0] = _mm_cvtsi32_si128(fmt->rshift);
+    s->mask[1] = _mm_set1_epi32(fmt->gmask); s->shift[1] = _mm_cvtsi32_si128(fmt->gshift);
+    s->mask[2] = _mm_set1_epi32(fmt->bmask); s->shift[2] = _mm_cvtsi32_si128(fmt->bshift);
+    s->amask = _mm_set1_epi32(fmt->amask); s->ashift = _mm_cvtsi32_si128(fmt->ashift);
+}
+
+static inline __m128i GetChannel4(__m128i p, __m128i mask, __m128i shift)
+{
+    return _mm_srl_epi32(_mm_and_si128(p, mask), shift);
+}
+
+static inline __m128i Shade4(const SseFormat *s, __m128i p, __m128 k)
+{
+    __m128i res = _mm_setzero_si128();
+    for (int ch=0; ch<3; ch++)
+    {
+        __m128 c = _mm_cvtepi32_ps(GetChannel4(p, s->mask[ch], s->shift[ch]));
+        __m128i v = _mm_cvttps_epi32(_mm_mul_ps(c, k));
+        res = _mm_or_si128(res, _mm_sll_epi32(v, s->shift[ch]));
+    }
+    return res;
+}
+
+static inline __m128i ShadeAA4(const SseFormat *s, __m128i p, __m128i aa)
+{
+    __m128i inv = _mm_sub_epi32(_mm_set1_epi32(SPAN_AA_MAX), aa);
+    __m128i res = _mm_setzero_si128();
+    for (int ch=0; ch<3; ch++)
+    {
+        __m128i c = GetChannel4(p, s->mask[ch], s->shift[ch]);
+        c = _mm_srli_epi32(_mm_mullo_epi16(c, inv), 4);
+        res = _mm_or_si128(res, _mm_sll_epi32(c, s->shift[ch]));
+    }
+    __m128i keep = _mm_cmpeq_epi32(aa, _mm_setzero_si128());
+    return _mm_or_si128(_mm_and_si128(keep, p), _mm_andnot_si128(keep, res));
+}
+
+static inline __m128i MixAA4(const SseFormat *s, __m128i p, __m128i aa, const __m128i *mix, const __m128i *max)
+{
+    __m128i inv = _mm_sub_epi32(_mm_set1_epi32(SPAN_AA_MAX), aa);
+    __m128i res = _mm_setzero_si128();
+    for (int ch=0; ch<3; ch++)
+    {
+        __m128i c = GetChannel4(p, s->mask[ch], s->shift[ch]);
+        c = _mm_add_epi32(_mm_mullo_epi16(c, inv), _mm_mullo_epi16(mix[ch], aa));
+        c = _mm_min_epi16(_mm_srli_epi32(c, 4), max[ch]);
+        res = _mm_or_si128(res, _mm_sll_epi32(c, s->shift[ch]));
+    }
+    __m128i keep = _mm_cmpeq_epi32(aa, _mm_setzero_si128());
+    return _mm_or_si128(_mm_and_si128(keep, p), _mm_andnot_si128(keep, res));
+}
+
+// 4 coverage bytes widened to 32-bit lanes
+static inline __m128i LoadAA4(const uint8_t *aa)
+{
+    int32_t v;
+    memcpy(&v, aa, sizeof(v));
+    __m128i zero = _mm_setzero_si128();
+    __m128i x = _mm_unpacklo_epi8(_mm_cvtsi32_si128(v), zero);
+    return _mm_unpacklo_epi16(x, zero);
+}
+
+// 8 coverage bytes widened to two vectors of 32-bit lanes
+static inline void LoadAA8(const uint8_t *aa, __m128i *lo, __m128i *hi)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i x = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)aa), zero);
+    *lo = _mm_unpacklo_epi16(x, zero);
+    *hi = _mm_unpackhi_epi16(x, zero);
+}
+
+// narrow two vectors of 32-bit lanes holding 16-bit values
+static inline __m128i Pack16(__m128i lo, __m128i hi)
+{
+    lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+    hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+    return _mm_packs_epi32(lo, hi);
+}
+
+static int ShadeSpanKSse2(const SpanFormat *fmt, void *pixels, const float *k, int count)
+{
+    SseFormat s;
+    InitSseFormat(&s, fmt);
+    __m128 one = _mm_set1_ps(1);
+    __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    if (fmt->bpp == 32)
+    {
+        for (; i+4 <= count; i+=4)
+        {
+            __m128i *p = (__m128i*)((Uint32*)pixels + i);
+            __m128 kk = _mm_sub_ps(one, _mm_loadu_ps(k + i));
+            _mm_storeu_si128(p, Shade4(&s, _mm_loadu_si128(p), kk));
+        }
+    }
+    else
+    {
+        for (; i+8 <= count; i+=8)
+        {
+            __m128i *p = (__m128i*)((Uint16*)pixels + i);
+            __m128i v = _mm_loadu_si128(p);
+            __m128 k_lo = _mm_sub_ps(one, _mm_loadu_ps(k + i));
+            __m128 k_hi = _mm_sub_ps(one, _mm_loadu_ps(k + i + 4));
+            __m128i lo = Shade4(&s, _mm_unpacklo_epi16(v, zero), k_lo);
+            __m128i hi = Shade4(&s, _mm_unpackhi_epi16(v, zero), k_hi);
+            _mm_storeu_si128(p, Pack16(lo, hi));
+        }
+    }
+    return i;
+}
+
+static int ShadeSpanAASse2(const SpanFormat *fmt, void *pixels, const uint8_t *aa, int count)
+{
+    SseFormat s;
+    InitSseFormat(&s, fmt);
+    __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    if (fmt->bpp == 32)
+    {
+        for (; i+4 <= count; i+=4)
+        {
+            __m128i *p = (__m128i*)((Uint32*)pixels + i);
+            _mm_storeu_si128(p, ShadeAA4(&s, _mm_loadu_si128(p), LoadAA4(aa + i)));
+        }
+    }
+    else
+    {
+        for (; i+8 <= count; i+=8)
+        {
+            __m128i *p = (__m128i*)((Uint16*)pixels + i);
+            __m128i v = _mm_loadu_si128(p);
+            __m128i aa_lo, aa_hi;
+            LoadAA8(aa + i, &aa_lo, &aa_hi);
+            __m128i lo = ShadeAA4(&s, _mm_unpacklo_epi16(v, zero), aa_lo);
+            __m128i hi = ShadeAA4(&s, _mm_unpackhi_epi16(v, zero), aa_hi);
+            _mm_storeu_si128(p, Pack16(lo, hi));
+        }
+    }
+    return i;
+}
+
+static int MixSpanAASse2(const SpanFormat *fmt, void *pixels, const uint8_t *aa, int count, SDL_Color mix)
+{
+    SseFormat s;
+    InitSseFormat(&s, fmt);
+    __m128i m[3], max[3];
+    m[0] = _mm_set1_epi32(mix.r); max[0] = _mm_set1_epi32(CHANNEL_MAX(fmt, r));
+    m[1] = _mm_set1_epi32(mix.g); max[1] = _mm_set1_epi32(CHANNEL_MAX(fmt, g));
+    m[2] = _mm_set1_epi32(mix.b); max[2] = _mm_set1_epi32(CHANNEL_MAX(fmt, b));
+    __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    if (fmt->bpp == 32)
+    {
+        for (; i+4 <= count; i+=4)
+        {
+            __m128i *p = (__m128i*)((Uint32*)pixels + i);
+            _mm_storeu_si128(p, MixAA4(&s, _mm_loadu_si128(p), LoadAA4(aa + i), m, max));
+        }
+    }
+    else
+    {
+        for (; i+8 <= count; i+=8)
+        {
+            __m128i *p = (__m128i*)((Uint16*)pixels + i);
+            __m128i v = _mm_loadu_si128(p);
+            __m128i aa_lo, aa_hi;
+            LoadAA8(aa + i, &aa_lo, &aa_hi);
+            __m128i lo = MixAA4(&s, _mm_unpacklo_epi16(v, zero), aa_lo, m, max);
+            __m128i hi = MixAA4(&s, _mm_unpackhi_epi16(v, zero), aa_hi, m, max);
+            _mm_storeu_si128(p, Pack16(lo, hi));
+        }
+    }
+    return i;
+}
+
+static int ScaleAlphaSpanSse2(const SpanFormat *fmt, const Uint32 *from, Uint32 *to, int count, float k)
+{
+    SseFormat s;
+    InitSseFormat(&s, fmt);
+    __m128 kk = _mm_set1_ps(k);
+    int i = 0;
+    for (; i+4 <= count; i+=4)
+    {
+        __m128i c = _mm_loadu_si128((const __m128i*)(from + i));
+        __m128 a = _mm_cvtepi32_ps(GetChannel4(c, s.amask, s.ashift));
+        __m128i av = _mm_cvttps_epi32(_mm_mul_ps(a, kk));
+        av = _mm_and_si128(av, _mm_set1_epi32(0xff)); // as the uint8_t cast
+        c = _mm_andnot_si128(s.amask, c);
+        c = _mm_or_si128(c, _mm_sll_epi32(av, s.ashift));
+        _mm_storeu_si128((__m128i*)(to + i), c);
+    }
+    return i;
+}
+
+#endif //SPAN_SSE2
+
+//------------------------------------------------------------------------------
+//-- Dispatch ------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+// the vector code handles the bulk of a span, the scalar one its tail
+
+void ShadeSpanK(const SpanFormat *fmt, void *pixels, const float *k, int count)
+{
+    int done = 0;
+#ifdef SPAN_SSE2
+    done = ShadeSpanKSse2(fmt, pixels, k, count);
+#endif
+    if (done < count)
+        ShadeSpanKScalar(fmt, (uint8_t*)pixels + done*(fmt->bpp/8), k + done, count - done);
+}
+
+void ShadeSpanAA(const SpanFormat *fmt, void *pixels, const uint8_t *aa, int count)
+{
+    int done = 0;
+#ifdef SPAN_SSE2
+    done = ShadeSpanAASse2(fmt, pixels, aa, count);
+#endif
+    if (done < count)
+        ShadeSpanAAScalar(fmt, (uint8_t*)pixels + done*(fmt->bpp/8), aa + done, count - done);
+}
+
+void MixSpanAA(const SpanFormat *fmt, void *pixels, const uint8_t *aa, int count, SDL_Color mix)
+{
+    int done = 0;
+#ifdef SPAN_SSE2
+    done = MixSpanAASse2(fmt, pixels, aa, count, mix);
+#endif
+    if (done < count)
+        MixSpanAAScalar(fmt, (uint8_t*)pixels + done*(fmt->bpp/8), aa + done, count - done, mix);
+}
+
+void ScaleAlphaSpan(const SpanFormat *fmt, const Uint32 *from, Uint32 *to, int count, float k)
+{
+    int done = 0;
+#ifdef SPAN_SSE2
+    done = ScaleAlphaSpanSse2(fmt, from, to, count, k);
+#endif
+    if (done < count)
+        ScaleAlphaSpanScalar(fmt, from + done, to + done, count - done, k);
+}
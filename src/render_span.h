@@ -0,0 +1,61 @@
+/*  render_span.h
+ *
+ *  Pixel span kernels for the graphics engine.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RENDER_SPAN_H
+#define RENDER_SPAN_H
+
+#include <stdint.h>
+#include <SDL/SDL.h>
+
+// Coverage arrays hold the number of hit samples of a pixel, 0..SPAN_AA_MAX.
+#define SPAN_AA_MAX 16
+
+// Channel layout of a surface, copied out of SDL_PixelFormat once so the
+// kernels don't dereference the surface format for every pixel.
+typedef struct {
+    int bpp; // 16 or 32
+    Uint32 rmask, gmask, bmask, amask;
+    uint8_t rshift, gshift, bshift, ashift;
+} SpanFormat;
+
+void InitSpanFormat(SpanFormat *fmt, const SDL_PixelFormat *pf);
+
+// All the kernels give exactly the results of the plain per-pixel float
+// code. The SSE2 versions are used when the compiler targets SSE2, the
+// portable scalar code otherwise.
+
+// darken pixels by individual factors k[i] (0 - unchanged, 1 - black)
+void ShadeSpanK(const SpanFormat *fmt, void *pixels, const float *k, int count);
+
+// darken pixels by their coverage, aa[i]/SPAN_AA_MAX; zero coverage leaves
+// the pixel untouched
+void ShadeSpanAA(const SpanFormat *fmt, void *pixels, const uint8_t *aa, int count);
+
+// mix pixels with a colour by their coverage; full coverage gives the colour
+// itself, zero coverage leaves the pixel untouched
+void MixSpanAA(const SpanFormat *fmt, void *pixels, const uint8_t *aa, int count, SDL_Color mix);
+
+// copy 32bpp pixels with the alpha channel scaled by k
+void ScaleAlphaSpan(const SpanFormat *fmt, const Uint32 *from, Uint32 *to, int count, float k);
+
+#endif //RENDER_SPAN_H
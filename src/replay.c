@@ -0,0 +1,267 @@
+/*  replay.c
+ *
+ *  Recording and reading of game sessions.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "replay.h"
+
+#define LOG_MODULE "Replay"
+#include "logging.h"
+
+#define REPLAY_MAGIC "MKRP"
+#define REPLAY_VERSION 1
+
+struct Replay {
+    FILE *f;
+};
+
+static FILE *rec_file = NULL;
+static float rec_speed = -1;
+
+//------------------------------------------------------------------------------
+
+static void write_u8(FILE *f, uint8_t v)
+{
+    fwrite(&v, sizeof(v), 1, f);
+}
+
+static void write_u16(FILE *f, uint16_t v)
+{
+    fwrite(&v, sizeof(v), 1, f);
+}
+
+static void write_i32(FILE *f, int32_t v)
+{
+    fwrite(&v, sizeof(v), 1, f);
+}
+
+static void write_float(FILE *f, float v)
+{
+    fwrite(&v, sizeof(v), 1, f);
+}
+
+static bool read_u8(FILE *f, uint8_t *v)
+{
+    return (fread(v, sizeof(*v), 1, f) == 1);
+}
+
+static bool read_u16(FILE *f, uint16_t *v)
+{
+    return (fread(v, sizeof(*v), 1, f) == 1);
+}
+
+static bool read_i32(FILE *f, int *v)
+{
+    int32_t t;
+    if (fread(&t, sizeof(t), 1, f) != 1)
+        return false;
+    *v = t;
+    return true;
+}
+
+static bool read_float(FILE *f, float *v)
+{
+    return (fread(v, sizeof(*v), 1, f) == 1);
+}
+
+//------------------------------------------------------------------------------
+
+bool replay_record_start(const char *fname, const ReplayHeader *hdr)
+{
+    replay_record_stop();
+
+    rec_file = fopen(fname, "wb");
+    if (!rec_file)
+    {
+        log_error("can't create replay file `%s'", fname);
+        return false;
+    }
+
+    fwrite(REPLAY_MAGIC, 1, 4, rec_file);
+    write_u16(rec_file, REPLAY_VERSION);
+
+    const MazeConfig *cfg = &hdr->config;
+    write_i32(rec_file, cfg->wnd_w);
+    write_i32(rec_file, cfg->wnd_h);
+    write_i32(rec_file, cfg->ball_r);
+    write_i32(rec_file, cfg->hole_r);
+    write_i32(rec_file, cfg->key_r);
+    write_i32(rec_file, cfg->shadow);
+
+    write_float(rec_file, hdr->scale);
+    write_u8(rec_file, hdr->rot);
+    write_i32(rec_file, hdr->scaled_width);
+    write_u8(rec_file, hdr->fixed_step);
+
+    uint16_t len = strlen(hdr->levelpack);
+    write_u16(rec_file, len);
+    fwrite(hdr->levelpack, 1, len, rec_file);
+
+    rec_speed = -1;
+    log_info("recording the game to `%s'", fname);
+    return true;
+}
+
+void replay_record_stop()
+{
+    if (!rec_file)
+        return;
+    fclose(rec_file);
+    rec_file = NULL;
+}
+
+void replay_record_frame(int delta_ticks, float tilt_x, float tilt_y)
+{
+    if (!rec_file)
+        return;
+    // the game loop clamps the ticks, longer frames are split just in case
+    while (delta_ticks > UINT16_MAX)
+    {
+        write_u8(rec_file, REPLAY_FRAME);
+        write_u16(rec_file, UINT16_MAX);
+        write_float(rec_file, tilt_x);
+        write_float(rec_file, tilt_y);
+        delta_ticks -= UINT16_MAX;
+    }
+    write_u8(rec_file, REPLAY_FRAME);
+    write_u16(rec_file, delta_ticks);
+    write_float(rec_file, tilt_x);
+    write_float(rec_file, tilt_y);
+}
+
+void replay_record_level(int level)
+{
+    if (!rec_file)
+        return;
+    write_u8(rec_file, REPLAY_LEVEL);
+    write_i32(rec_file, level);
+}
+
+void replay_record_restart()
+{
+    if (!rec_file)
+        return;
+    write_u8(rec_file, REPLAY_RESTART);
+}
+
+void replay_record_reload()
+{
+    if (!rec_file)
+        return;
+    write_u8(rec_file, REPLAY_RELOAD);
+}
+
+// written only when it changes, the game sets it every frame
+void replay_record_speed(float speed)
+{
+    if (!rec_file || speed == rec_speed)
+        return;
+    write_u8(rec_file, REPLAY_SPEED);
+    write_float(rec_file, speed);
+    rec_speed = speed;
+}
+
+//------------------------------------------------------------------------------
+
+Replay *replay_open(const char *fname, ReplayHeader *hdr)
+{
+    FILE *f = fopen(fname, "rb");
+    if (!f)
+    {
+        log_error("can't open replay file `%s'", fname);
+        return NULL;
+    }
+
+    char magic[4];
+    uint16_t version = 0;
+    if ( (fread(magic, 1, 4, f) != 4) || memcmp(magic, REPLAY_MAGIC, 4) ||
+         !read_u16(f, &version) || (version != REPLAY_VERSION) )
+    {
+        log_error("`%s' is not a replay file of version %d", fname, REPLAY_VERSION);
+        fclose(f);
+        return NULL;
+    }
+
+    memset(hdr, 0, sizeof(ReplayHeader));
+    MazeConfig *cfg = &hdr->config;
+    uint8_t rot = 0, fixed_step = 0;
+    uint16_t len = 0;
+    bool ok = ( read_i32(f, &cfg->wnd_w) && read_i32(f, &cfg->wnd_h) &&
+                read_i32(f, &cfg->ball_r) && read_i32(f, &cfg->hole_r) &&
+                read_i32(f, &cfg->key_r) && read_i32(f, &cfg->shadow) &&
+                read_float(f, &hdr->scale) && read_u8(f, &rot) &&
+                read_i32(f, &hdr->scaled_width) && read_u8(f, &fixed_step) &&
+                read_u16(f, &len) && (len < REPLAY_MAX_PATH) &&
+                (fread(hdr->levelpack, 1, len, f) == len) );
+    if (!ok)
+    {
+        log_error("replay file `%s' is truncated", fname);
+        fclose(f);
+        return NULL;
+    }
+    hdr->rot = rot;
+    hdr->fixed_step = fixed_step;
+
+    Replay *r = (Replay*)malloc(sizeof(Replay));
+    r->f = f;
+    return r;
+}
+
+bool replay_read(Replay *r, ReplayEvent *ev)
+{
+    uint8_t type;
+    if (!read_u8(r->f, &type))
+        return false;
+
+    memset(ev, 0, sizeof(ReplayEvent));
+    ev->type = type;
+    switch (type)
+    {
+    case REPLAY_FRAME:
+    {
+        uint16_t ticks;
+        if (!read_u16(r->f, &ticks) || !read_float(r->f, &ev->tilt_x) || !read_float(r->f, &ev->tilt_y))
+            return false;
+        ev->delta_ticks = ticks;
+        return true;
+    }
+    case REPLAY_LEVEL:
+        return read_i32(r->f, &ev->level);
+    case REPLAY_RESTART:
+    case REPLAY_RELOAD:
+        return true;
+    case REPLAY_SPEED:
+        return read_float(r->f, &ev->speed);
+    default:
+        log_error("unknown replay event %d", type);
+        return false;
+    }
+}
+
+void replay_close(Replay *r)
+{
+    if (!r)
+        return;
+    fclose(r->f);
+    free(r);
+}
@@ -0,0 +1,78 @@
+/*  replay.h
+ *
+ *  Recording and reading of game sessions.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "mazecore/mazetypes.h"
+
+// A replay file is a header followed by a stream of tagged events, all of
+// them in host byte order. Frames carry the elapsed ticks and the tilt after
+// calibration, so stepping a world with them gives back the same game.
+
+#define REPLAY_MAX_PATH 1024
+
+typedef struct {
+    MazeConfig config;    // as passed to mazecore, after the transformation
+    float scale;          // transformation of the levelpack coordinates
+    bool rot;
+    int scaled_width;
+    bool fixed_step;
+    char levelpack[REPLAY_MAX_PATH];
+} ReplayHeader;
+
+typedef enum {
+    REPLAY_FRAME,
+    REPLAY_LEVEL,
+    REPLAY_RESTART,
+    REPLAY_RELOAD,
+    REPLAY_SPEED
+} ReplayEventType;
+
+typedef struct {
+    ReplayEventType type;
+    int delta_ticks;
+    float tilt_x;
+    float tilt_y;
+    int level;
+    float speed;
+} ReplayEvent;
+
+typedef struct Replay Replay;
+
+// recording; the calls do nothing while no recording is started
+bool replay_record_start(const char *fname, const ReplayHeader *hdr);
+void replay_record_stop();
+void replay_record_frame(int delta_ticks, float tilt_x, float tilt_y);
+void replay_record_level(int level);
+void replay_record_restart();
+void replay_record_reload();
+void replay_record_speed(float speed);
+
+// reading
+Replay *replay_open(const char *fname, ReplayHeader *hdr);
+bool replay_read(Replay *r, ReplayEvent *ev);
+void replay_close(Replay *r);
+
+#endif /* REPLAY_H */
@@ -0,0 +1,113 @@
+/*  ballbench.c
+ *
+ *  Microbenchmark of the ball rendering.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Times DrawBall() at the ball radii of a small screen, of the default pack
+ * and of a large screen, on 16 and 32bpp surfaces, with the ball rolling in
+ * place so every frame rotates the texture.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include "../render.h"
+#include "../types.h"
+
+// the globals the renderer shares with the main window
+Level *game_level = NULL;
+MazeConfig game_config = {0};
+int cur_level = 0;
+int prev_px = 0, prev_py = 0;
+int disp_bpp = 0;
+Animation final_anim;
+Animation *keys_anim = NULL;
+SDL_Surface *screen = NULL;
+SDL_Surface *fin_pic = NULL, *desk_pic = NULL, *wall_pic = NULL, *render_pic = NULL;
+SDL_Rect desk_rect;
+
+#define BENCH_W 480
+#define BENCH_H 640
+#define BENCH_FRAMES 2000
+
+static const int radii[] = { 12, 23, 64 };
+
+static double get_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// rotation about the x and y axes in the 3x4 layout of ODE
+static void RollMatrix(dReal *R, double angle)
+{
+    double ca = cos(angle), sa = sin(angle);
+    double cb = cos(angle * 0.7), sb = sin(angle * 0.7);
+    R[0] = cb;  R[1] = sa*sb; R[2] = ca*sb;  R[3] = 0;
+    R[4] = 0;   R[5] = ca;    R[6] = -sa;    R[7] = 0;
+    R[8] = -sb; R[9] = sa*cb; R[10] = ca*cb; R[11] = 0;
+}
+
+static double BenchBall(int bpp, int radius)
+{
+    Uint32 rmask = (bpp == 32 ? 0xff0000 : 0xf800);
+    Uint32 gmask = (bpp == 32 ? 0x00ff00 : 0x07e0);
+    Uint32 bmask = (bpp == 32 ? 0x0000ff : 0x001f);
+    disp_bpp = bpp;
+    screen = SDL_CreateRGBSurface(SDL_SWSURFACE, BENCH_W, BENCH_H, bpp, rmask, gmask, bmask, 0);
+    fin_pic = SDL_CreateRGBSurface(SDL_SWSURFACE, 40, 40, 32, 0xff0000, 0x00ff00, 0x0000ff, 0xff000000);
+
+    game_config.wnd_w = BENCH_W;
+    game_config.wnd_h = BENCH_H;
+    game_config.ball_r = radius;
+    game_config.hole_r = radius + 2;
+    game_config.key_r = radius * 3 / 4;
+    InitRender();
+
+    SDL_Color bcolor = { 200, 200, 200, 0 };
+    dReal R[12];
+    double start = get_time();
+    for (int i=0; i<BENCH_FRAMES; i++)
+    {
+        RollMatrix(R, i * 0.05);
+        DrawBall(BENCH_W/2, BENCH_H/2, 0, R, bcolor);
+    }
+    double res = (get_time() - start) / BENCH_FRAMES;
+
+    FreeRender();
+    SDL_FreeSurface(fin_pic);
+    SDL_FreeSurface(screen);
+    return res;
+}
+
+int main()
+{
+    printf("radius   16bpp us/ball   32bpp us/ball\n");
+    for (unsigned int i=0; i<sizeof(radii)/sizeof(radii[0]); i++)
+    {
+        double t16 = BenchBall(16, radii[i]);
+        double t32 = BenchBall(32, radii[i]);
+        printf("%6d %15.2f %15.2f\n", radii[i], t16 * 1e6, t32 * 1e6);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,341 @@
+/*  ballcheck.c
+ *
+ *  Check of the ball renderer against the per-pixel one.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Draws the ball at random rotations, heights and positions, many of them
+ * clipped by the screen edges, with DrawBall() and with the per-pixel
+ * renderer it replaced, on 16 and 32bpp screens over a random background,
+ * and requires byte-identical screens. Run by `make check'.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "../render.c"
+
+// the globals the renderer shares with the main window
+Level *game_level = NULL;
+MazeConfig game_config = {0};
+int cur_level = 0;
+int prev_px = 0, prev_py = 0;
+int disp_bpp = 0;
+Animation final_anim;
+Animation *keys_anim = NULL;
+SDL_Surface *screen = NULL;
+SDL_Surface *fin_pic = NULL, *desk_pic = NULL, *wall_pic = NULL, *render_pic = NULL;
+SDL_Rect desk_rect;
+
+#define CHECK_W 97
+#define CHECK_H 61
+#define POSES_COUNT 300
+
+static const int radii[] = { 4, 12, 23, 40 };
+
+typedef struct {
+    int bpp;
+    Uint32 r, g, b;
+} CheckFormat;
+
+static const CheckFormat formats[] = {
+    { 16, 0xf800, 0x07e0, 0x001f },
+    { 16, 0x7c00, 0x03e0, 0x001f },
+    { 32, 0xff0000, 0x00ff00, 0x0000ff },
+    { 32, 0x0000ff, 0x00ff00, 0xff0000 }
+};
+
+static int checks_count = 0;
+static int failures_count = 0;
+
+//------------------------------------------------------------------------------
+// The renderer before the ball lookup tables: the coverage and the height of
+// every pixel of the bounding square, and the texture computed per pixel.
+
+static float **ref_zeds = NULL;
+static uint8_t **ref_aa = NULL;
+static float **ref_a = NULL, **ref_a_1 = NULL;
+
+static void RefCalcCircle(int r)
+{
+    for (int x = -r; x <= r; x++)
+        for (int y = -r; y <= r; y++)
+        {
+            float xdist = x*x + y*y;
+            int sample_hit = 0;
+            if (xdist > sqr(r + 1))
+                sample_hit = 0;
+            else if (xdist < sqr(r - 1))
+                sample_hit = AA_SAMPLES_COUNT;
+            else
+            {
+                for (int ii = 0; ii < AA_SAMPLING_STEP; ii++)
+                    for (int jj = 0; jj < AA_SAMPLING_STEP; jj++)
+                    {
+                        float rast = sqr(x - 0.3 + 0.2 * ii) + sqr(y - 0.3 + 0.2 * jj);
+                        if (rast <= r * r)
+                            sample_hit++;
+                    }
+            }
+            ref_aa[x + r][y + r] = sample_hit;
+            ref_zeds[x + r][y + r] = (sample_hit == AA_SAMPLES_COUNT) ? sqrt(r * r - xdist) : -1;
+        }
+}
+
+static Uint32 RefGetPixel(int adr)
+{
+    if (disp_bpp == 32)
+        return ((Uint32*)screen->pixels)[adr];
+    return ((Uint16*)screen->pixels)[adr];
+}
+
+static void RefPutPixel(int adr, Uint32 col)
+{
+    if (disp_bpp == 32)
+        ((Uint32*)screen->pixels)[adr] = col;
+    else
+        ((Uint16*)screen->pixels)[adr] = col;
+}
+
+static Uint32 RefMax(Uint32 mask)
+{
+    while (mask && !(mask & 1))
+        mask >>= 1;
+    return mask;
+}
+
+static Uint32 RefColorToBit(uint8_t c0, uint8_t c1, uint8_t c2)
+{
+    const SDL_PixelFormat *f = screen->format;
+    return (c0<<f->Rshift) | (c1<<f->Gshift) | (c2<<f->Bshift);
+}
+
+static Uint32 RefShadeBitColor(Uint32 col, float k)
+{
+    const SDL_PixelFormat *f = screen->format;
+    k = 1-k;
+    uint8_t c2 = (uint8_t)(((col & f->Bmask) >> f->Bshift) * k);
+    uint8_t c1 = (uint8_t)(((col & f->Gmask) >> f->Gshift) * k);
+    uint8_t c0 = (uint8_t)(((col & f->Rmask) >> f->Rshift) * k);
+    return RefColorToBit(c0, c1, c2);
+}
+
+static void RefTexSmooth(uint8_t *c0, uint8_t *c1, uint8_t *c2, SDL_Color secc, float fixx, SDL_Color max)
+{
+    *c0 = (*c0)*(0.5+fixx) + secc.r*(0.5-fixx);
+    *c1 = (*c1)*(0.5+fixx) + secc.g*(0.5-fixx);
+    *c2 = (*c2)*(0.5+fixx) + secc.b*(0.5-fixx);
+    clamp_max(*c0, max.r);
+    clamp_max(*c1, max.g);
+    clamp_max(*c2, max.b);
+}
+
+static void RefDrawBall(int tk_px, int tk_py, float poss_z, const dReal *R, SDL_Color bcolor)
+{
+    ref_a[0][0] = R[0]; ref_a[0][1] = R[4]; ref_a[0][2] = R[8];
+    ref_a[1][0] = R[1]; ref_a[1][1] = R[5]; ref_a[1][2] = R[9];
+    ref_a[2][0] = R[2]; ref_a[2][1] = R[6]; ref_a[2][2] = R[10];
+    MatrixInversion(ref_a, 3, ref_a_1);
+
+    SDL_Color max;
+    max.r = RefMax(screen->format->Rmask);
+    max.g = RefMax(screen->format->Gmask);
+    max.b = RefMax(screen->format->Bmask);
+    max.unused = 0;
+
+    Uint32 bcolor_r = bcolor.r/255.0*max.r;
+    Uint32 bcolor_g = bcolor.g/255.0*max.g;
+    Uint32 bcolor_b = bcolor.b/255.0*max.b;
+    clamp_max(bcolor_r, max.r);
+    clamp_max(bcolor_g, max.g);
+    clamp_max(bcolor_b, max.b);
+    bcolor.r = bcolor_r;
+    bcolor.g = bcolor_g;
+    bcolor.b = bcolor_b;
+
+    for (int x = -rad; x <= rad; x++)
+        for (int y = -rad; y <= rad; y++)
+        {
+            if (tk_py + y < 0 || tk_py + y >= screen->h || tk_px + x < 0 || tk_px + x >= screen->w)
+                continue;
+
+            int adr = (tk_py + y) * screen->w + (tk_px + x);
+            float z = ref_zeds[x + rad][y + rad];
+            if (z < 0)
+            {
+                uint8_t aa_k = ref_aa[x + rad][y + rad];
+                if (aa_k > 0)
+                    RefPutPixel(adr, RefShadeBitColor(RefGetPixel(adr), (float)aa_k/AA_SAMPLES_COUNT));
+                continue;
+            }
+
+            float x0 = ref_a_1[0][0] * x + ref_a_1[1][0] * y + ref_a_1[2][0] * z;
+            float y0 = ref_a_1[0][1] * x + ref_a_1[1][1] * y + ref_a_1[2][1] * z;
+            float z0 = ref_a_1[0][2] * x + ref_a_1[1][2] * y + ref_a_1[2][2] * z;
+
+            float ksi = (float) z0 / rad;
+            float fi = (x0 != 0 ? (float) y0 / x0 : 0);
+            float fip = (y0 != 0 ? (float) x0 / y0 : 0);
+            float ksim = ksi - COS_PI_2;
+
+            SDL_Color prim, secc;
+            if ((ksi >= COS_PI_2) == (fi <= 0))
+            {
+                prim = bcolor;
+                secc = max;
+            }
+            else
+            {
+                prim = max;
+                secc = bcolor;
+            }
+            uint8_t c0 = prim.r, c1 = prim.g, c2 = prim.b;
+
+            if ((fi < 0.04) && (fi >= 0.0))
+                RefTexSmooth(&c0, &c1, &c2, secc, fi / 0.08, max);
+            else if ((fi > -0.04) && (fi < 0.0))
+                RefTexSmooth(&c0, &c1, &c2, secc, -fi / 0.08, max);
+            else if ((ksim < 0.02) && (ksim >= 0.0))
+                RefTexSmooth(&c0, &c1, &c2, secc, ksim / 0.04, max);
+            else if ((ksim > -0.02) && (ksim < 0.0))
+                RefTexSmooth(&c0, &c1, &c2, secc, -ksim / 0.04, max);
+            else if ((fip < 0.04) && (fip >= 0.0))
+                RefTexSmooth(&c0, &c1, &c2, secc, fip / 0.08, max);
+            else if ((fip > -0.04) && (fip < 0.0))
+                RefTexSmooth(&c0, &c1, &c2, secc, -fip / 0.08, max);
+
+            float mz = (rad - poss_z);
+            clamp_max(mz, 0.6 * rad);
+            clamp_min(mz, 0);
+            float cosa = (z - mz) / rad;
+            clamp_min(cosa, 0);
+
+            c0 = (uint8_t) ((float) c0 * cosa);
+            c1 = (uint8_t) ((float) c1 * cosa);
+            c2 = (uint8_t) ((float) c2 * cosa);
+            RefPutPixel(adr, RefColorToBit(c0, c1, c2));
+        }
+}
+
+//------------------------------------------------------------------------------
+
+static double RandomUnit()
+{
+    return (double)rand() / RAND_MAX;
+}
+
+// a random rotation from a random unit quaternion, in the 3x4 layout of ODE;
+// some are the identity, where the texture seams are on the pixel grid
+static void RandomRotation(dReal *R)
+{
+    double q0 = 1, q1 = 0, q2 = 0, q3 = 0;
+    if (rand() % 8)
+    {
+        q0 = RandomUnit() - 0.5; q1 = RandomUnit() - 0.5;
+        q2 = RandomUnit() - 0.5; q3 = RandomUnit() - 0.5;
+        double l = sqrt(q0*q0 + q1*q1 + q2*q2 + q3*q3);
+        q0 /= l; q1 /= l; q2 /= l; q3 /= l;
+    }
+    R[0] = 1 - 2*(q2*q2 + q3*q3); R[1] = 2*(q1*q2 - q0*q3);     R[2] = 2*(q1*q3 + q0*q2);     R[3] = 0;
+    R[4] = 2*(q1*q2 + q0*q3);     R[5] = 1 - 2*(q1*q1 + q3*q3); R[6] = 2*(q2*q3 - q0*q1);     R[7] = 0;
+    R[8] = 2*(q1*q3 - q0*q2);     R[9] = 2*(q2*q3 + q0*q1);     R[10] = 1 - 2*(q1*q1 + q2*q2); R[11] = 0;
+}
+
+// the centre anywhere the ball is at least partly on the screen
+static int RandomCentre(int size, int r)
+{
+    return rand() % (size + 2*r) - r;
+}
+
+static void CheckFormatRadius(const CheckFormat *cf, int radius)
+{
+    disp_bpp = cf->bpp;
+    screen = SDL_CreateRGBSurface(SDL_SWSURFACE, CHECK_W, CHECK_H, cf->bpp, cf->r, cf->g, cf->b, 0);
+    SDL_Surface *ref = SDL_CreateRGBSurface(SDL_SWSURFACE, CHECK_W, CHECK_H, cf->bpp, cf->r, cf->g, cf->b, 0);
+    fin_pic = SDL_CreateRGBSurface(SDL_SWSURFACE, 8, 8, 32, 0xff0000, 0x00ff00, 0x0000ff, 0xff000000);
+    SDL_Surface *lut_screen = screen;
+
+    game_config.wnd_w = CHECK_W;
+    game_config.wnd_h = CHECK_H;
+    game_config.ball_r = radius;
+    game_config.hole_r = radius + 2;
+    game_config.key_r = radius * 3 / 4;
+    InitRender();
+
+    int diam = rad * 2 + 1;
+    ref_zeds = ALLOC2D_DIAM(float, diam);
+    ref_aa = ALLOC2D_DIAM(uint8_t, diam);
+    RefCalcCircle(rad);
+
+    size_t size = (size_t)CHECK_H * screen->pitch;
+    for (int i=0; i<POSES_COUNT; i++)
+    {
+        for (size_t j=0; j<size; j++)
+            ((Uint8*)lut_screen->pixels)[j] = rand();
+        memcpy(ref->pixels, lut_screen->pixels, size);
+
+        dReal R[12];
+        RandomRotation(R);
+        int x = RandomCentre(CHECK_W, rad), y = RandomCentre(CHECK_H, rad);
+        float z = (float)(RandomUnit() * 3 - 1) * rad;
+        SDL_Color bcolor = { rand(), rand(), rand(), 0 };
+
+        screen = lut_screen;
+        DrawBall(x, y, z, R, bcolor);
+        screen = ref;
+        RefDrawBall(x, y, z, R, bcolor);
+        screen = lut_screen;
+
+        checks_count++;
+        if (memcmp(lut_screen->pixels, ref->pixels, size))
+        {
+            failures_count++;
+            printf("%dbpp ball of radius %d at (%d, %d) differs from the per-pixel one\n",
+                   cf->bpp, rad, x, y);
+        }
+    }
+
+    free2d((void**)ref_zeds, diam);
+    free2d((void**)ref_aa, diam);
+    FreeRender();
+    SDL_FreeSurface(fin_pic);
+    SDL_FreeSurface(ref);
+    SDL_FreeSurface(lut_screen);
+    screen = fin_pic = NULL;
+}
+
+int main()
+{
+    ref_a = ALLOC2D_DIAM(float, 3);
+    ref_a_1 = ALLOC2D_DIAM(float, 3);
+
+    srand(1);
+    for (unsigned int i=0; i<sizeof(formats)/sizeof(formats[0]); i++)
+        for (unsigned int j=0; j<sizeof(radii)/sizeof(radii[0]); j++)
+            CheckFormatRadius(&formats[i], radii[j]);
+
+    free2d((void**)ref_a, 3);
+    free2d((void**)ref_a_1, 3);
+
+    printf("%d ball checks, %d failed\n", checks_count, failures_count);
+    return (failures_count == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
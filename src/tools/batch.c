@@ -0,0 +1,576 @@
+/*  batch.c
+ *
+ *  Headless batch simulation runner for level QA and physics benchmarking.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Jobs file: one job per line, `<level> <script file>', where <level> is
+ * 1-based or `*' for every level of the pack. Lines starting with `#' are
+ * ignored.
+ *
+ * Script file: one segment per line, `<duration ms> <tilt x> <tilt y>',
+ * tilt components in [-1..1] as returned by input_calibration_adjust().
+ *
+ * With --compare <n> only the jobs of the <n> levels with the most boxes are
+ * run, each once with the grid and once with the hash broadphase, and the
+ * times and pairs tested of the two are printed side by side per level.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <argtable2.h>
+#include "../mazecore/mazecore.h"
+#include "../mazecore/mazehelpers.h"
+#include "../misc/workpool.h"
+#include "../paramsloader.h"
+
+#define LOG_MODULE "Batch"
+#include "../logging.h"
+
+typedef struct {
+    int duration;
+    float tilt_x;
+    float tilt_y;
+} ScriptSegment;
+
+typedef struct {
+    char *name;
+    ScriptSegment *segments;
+    int segments_count;
+} Script;
+
+typedef enum {
+    RESULT_FINISHED,
+    RESULT_FAILED,
+    RESULT_STUCK,
+    RESULT_TUNNELED,
+    RESULT_TIMEOUT
+} JobResult;
+
+static const char *result_names[] = {
+    "finished",
+    "failed",
+    "stuck",
+    "tunneled",
+    "timeout"
+};
+
+typedef struct {
+    int level;
+    Script *script;
+    MazeBroadphase broadphase;
+
+    JobResult result;
+    int frames;
+    int saves;
+    int game_time;
+    MazeStats stats;
+    double wall_time;
+} Job;
+
+static MazeConfig game_config;
+static Level *game_levels = NULL;
+static int game_levels_count = 0;
+static int frame_ticks = 16;
+static int stuck_ticks = 5000;
+static MazeBroadphase broadphase = MAZE_BROADPHASE_GRID;
+static bool fixed_step = false;
+
+//------------------------------------------------------------------------------
+
+static double get_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool load_script(Script *script, const char *fname)
+{
+    FILE *f = fopen(fname, "r");
+    if (!f)
+    {
+        log_error("can't open script `%s'", fname);
+        return false;
+    }
+
+    int size = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), f))
+    {
+        ScriptSegment seg;
+        if (line[0] == '#' || sscanf(line, "%d %f %f", &seg.duration, &seg.tilt_x, &seg.tilt_y) != 3)
+            continue;
+        clamp(seg.tilt_x, -1, 1);
+        clamp(seg.tilt_y, -1, 1);
+        if (script->segments_count == size)
+        {
+            size = (size ? size * 2 : 64);
+            script->segments = (ScriptSegment*)realloc(script->segments, size * sizeof(ScriptSegment));
+        }
+        script->segments[script->segments_count++] = seg;
+    }
+    fclose(f);
+
+    script->name = strdup(fname);
+    return true;
+}
+
+static void random_script(Script *script, unsigned int seed, int length)
+{
+    int size = 0;
+    int total = 0;
+    while (total < length)
+    {
+        ScriptSegment seg;
+        seg.duration = 100 + rand_r(&seed) % 1400;
+        seg.tilt_x = 2.0 * rand_r(&seed) / RAND_MAX - 1.0;
+        seg.tilt_y = 2.0 * rand_r(&seed) / RAND_MAX - 1.0;
+        if (script->segments_count == size)
+        {
+            size = (size ? size * 2 : 64);
+            script->segments = (ScriptSegment*)realloc(script->segments, size * sizeof(ScriptSegment));
+        }
+        script->segments[script->segments_count++] = seg;
+        total += seg.duration;
+    }
+
+    char name[32];
+    sprintf(name, "random:%u", seed);
+    script->name = strdup(name);
+}
+
+//------------------------------------------------------------------------------
+
+static bool is_tunneled(Level *lvl, int x, int y, int z)
+{
+    if (z < 0)
+        return false;
+    if (x < 0 || x > game_config.wnd_w || y < 0 || y > game_config.wnd_h)
+        return true;
+    for (int i=0; i<lvl->boxes_count; i++)
+    {
+        Box *b = &lvl->boxes[i];
+        if (x > b->x1 && x < b->x2 && y > b->y1 && y < b->y2)
+            return true;
+    }
+    return false;
+}
+
+static void run_job(void *arg)
+{
+    Job *job = (Job*)arg;
+    Level *lvl = &game_levels[job->level];
+    double start = get_time();
+
+    MazeWorld *w = maze_world_create(game_config, game_levels, game_levels_count);
+    maze_world_set_broadphase(w, job->broadphase);
+    maze_world_set_fixed_step(w, fixed_step);
+    maze_world_set_level(w, job->level);
+
+    int anchor_x = 0, anchor_y = 0, anchor_ticks = 0;
+    maze_world_get_ball(w, &anchor_x, &anchor_y, NULL, NULL);
+
+    job->result = RESULT_TIMEOUT;
+    bool done = false;
+    for (int i=0; i<job->script->segments_count && !done; i++)
+    {
+        ScriptSegment *seg = &job->script->segments[i];
+        maze_world_set_tilt(w, seg->tilt_x, seg->tilt_y, 0);
+        for (int t=0; t<seg->duration && !done; t+=frame_ticks)
+        {
+            GameState state = maze_world_step(w, frame_ticks);
+            job->frames++;
+            job->game_time += frame_ticks;
+
+            int x, y, z;
+            maze_world_get_ball(w, &x, &y, &z, NULL);
+
+            switch (state)
+            {
+            case GAME_STATE_WIN:
+                job->result = RESULT_FINISHED;
+                done = true;
+                break;
+            case GAME_STATE_FAILED:
+                job->result = RESULT_FAILED;
+                done = true;
+                break;
+            case GAME_STATE_SAVED:
+                job->saves++;
+                maze_world_reload_level(w);
+                maze_world_get_ball(w, &x, &y, &z, NULL);
+                anchor_x = x;
+                anchor_y = y;
+                anchor_ticks = job->game_time;
+                break;
+            default:
+                break;
+            }
+            if (done)
+                break;
+
+            if (is_tunneled(lvl, x, y, z))
+            {
+                job->result = RESULT_TUNNELED;
+                done = true;
+            }
+            else if (abs(x - anchor_x) > game_config.ball_r / 4 ||
+                     abs(y - anchor_y) > game_config.ball_r / 4)
+            {
+                anchor_x = x;
+                anchor_y = y;
+                anchor_ticks = job->game_time;
+            }
+            else if (job->game_time - anchor_ticks >= stuck_ticks)
+            {
+                job->result = RESULT_STUCK;
+                done = true;
+            }
+        }
+    }
+
+    maze_world_get_stats(w, &job->stats);
+    maze_world_destroy(w);
+    job->wall_time = get_time() - start;
+}
+
+//------------------------------------------------------------------------------
+
+static int add_job(Job **jobs, int *jobs_count, int *jobs_size, int level, Script *script)
+{
+    if (*jobs_count == *jobs_size)
+    {
+        *jobs_size = (*jobs_size ? *jobs_size * 2 : 256);
+        *jobs = (Job*)realloc(*jobs, *jobs_size * sizeof(Job));
+    }
+    Job *job = &(*jobs)[(*jobs_count)++];
+    memset(job, 0, sizeof(Job));
+    job->level = level;
+    job->script = script;
+    job->broadphase = broadphase;
+    return *jobs_count;
+}
+
+static bool load_jobs(const char *fname, Job **jobs, int *jobs_count, int *jobs_size)
+{
+    FILE *f = fopen(fname, "r");
+    if (!f)
+    {
+        log_error("can't open jobs file `%s'", fname);
+        return false;
+    }
+
+    bool ok = true;
+    char line[1024];
+    while (ok && fgets(line, sizeof(line), f))
+    {
+        char level_str[32];
+        char script_fname[sizeof(line)];
+        if (line[0] == '#' || sscanf(line, "%31s %1023s", level_str, script_fname) != 2)
+            continue;
+
+        Script *script = (Script*)calloc(1, sizeof(Script));
+        if (!load_script(script, script_fname))
+        {
+            free(script);
+            ok = false;
+            break;
+        }
+
+        if (!strcmp(level_str, "*"))
+        {
+            for (int i=0; i<game_levels_count; i++)
+                add_job(jobs, jobs_count, jobs_size, i, script);
+        }
+        else
+        {
+            int level = atoi(level_str) - 1;
+            if (level < 0 || level >= game_levels_count)
+            {
+                log_error("level `%s' is out of range 1..%d", level_str, game_levels_count);
+                ok = false;
+                break;
+            }
+            add_job(jobs, jobs_count, jobs_size, level, script);
+        }
+    }
+    fclose(f);
+    return ok;
+}
+
+static const char *broadphase_name(MazeBroadphase b)
+{
+    return (b == MAZE_BROADPHASE_HASH ? "hash" : "grid");
+}
+
+static int compare_boxes(const void *a, const void *b)
+{
+    int la = *(const int*)a, lb = *(const int*)b;
+    int diff = game_levels[lb].boxes_count - game_levels[la].boxes_count;
+    return (diff ? diff : la - lb);
+}
+
+// keeps the jobs of the levels with the most boxes, then repeats them with
+// the hash broadphase, so the twin of job i is job i + (returned count)
+static int select_compare_jobs(Job **jobs, int *jobs_count, int *jobs_size, int levels_count)
+{
+    int *order = (int*)malloc(game_levels_count * sizeof(int));
+    bool *selected = (bool*)calloc(game_levels_count, sizeof(bool));
+    for (int i=0; i<game_levels_count; i++)
+        order[i] = i;
+    qsort(order, game_levels_count, sizeof(int), compare_boxes);
+    for (int i=0; i<levels_count && i<game_levels_count; i++)
+        selected[order[i]] = true;
+
+    int count = 0;
+    for (int i=0; i<*jobs_count; i++)
+    {
+        if (selected[(*jobs)[i].level])
+        {
+            (*jobs)[count] = (*jobs)[i];
+            (*jobs)[count++].broadphase = MAZE_BROADPHASE_GRID;
+        }
+    }
+    *jobs_count = count;
+    for (int i=0; i<count; i++)
+    {
+        int level = (*jobs)[i].level;
+        Script *script = (*jobs)[i].script;
+        add_job(jobs, jobs_count, jobs_size, level, script);
+        (*jobs)[*jobs_count - 1].broadphase = MAZE_BROADPHASE_HASH;
+    }
+
+    free(selected);
+    free(order);
+    return count;
+}
+
+static void print_compare(Job *jobs, int count)
+{
+    //a level has a job for every script, they are summed
+    int *levels = (int*)malloc(count * sizeof(int));
+    int levels_count = 0;
+    for (int i=0; i<count; i++)
+    {
+        int n = 0;
+        while (n < levels_count && levels[n] != jobs[i].level)
+            n++;
+        if (n == levels_count)
+            levels[levels_count++] = jobs[i].level;
+    }
+    qsort(levels, levels_count, sizeof(int), compare_boxes);
+
+    log_info("%5s %5s %10s %10s %8s %12s %12s %s", "level", "boxes", "grid ms", "hash ms",
+             "speedup", "grid pairs", "hash pairs", "results");
+    for (int n=0; n<levels_count; n++)
+    {
+        double grid_time = 0, hash_time = 0;
+        unsigned long grid_pairs = 0, hash_pairs = 0;
+        int differ = 0;
+        for (int i=0; i<count; i++)
+        {
+            if (jobs[i].level != levels[n])
+                continue;
+            Job *grid = &jobs[i], *hash = &jobs[i + count];
+            grid_time += grid->wall_time;
+            hash_time += hash->wall_time;
+            grid_pairs += grid->stats.pairs_tested;
+            hash_pairs += hash->stats.pairs_tested;
+            differ += (grid->result != hash->result || grid->frames != hash->frames);
+        }
+
+        char results[32];
+        if (differ)
+            sprintf(results, "%d differ", differ);
+        else
+            strcpy(results, "same");
+        log_info("%5d %5d %10.3f %10.3f %7.2fx %12lu %12lu %s", levels[n] + 1,
+                 game_levels[levels[n]].boxes_count, grid_time * 1000, hash_time * 1000,
+                 (hash_time > 0 ? grid_time / hash_time : 0), grid_pairs, hash_pairs, results);
+    }
+    free(levels);
+}
+
+static void write_results(FILE *out, Job *jobs, int jobs_count)
+{
+    fprintf(out, "job,level,script,broadphase,result,frames,game_ms,saves,steps,nan_rollbacks,pairs,contacts,wall_ms\n");
+    for (int i=0; i<jobs_count; i++)
+    {
+        Job *job = &jobs[i];
+        fprintf(out, "%d,%d,%s,%s,%s,%d,%d,%d,%lu,%lu,%lu,%lu,%.3f\n",
+                i + 1, job->level + 1, job->script->name, broadphase_name(job->broadphase),
+                result_names[job->result],
+                job->frames, job->game_time, job->saves,
+                job->stats.steps, job->stats.nan_rollbacks,
+                job->stats.pairs_tested, job->stats.contacts_made, job->wall_time * 1000);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    struct arg_str  *pack    = arg_str0("p","levelpack","<file>", "level pack file (default: " MDIR "main.levelpack.json)");
+    struct arg_int  *threads = arg_int0("j","jobs",NULL, "number of worker threads (default: number of CPUs)");
+    struct arg_int  *frame   = arg_int0("f","frame",NULL, "frame duration in ms passed to every step (default: 16)");
+    struct arg_int  *random  = arg_int0("r","random",NULL, "run <n> random tilt scripts on every level");
+    struct arg_int  *seed    = arg_int0("s","seed",NULL, "seed of random tilt scripts (default: 1)");
+    struct arg_int  *length  = arg_int0("t","time",NULL, "length of random tilt scripts in seconds (default: 60)");
+    struct arg_int  *stuck   = arg_int0(NULL,"stuck",NULL, "report a run as stuck after <n> ms without moving (default: 5000)");
+    struct arg_file *output  = arg_file0("o","output","<file>", "write per-job results (CSV) to <file> instead of stdout");
+    struct arg_str  *bphase  = arg_str0(NULL,"broadphase","grid|hash", "collision broadphase (default: grid)");
+    struct arg_int  *compare = arg_int0(NULL,"compare","<n>", "run the <n> levels with the most boxes with both broadphases and compare them");
+    struct arg_lit  *fixed   = arg_lit0(NULL,"fixed-step", "step the physics with a fixed timestep");
+    struct arg_file *jobs_f  = arg_file0(NULL,NULL,"<jobs file>", "list of `<level> <script file>' jobs");
+    struct arg_lit  *help    = arg_lit0(NULL,"help", "print this help and exit");
+    struct arg_end  *end     = arg_end (20);
+    void* argtable[] = {pack,threads,frame,random,seed,length,stuck,output,bphase,compare,fixed,jobs_f,help,end};
+    const char* progname = "mokomaze-batch";
+
+    if (arg_nullcheck(argtable) != 0)
+    {
+        printf("%s: insufficient memory\n",progname);
+        return EXIT_FAILURE;
+    }
+
+    int nerrors = arg_parse(argc,argv,argtable);
+    if (help->count > 0)
+    {
+        printf("Mokomaze batch simulation runner\n");
+        printf("Usage: %s", progname);
+        arg_print_syntax(stdout,argtable,"\n");
+        arg_print_glossary(stdout,argtable,"  %-25s %s\n");
+        return EXIT_SUCCESS;
+    }
+    if (nerrors > 0 || (jobs_f->count == 0 && random->count == 0))
+    {
+        arg_print_errors(stdout,end,progname);
+        printf("Try '%s --help' for more information.\n",progname);
+        return EXIT_FAILURE;
+    }
+
+    const char *pack_fname = (pack->count > 0 ? pack->sval[0] : MDIR "main.levelpack.json");
+    if (!LoadLevelpack(pack_fname) || GetGameLevelsCount() == 0)
+    {
+        log_error("Failed to load level pack `%s'.", pack_fname);
+        return EXIT_FAILURE;
+    }
+    game_config = GetGameConfig();
+    game_levels = GetGameLevels();
+    game_levels_count = GetGameLevelsCount();
+
+    if (frame->count > 0)
+        frame_ticks = frame->ival[0];
+    clamp_min(frame_ticks, 1);
+    if (stuck->count > 0)
+        stuck_ticks = stuck->ival[0];
+    fixed_step = (fixed->count > 0);
+    if (bphase->count > 0)
+    {
+        if (!strcmp(bphase->sval[0], "hash"))
+            broadphase = MAZE_BROADPHASE_HASH;
+        else if (strcmp(bphase->sval[0], "grid"))
+        {
+            log_error("unknown broadphase `%s'", bphase->sval[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    Job *jobs = NULL;
+    int jobs_count = 0, jobs_size = 0;
+    if (jobs_f->count > 0 && !load_jobs(jobs_f->filename[0], &jobs, &jobs_count, &jobs_size))
+        return EXIT_FAILURE;
+
+    if (random->count > 0)
+    {
+        unsigned int rseed = (seed->count > 0 ? seed->ival[0] : 1);
+        int rlength = (length->count > 0 ? length->ival[0] : 60) * 1000;
+        for (int i=0; i<random->ival[0]; i++)
+        {
+            Script *script = (Script*)calloc(1, sizeof(Script));
+            random_script(script, rseed + i, rlength);
+            for (int j=0; j<game_levels_count; j++)
+                add_job(&jobs, &jobs_count, &jobs_size, j, script);
+        }
+    }
+
+    int compare_count = 0;
+    if (compare->count > 0)
+        compare_count = select_compare_jobs(&jobs, &jobs_count, &jobs_size, compare->ival[0]);
+
+    FILE *out = stdout;
+    if (output->count > 0)
+    {
+        out = fopen(output->filename[0], "w");
+        if (!out)
+        {
+            log_error("can't open output file `%s'", output->filename[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    maze_init();
+    int threads_count = (threads->count > 0 ? threads->ival[0] : workpool_get_cpus_count());
+    WorkPool *pool = workpool_create(threads_count, maze_thread_init, maze_thread_quit);
+    threads_count = workpool_get_threads_count(pool);
+
+    log_info("running %d jobs on %d threads, %s broadphase", jobs_count, threads_count,
+             (compare->count > 0 ? "grid and hash" : broadphase_name(broadphase)));
+    double start = get_time();
+    for (int i=0; i<jobs_count; i++)
+        workpool_submit(pool, run_job, &jobs[i]);
+    workpool_wait(pool);
+    double wall_time = get_time() - start;
+    workpool_destroy(pool);
+
+    write_results(out, jobs, jobs_count);
+    if (out != stdout)
+        fclose(out);
+
+    int results[RESULT_TIMEOUT + 1] = {0};
+    double game_time = 0;
+    unsigned long steps = 0, pairs = 0, contacts = 0;
+    for (int i=0; i<jobs_count; i++)
+    {
+        results[jobs[i].result]++;
+        game_time += jobs[i].game_time / 1000.0;
+        steps += jobs[i].stats.steps;
+        pairs += jobs[i].stats.pairs_tested;
+        contacts += jobs[i].stats.contacts_made;
+    }
+
+    for (int i=0; i<=RESULT_TIMEOUT; i++)
+        log_info("%-8s %d", result_names[i], results[i]);
+    log_info("wall time: %.3f s", wall_time);
+    if (wall_time > 0)
+    {
+        log_info("simulated %.1f s of game time, %.1f game s per wall s", game_time, game_time / wall_time);
+        log_info("%lu physics steps, %.0f steps/s, %.0f steps/s/core", steps,
+                 steps / wall_time, steps / wall_time / threads_count);
+        log_info("%lu collision pairs tested, %lu contacts made", pairs, contacts);
+    }
+    if (compare->count > 0)
+        print_compare(jobs, compare_count);
+
+    maze_quit();
+    arg_freetable(argtable,sizeof(argtable)/sizeof(argtable[0]));
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,201 @@
+/*  dirtycheck.c
+ *
+ *  Check of the merging of the dirty rectangles.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Reports rectangles the way the main loop does and checks what reaches the
+ * display: every dirty pixel is updated, nothing outside the surface is,
+ * overlapping and touching rectangles are merged, distant ones (a fast
+ * diagonal move of the ball) are not, and one SDL_UpdateRects call is made
+ * per frame. Run by `make check'.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <SDL/SDL.h>
+
+// the updates are recorded instead of presented
+static void RecordUpdateRects(SDL_Surface *surf, int count, SDL_Rect *update);
+static int RecordFlip(SDL_Surface *surf);
+#define SDL_UpdateRects RecordUpdateRects
+#define SDL_Flip RecordFlip
+#include "../dirtyrects.c"
+#undef SDL_UpdateRects
+#undef SDL_Flip
+
+#define SURFACE_W 480
+#define SURFACE_H 640
+#define RANDOM_FRAMES 1000
+
+static SDL_Rect updated[DIRTY_MAX_RECTS];
+static int updated_count = 0;
+static int update_calls = 0;
+static int flip_calls = 0;
+
+static int checks_count = 0;
+static int failures_count = 0;
+
+static void RecordUpdateRects(SDL_Surface *surf, int count, SDL_Rect *update)
+{
+    (void)surf;
+    memcpy(updated, update, count * sizeof(SDL_Rect));
+    updated_count = count;
+    update_calls++;
+}
+
+static int RecordFlip(SDL_Surface *surf)
+{
+    (void)surf;
+    flip_calls++;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static void Check(bool ok, const char *what)
+{
+    checks_count++;
+    if (ok)
+        return;
+    failures_count++;
+    printf("%s\n", what);
+}
+
+static void Flush(SDL_Surface *surf)
+{
+    updated_count = update_calls = flip_calls = 0;
+    dirty_flush(surf);
+}
+
+static void CheckCases(SDL_Surface *surf)
+{
+    Flush(surf);
+    Check(update_calls == 0 && flip_calls == 0, "empty frame presented");
+    Check(dirty_get_stats().pixels == 0 && dirty_get_stats().rects == 0, "empty frame counted");
+
+    //the old and the new place of a slow ball overlap
+    dirty_add(100, 100, 30, 30);
+    dirty_add(104, 103, 30, 30);
+    Flush(surf);
+    Check(update_calls == 1 && updated_count == 1, "overlapping rectangles not merged");
+    Check(dirty_get_stats().pixels == 34*33, "overlapping rectangles pushed more than their union");
+
+    //near ones are cheaper to push at once
+    dirty_add(10, 10, 20, 20);
+    dirty_add(32, 10, 20, 20);
+    Flush(surf);
+    Check(updated_count == 1, "near rectangles not merged");
+
+    //a fast diagonal move stays two rectangles
+    dirty_add(0, 0, 30, 30);
+    dirty_add(200, 250, 30, 30);
+    Flush(surf);
+    Check(update_calls == 1 && updated_count == 2, "distant rectangles merged");
+    Check(dirty_get_stats().pixels == 2*30*30, "distant rectangles pushed more than themselves");
+
+    //clipped to the surface, the ones outside and the empty ones dropped
+    dirty_add(-10, -5, 20, 20);
+    dirty_add(SURFACE_W - 5, SURFACE_H - 5, 20, 20);
+    dirty_add(SURFACE_W + 5, 10, 20, 20);
+    dirty_add(10, -30, 20, 20);
+    dirty_add(50, 50, 0, 20);
+    Flush(surf);
+    Check(updated_count == 2 && dirty_get_stats().pixels == 10*15 + 5*5, "rectangles not clipped to the surface");
+
+    //a full redraw flips the surface
+    dirty_add(10, 10, 20, 20);
+    dirty_add_all();
+    Flush(surf);
+    Check(flip_calls == 1 && update_calls == 0, "full redraw not flipped");
+    Check(dirty_get_stats().full && dirty_get_stats().pixels == SURFACE_W*SURFACE_H, "full redraw not counted");
+
+    //more rectangles than can be kept
+    for (int i=0; i<DIRTY_MAX_RECTS + 1; i++)
+        dirty_add((i % 8) * 60, (i / 8) * 60, 10, 10);
+    Flush(surf);
+    Check(flip_calls == 1 && update_calls == 0, "overflow of the rectangles not flipped");
+
+    //the frame after a full redraw starts clean
+    dirty_add(10, 10, 20, 20);
+    Flush(surf);
+    Check(update_calls == 1 && !dirty_get_stats().full && dirty_get_stats().pixels == 400, "full redraw leaked into the next frame");
+}
+
+// every dirty pixel is updated, nothing outside the surface, and the merges
+// cost at most DIRTY_RECT_COST each
+static void CheckRandom(SDL_Surface *surf)
+{
+    static Uint8 dirty[SURFACE_H][SURFACE_W];
+    for (int frame=0; frame<RANDOM_FRAMES; frame++)
+    {
+        memset(dirty, 0, sizeof(dirty));
+        int count = 1 + rand() % (DIRTY_MAX_RECTS - 1);
+        long area = 0;
+        for (int i=0; i<count; i++)
+        {
+            int w = 1 + rand() % 60, h = 1 + rand() % 60;
+            int x = rand() % (SURFACE_W + 60) - 60 + 1, y = rand() % (SURFACE_H + 60) - 60 + 1;
+            dirty_add(x, y, w, h);
+            int x1 = max(x, 0), y1 = max(y, 0);
+            int x2 = min(x + w, SURFACE_W), y2 = min(y + h, SURFACE_H);
+            if (x1 < x2 && y1 < y2)
+                area += (x2 - x1) * (y2 - y1);
+            for (int yy=y1; yy<y2; yy++)
+                for (int xx=x1; xx<x2; xx++)
+                    dirty[yy][xx] = 1;
+        }
+        Flush(surf);
+
+        bool inside = true;
+        long pixels = 0;
+        for (int i=0; i<updated_count; i++)
+        {
+            const SDL_Rect *r = &updated[i];
+            inside &= (r->x >= 0 && r->y >= 0 && r->w > 0 && r->h > 0 &&
+                       r->x + r->w <= SURFACE_W && r->y + r->h <= SURFACE_H);
+            pixels += r->w * r->h;
+            for (int y=max(r->y, 0); y<min(r->y + r->h, SURFACE_H); y++)
+                for (int x=max(r->x, 0); x<min(r->x + r->w, SURFACE_W); x++)
+                    dirty[y][x] = 0;
+        }
+        Check(inside, "update outside the surface");
+        Check(update_calls <= 1 && flip_calls == 0, "frame presented more than once");
+        Check(pixels == dirty_get_stats().pixels && updated_count == dirty_get_stats().rects, "stats differ from the update");
+        Check(pixels <= area + (long)(count - updated_count) * DIRTY_RECT_COST, "merged rectangles cost too much");
+
+        //the updated pixels are cleared above
+        Check(!memchr(dirty, 1, sizeof(dirty)), "dirty pixel not updated");
+    }
+}
+
+int main()
+{
+    SDL_Surface *surf = SDL_CreateRGBSurface(SDL_SWSURFACE, SURFACE_W, SURFACE_H, 16, 0xf800, 0x07e0, 0x001f, 0);
+    srand(1);
+    CheckCases(surf);
+    CheckRandom(surf);
+    SDL_FreeSurface(surf);
+
+    printf("%d dirty rectangle checks, %d failed\n", checks_count, failures_count);
+    return (failures_count == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,355 @@
+/*  gfxcheck.c
+ *
+ *  Check of the manifest and the eviction of the graphics cache.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Stores images in the graphics cache until it outgrows its budget and
+ * requires the least recently used ones to be removed with their files,
+ * a touch counting as a use. The entries and their order of use must come
+ * back from the manifest after reopening, files not listed in a known
+ * manifest must be removed, and a damaged manifest or one of another
+ * version must start the cache over. Several threads storing, touching and
+ * loading at once must leave the sizes and the files in agreement with the
+ * entries. Run by `make check'.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+#include "../gfxcache.c"
+
+#define CACHE_DIR "gfxcheck.cache"
+#define BIG_W 1024  // 7 images fit the budget, the 8th doesn't
+#define BIG_H 1024
+#define SMALL_W 512
+#define SMALL_H 512
+#define THREADS_COUNT 4
+#define THREAD_KEYS 12
+#define THREAD_RUNS 3
+
+static int checks_count = 0;
+static int failures_count = 0;
+
+//------------------------------------------------------------------------------
+
+static void Check(bool ok, const char *what, ...)
+{
+    checks_count++;
+    if (ok)
+        return;
+    failures_count++;
+    va_list ap;
+    va_start(ap, what);
+    vprintf(what, ap);
+    va_end(ap);
+    printf("\n");
+}
+
+static SDL_Surface *CreateImage(int w, int h, uint64_t seed)
+{
+    SDL_Surface *s = SDL_CreateRGBSurface(SDL_SWSURFACE, w, h, 32, 0xff0000, 0x00ff00, 0x0000ff, 0);
+    Uint32 *p = (Uint32*)s->pixels;
+    for (int i=0; i<s->pitch/4*h; i++)
+        p[i] = (Uint32)seed*2654435761u + i;
+    return s;
+}
+
+static bool HasImage(const SDL_Surface *s, int w, int h, uint64_t seed)
+{
+    if (!s || s->w != w || s->h != h)
+        return false;
+    const Uint32 *p = (const Uint32*)s->pixels;
+    for (int i=0; i<s->pitch/4*h; i++)
+        if (p[i] != (Uint32)seed*2654435761u + i)
+            return false;
+    return true;
+}
+
+static bool Stored(uint64_t key)
+{
+    return g_hash_table_lookup_extended(entries, &key, NULL, NULL);
+}
+
+static bool FileExists(uint64_t key)
+{
+    char *fname = GetEntryFile(key);
+    bool res = (access(fname, F_OK) == 0);
+    free(fname);
+    return res;
+}
+
+// the files but the manifest
+static int CountFiles()
+{
+    DIR *d = opendir(CACHE_DIR);
+    if (!d)
+        return 0;
+    int res = 0;
+    struct dirent *entry;
+    while ((entry = readdir(d)))
+        res += (entry->d_name[0] != '.' && strcmp(entry->d_name, GFX_CACHE_MANIFEST));
+    closedir(d);
+    return res;
+}
+
+static long SumSizes()
+{
+    long res = 0;
+    GHashTableIter iter;
+    gpointer key;
+    g_hash_table_iter_init(&iter, entries);
+    while (g_hash_table_iter_next(&iter, &key, NULL))
+        res += ((GfxCacheEntry*)key)->size;
+    return res;
+}
+
+static void WriteFile(const char *name, const char *text)
+{
+    char fname[512];
+    snprintf(fname, sizeof(fname), "%s/%s", CACHE_DIR, name);
+    FILE *f = fopen(fname, "w");
+    if (!f)
+        return;
+    fputs(text, f);
+    fclose(f);
+}
+
+static void RemoveDir(const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (!d)
+        return;
+    struct dirent *entry;
+    while ((entry = readdir(d)))
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+        char fname[512];
+        snprintf(fname, sizeof(fname), "%s/%s", dir, entry->d_name);
+        unlink(fname);
+    }
+    closedir(d);
+    rmdir(dir);
+}
+
+//------------------------------------------------------------------------------
+
+static uint64_t KeyOf(int n)
+{
+    return gfx_cache_key(n, BIG_W, BIG_H, false, 32);
+}
+
+static bool StoreBig(int n)
+{
+    SDL_Surface *s = CreateImage(BIG_W, BIG_H, n);
+    bool res = gfx_cache_store(KeyOf(n), n, false, s);
+    SDL_FreeSurface(s);
+    return res;
+}
+
+static bool LoadsBig(int n, const SDL_PixelFormat *format)
+{
+    SDL_Surface *s = gfx_cache_load(KeyOf(n), BIG_W, BIG_H, format, NULL);
+    bool res = HasImage(s, BIG_W, BIG_H, n);
+    raw_image_free(s);
+    return res;
+}
+
+// entries 0..count-1 are expected but the removed ones
+static void CheckEntries(int count, const bool *removed, const SDL_PixelFormat *format, const char *when)
+{
+    int listed = 0;
+    for (int i=0; i<count; i++)
+    {
+        bool kept = !removed[i];
+        listed += kept;
+        Check(Stored(KeyOf(i)) == kept, "%s: entry %d %s", when, i, kept ? "missing" : "kept");
+        Check(FileExists(KeyOf(i)) == kept, "%s: file of entry %d %s", when, i, kept ? "missing" : "kept");
+        if (kept)
+            Check(LoadsBig(i, format), "%s: entry %d not loaded back", when, i);
+    }
+    Check((int)g_hash_table_size(entries) == listed && CountFiles() == listed,
+          "%s: %u entries and %d files instead of %d", when, g_hash_table_size(entries), CountFiles(), listed);
+    Check(total_size == SumSizes() && total_size <= GFX_CACHE_BUDGET,
+          "%s: total size %ld, entries of %ld", when, total_size, SumSizes());
+}
+
+static void CheckEviction(const SDL_PixelFormat *format)
+{
+    bool removed[10] = {false};
+    RemoveDir(CACHE_DIR);
+    mkdir(CACHE_DIR, 0755);
+    WriteFile("level-1.png", "stale");
+    gfx_cache_open(CACHE_DIR);
+    Check(CountFiles() == 0, "file left without a manifest");
+
+    for (int i=0; i<7; i++)
+        Check(StoreBig(i), "entry %d not stored", i);
+    CheckEntries(7, removed, format, "under the budget");
+
+    //0 is used again, so 1 is the least recently used one
+    gfx_cache_touch(KeyOf(0));
+    StoreBig(7);
+    removed[1] = true;
+    CheckEntries(8, removed, format, "over the budget");
+
+    //storing an entry again replaces it
+    StoreBig(0);
+    CheckEntries(8, removed, format, "stored again");
+
+    //the order of use comes from the manifest: 2 is the oldest, 3 is made the newest
+    gfx_cache_close();
+    WriteFile("level-2.png", "stale");
+    gfx_cache_open(CACHE_DIR);
+    Check(CountFiles() == 8, "listed file removed or unlisted one kept with a manifest, %d files", CountFiles());
+    char fname[512];
+    snprintf(fname, sizeof(fname), "%s/%s", CACHE_DIR, "level-2.png");
+    unlink(fname);
+    CheckEntries(8, removed, format, "reopened");
+    gfx_cache_touch(KeyOf(3));
+    StoreBig(8);
+    removed[2] = true;
+    CheckEntries(9, removed, format, "over the budget after reopening");
+    StoreBig(9);
+    removed[4] = true;
+    CheckEntries(10, removed, format, "over the budget again");
+
+    //a damaged manifest starts the cache over
+    gfx_cache_close();
+    WriteFile(GFX_CACHE_MANIFEST, "mokomaze-gfx");
+    gfx_cache_open(CACHE_DIR);
+    Check(g_hash_table_size(entries) == 0 && total_size == 0 && CountFiles() == 0,
+          "damaged manifest not started over");
+    Check(!gfx_cache_load(KeyOf(0), BIG_W, BIG_H, format, NULL), "entry loaded after a damaged manifest");
+
+    //so does one of another version, even listing a file that is there
+    Check(StoreBig(0), "entry not stored after starting over");
+    gfx_cache_close();
+    char text[256];
+    snprintf(text, sizeof(text), "%s %d\n%016" PRIx64 " %016" PRIx64 " %d %d %d %d %ld %lu\n",
+             GFX_CACHE_MAGIC, GFX_CACHE_VERSION - 1, KeyOf(0), (uint64_t)0,
+             BIG_W, BIG_H, 32, 0, 4L*BIG_W*BIG_H, 1UL);
+    WriteFile(GFX_CACHE_MANIFEST, text);
+    gfx_cache_open(CACHE_DIR);
+    Check(g_hash_table_size(entries) == 0 && CountFiles() == 0, "manifest of another version read");
+    gfx_cache_close();
+}
+
+//------------------------------------------------------------------------------
+
+static const SDL_PixelFormat *thread_format = NULL;
+
+static uint64_t ThreadKey(int thread, int n)
+{
+    return gfx_cache_key(thread*THREAD_KEYS + n, SMALL_W, SMALL_H, true, 32);
+}
+
+typedef struct {
+    int thread;
+    int damaged;
+} StoreWorkData;
+
+static int StoreWork(void *data)
+{
+    StoreWorkData *work = (StoreWorkData*)data;
+    int t = work->thread;
+    unsigned int seed = t;
+    for (int run=0; run<THREAD_RUNS; run++)
+    {
+        for (int i=0; i<THREAD_KEYS; i++)
+        {
+            int n = rand_r(&seed) % THREAD_KEYS;
+            SDL_Surface *held = gfx_cache_load(ThreadKey(t, n), SMALL_W, SMALL_H, thread_format, NULL);
+            gfx_cache_touch(ThreadKey(t, rand_r(&seed) % THREAD_KEYS));
+
+            SDL_Surface *s = CreateImage(SMALL_W, SMALL_H, ThreadKey(t, i));
+            gfx_cache_store(ThreadKey(t, i), ThreadKey(t, i), true, s);
+            SDL_FreeSurface(s);
+
+            //an image loaded stays whole when its entry is removed meanwhile
+            work->damaged += (held && !HasImage(held, SMALL_W, SMALL_H, ThreadKey(t, n)));
+            raw_image_free(held);
+        }
+        gfx_cache_sync();
+    }
+    return 0;
+}
+
+static void CheckThreads(const SDL_PixelFormat *format)
+{
+    RemoveDir(CACHE_DIR);
+    mkdir(CACHE_DIR, 0755);
+    gfx_cache_open(CACHE_DIR);
+    thread_format = format;
+
+    SDL_Thread *threads[THREADS_COUNT];
+    StoreWorkData work[THREADS_COUNT];
+    for (int i=0; i<THREADS_COUNT; i++)
+    {
+        work[i].thread = i;
+        work[i].damaged = 0;
+        threads[i] = SDL_CreateThread(StoreWork, &work[i]);
+    }
+    for (int i=0; i<THREADS_COUNT; i++)
+    {
+        SDL_WaitThread(threads[i], NULL);
+        Check(work[i].damaged == 0, "threads: %d images of thread %d damaged", work[i].damaged, i);
+    }
+
+    int listed = 0;
+    for (int t=0; t<THREADS_COUNT; t++)
+    {
+        for (int i=0; i<THREAD_KEYS; i++)
+        {
+            bool stored = Stored(ThreadKey(t, i));
+            listed += stored;
+            Check(stored == FileExists(ThreadKey(t, i)), "threads: entry and file of %d:%d disagree", t, i);
+        }
+    }
+    Check(listed < THREADS_COUNT*THREAD_KEYS, "threads: nothing removed");
+    Check(listed == (int)g_hash_table_size(entries) && CountFiles() == listed,
+          "threads: %d entries and %d files", listed, CountFiles());
+    Check(total_size == SumSizes() && total_size <= GFX_CACHE_BUDGET,
+          "threads: total size %ld, entries of %ld", total_size, SumSizes());
+
+    gfx_cache_close();
+    gfx_cache_open(CACHE_DIR);
+    Check((int)g_hash_table_size(entries) == listed, "threads: manifest lists %u entries instead of %d",
+          g_hash_table_size(entries), listed);
+    gfx_cache_close();
+}
+
+int main()
+{
+    SDL_Surface *like = CreateImage(1, 1, 0);
+
+    CheckEviction(like->format);
+    CheckThreads(like->format);
+
+    SDL_FreeSurface(like);
+    RemoveDir(CACHE_DIR);
+
+    printf("%d gfx cache checks, %d failed\n", checks_count, failures_count);
+    return (failures_count == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
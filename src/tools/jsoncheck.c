@@ -0,0 +1,366 @@
+/*  jsoncheck.c
+ *
+ *  Check of the index-only loading of JSON levelpacks.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Writes the same levels as pretty, compact, reordered, escaped and nested
+ * JSON packs, opens them with the index-only loader and the full one, and
+ * requires every level to come back field by field. Run by `make check'.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "../paramsloader.c"
+
+#define PACK_FILE "jsoncheck.json"
+#define LEVELS_COUNT 7
+
+#define STYLE_COMPACT   1
+#define STYLE_REORDERED 2
+#define STYLE_ESCAPED   4
+#define STYLE_NESTED    8
+
+static const MazeConfig pack_config = { 480, 640, 16, 18, 12, 3 };
+
+static int checks_count = 0;
+static int failures_count = 0;
+
+//------------------------------------------------------------------------------
+
+// levels of different sizes, some of them without holes or keys
+static void MakeLevel(int n, Level *lvl)
+{
+    memset(lvl, 0, sizeof(Level));
+    lvl->boxes_count = 1 + n % 4;
+    lvl->boxes = (Box*)malloc(sizeof(Box) * lvl->boxes_count);
+    for (int i=0; i<lvl->boxes_count; i++)
+    {
+        Box *box = &lvl->boxes[i];
+        box->x1 = 10*n + i;
+        box->y1 = 20*n + 2*i;
+        box->x2 = box->x1 + 30 + i;
+        box->y2 = box->y1 + 40 - n;
+    }
+    lvl->holes_count = n % 3;
+    lvl->holes = (Point*)malloc(sizeof(Point) * (lvl->holes_count + 1));
+    for (int i=0; i<lvl->holes_count; i++)
+    {
+        lvl->holes[i].x = 100 + n + i;
+        lvl->holes[i].y = 200 - n - i;
+    }
+    lvl->keys_count = (n % 2 ? 2 : 0);
+    lvl->keys = (Point*)malloc(sizeof(Point) * (lvl->keys_count + 1));
+    for (int i=0; i<lvl->keys_count; i++)
+    {
+        lvl->keys[i].x = 300 + i;
+        lvl->keys[i].y = 310 + n;
+    }
+    lvl->fins_count = 1 + n % 2;
+    lvl->fins = (Point*)malloc(sizeof(Point) * lvl->fins_count);
+    for (int i=0; i<lvl->fins_count; i++)
+    {
+        lvl->fins[i].x = 400 - n;
+        lvl->fins[i].y = 410 + i;
+    }
+    lvl->init.x = 5 + n;
+    lvl->init.y = 600 - n;
+}
+
+static void FreeLevel(Level *lvl)
+{
+    free(lvl->boxes);
+    free(lvl->holes);
+    free(lvl->keys);
+    free(lvl->fins);
+    memset(lvl, 0, sizeof(Level));
+}
+
+//------------------------------------------------------------------------------
+
+static void WritePoints(FILE *f, const char *name, const Point *points, int count, const char *nl)
+{
+    fprintf(f, "\"%s\":%s[", name, (*nl ? " " : ""));
+    for (int i=0; i<count; i++)
+        fprintf(f, "%s%s{\"x\":%d,\"y\":%d}", (i ? "," : ""), nl, points[i].x, points[i].y);
+    fprintf(f, "%s]", nl);
+}
+
+static void WriteBoxes(FILE *f, const Level *lvl, const char *nl)
+{
+    fprintf(f, "\"boxes\":%s[", (*nl ? " " : ""));
+    for (int i=0; i<lvl->boxes_count; i++)
+    {
+        const Box *box = &lvl->boxes[i];
+        fprintf(f, "%s%s{ \"x1\": %d, \"y1\": %d, \"x2\": %d, \"y2\": %d }",
+                (i ? "," : ""), nl, box->x1, box->y1, box->x2, box->y2);
+    }
+    fprintf(f, "%s]", nl);
+}
+
+static void WriteLevel(FILE *f, const Level *lvl, int style)
+{
+    const char *nl = (style & STYLE_COMPACT ? "" : "\n    ");
+    fprintf(f, "{%s", nl);
+    if (style & STYLE_ESCAPED)
+        fprintf(f, "\"comment\": \"a \\\"level\\\" with }, ] and \\\\\",%s", nl);
+    if (style & STYLE_NESTED)
+        fprintf(f, "\"extra\": {\"levels\": [{\"init\": {\"x\": -1}}], \"note\": \"{[\"},%s", nl);
+
+    if (style & STYLE_REORDERED)
+    {
+        fprintf(f, "\"init\": {\"y\": %d, \"x\": %d},%s", lvl->init.y, lvl->init.x, nl);
+        WritePoints(f, "checkpoints", lvl->fins, lvl->fins_count, nl);
+        if (lvl->keys_count)
+        {
+            fprintf(f, ",%s", nl);
+            WritePoints(f, "keys", lvl->keys, lvl->keys_count, nl);
+        }
+        if (lvl->holes_count)
+        {
+            fprintf(f, ",%s", nl);
+            WritePoints(f, "holes", lvl->holes, lvl->holes_count, nl);
+        }
+        fprintf(f, ",%s", nl);
+        WriteBoxes(f, lvl, nl);
+    }
+    else
+    {
+        WriteBoxes(f, lvl, nl);
+        if (lvl->holes_count)
+        {
+            fprintf(f, ",%s", nl);
+            WritePoints(f, "holes", lvl->holes, lvl->holes_count, nl);
+        }
+        if (lvl->keys_count)
+        {
+            fprintf(f, ",%s", nl);
+            WritePoints(f, "keys", lvl->keys, lvl->keys_count, nl);
+        }
+        fprintf(f, ",%s", nl);
+        WritePoints(f, "checkpoints", lvl->fins, lvl->fins_count, nl);
+        fprintf(f, ",%s\"init\": {\"x\": %d, \"y\": %d}", nl, lvl->init.x, lvl->init.y);
+    }
+    fprintf(f, "%s}", (style & STYLE_COMPACT ? "" : "\n  "));
+}
+
+static void WriteRequirements(FILE *f, const MazeConfig *cfg, const char *nl)
+{
+    fprintf(f, "\"requirements\": {%s\"window\": {\"width\": %d, \"height\": %d},%s"
+               "\"ball\": {\"radius\": %d},%s\"hole\": {\"radius\": %d},%s"
+               "\"key\": {\"radius\": %d},%s\"box\": {\"shadow\": %d}}",
+            nl, cfg->wnd_w, cfg->wnd_h, nl, cfg->ball_r, nl, cfg->hole_r, nl, cfg->key_r, nl, cfg->shadow);
+}
+
+static void WriteLevels(FILE *f, const Level *levels, int count, int style, const char *nl)
+{
+    fprintf(f, "\"levels\": [");
+    for (int i=0; i<count; i++)
+    {
+        fprintf(f, "%s%s  ", (i ? "," : ""), nl);
+        WriteLevel(f, &levels[i], style);
+    }
+    fprintf(f, "%s]", nl);
+}
+
+static bool WritePack(const char *fname, const Level *levels, int count, int style)
+{
+    FILE *f = fopen(fname, "w");
+    if (!f)
+        return false;
+    const char *nl = (style & STYLE_COMPACT ? "" : "\n");
+    fprintf(f, "{%s", nl);
+    if (style & STYLE_ESCAPED)
+        fprintf(f, "\"name\": \"\\\"levels\\\": [{\\\\\", \"author\": \"a, b {c}\",%s", nl);
+    if (style & STYLE_NESTED)
+        fprintf(f, "\"about\": {\"requirements\": \"levels\", \"levels\": [\"requirements\"]},%s"
+                   "\"levels_old\": [],%s", nl, nl);
+    if (style & STYLE_REORDERED)
+    {
+        WriteLevels(f, levels, count, style, nl);
+        fprintf(f, ",%s", nl);
+        WriteRequirements(f, &pack_config, nl);
+    }
+    else
+    {
+        WriteRequirements(f, &pack_config, nl);
+        fprintf(f, ",%s", nl);
+        WriteLevels(f, levels, count, style, nl);
+    }
+    if (style & STYLE_NESTED)
+        fprintf(f, ",%s\"version\": [1, {\"levels\": 0}]", nl);
+    fprintf(f, "%s}%s", nl, nl);
+    fclose(f);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+static bool SamePoints(const Point *a, const Point *b, int count)
+{
+    for (int i=0; i<count; i++)
+        if (a[i].x != b[i].x || a[i].y != b[i].y)
+            return false;
+    return true;
+}
+
+static bool SameLevel(const Level *a, const Level *b)
+{
+    if (a->boxes_count != b->boxes_count || a->holes_count != b->holes_count ||
+        a->keys_count != b->keys_count || a->fins_count != b->fins_count)
+        return false;
+    for (int i=0; i<a->boxes_count; i++)
+        if (a->boxes[i].x1 != b->boxes[i].x1 || a->boxes[i].y1 != b->boxes[i].y1 ||
+            a->boxes[i].x2 != b->boxes[i].x2 || a->boxes[i].y2 != b->boxes[i].y2)
+            return false;
+    return SamePoints(a->holes, b->holes, a->holes_count) &&
+           SamePoints(a->keys, b->keys, a->keys_count) &&
+           SamePoints(a->fins, b->fins, a->fins_count) &&
+           a->init.x == b->init.x && a->init.y == b->init.y;
+}
+
+static bool SameConfig(const MazeConfig *a, const MazeConfig *b)
+{
+    return a->wnd_w == b->wnd_w && a->wnd_h == b->wnd_h && a->ball_r == b->ball_r &&
+           a->hole_r == b->hole_r && a->key_r == b->key_r && a->shadow == b->shadow;
+}
+
+static void Check(bool ok, const char *what, int style, int level)
+{
+    checks_count++;
+    if (ok)
+        return;
+    failures_count++;
+    printf("%s: style %d, level %d\n", what, style, level + 1);
+}
+
+//------------------------------------------------------------------------------
+
+static void CheckIndexed(const Level *levels, int style)
+{
+    memset(&game_config, 0, sizeof(game_config));
+    bool opened = open_levelpack(PACK_FILE);
+    Check(opened, "pack not opened", style, -1);
+    if (!opened)
+        return;
+    Check(SameConfig(&game_config, &pack_config), "indexed requirements differ", style, -1);
+    Check(game_levels_count == LEVELS_COUNT, "indexed levels count differs", style, -1);
+
+    //the levels out of order, as the game loads them
+    for (int i=0; i<game_levels_count && i<LEVELS_COUNT; i++)
+    {
+        int n = (i * 3) % LEVELS_COUNT;
+        Level lvl;
+        bool loaded = LoadGameLevel(n, &lvl);
+        Check(loaded && SameLevel(&lvl, &levels[n]), "indexed level differs", style, n);
+        FreeLevel(&lvl);
+    }
+    Level lvl;
+    Check(!LoadGameLevel(LEVELS_COUNT, &lvl), "level past the end loaded", style, LEVELS_COUNT);
+    close_levelpack();
+}
+
+static void CheckParsed(const Level *levels, int style)
+{
+    memset(&game_config, 0, sizeof(game_config));
+    bool loaded = load_levelpack(PACK_FILE);
+    Check(loaded, "pack not parsed", style, -1);
+    if (!loaded)
+        return;
+    Check(SameConfig(&game_config, &pack_config), "parsed requirements differ", style, -1);
+    Check(game_levels_count == LEVELS_COUNT, "parsed levels count differs", style, -1);
+    for (int i=0; i<game_levels_count && i<LEVELS_COUNT; i++)
+        Check(SameLevel(&game_levels[i], &levels[i]), "parsed level differs", style, i);
+    for (int i=0; i<game_levels_count; i++)
+        FreeLevel(&game_levels[i]);
+    free(game_levels);
+    game_levels = NULL;
+    game_levels_count = 0;
+}
+
+static void CheckBroken(const char *json, const char *what)
+{
+    FILE *f = fopen(PACK_FILE, "w");
+    if (!f)
+        return;
+    fputs(json, f);
+    fclose(f);
+    checks_count++;
+    if (open_levelpack(PACK_FILE))
+    {
+        failures_count++;
+        printf("%s: pack opened\n", what);
+        close_levelpack();
+    }
+}
+
+int main()
+{
+    parser = json_parser_new();
+
+    Level levels[LEVELS_COUNT];
+    for (int i=0; i<LEVELS_COUNT; i++)
+        MakeLevel(i, &levels[i]);
+
+    for (int style=0; style<=(STYLE_COMPACT|STYLE_REORDERED|STYLE_ESCAPED|STYLE_NESTED); style++)
+    {
+        if (!WritePack(PACK_FILE, levels, LEVELS_COUNT, style))
+        {
+            printf("can't write `%s'\n", PACK_FILE);
+            return EXIT_FAILURE;
+        }
+        CheckIndexed(levels, style);
+        CheckParsed(levels, style);
+    }
+
+    //a level without checkpoints is indexed, but not loaded
+    FILE *f = fopen(PACK_FILE, "w");
+    if (f)
+    {
+        fprintf(f, "{\"levels\": [{\"boxes\": [], \"checkpoints\": [], \"init\": {\"x\": 1, \"y\": 1}}],"
+                   " \"requirements\": {}}");
+        fclose(f);
+        Level lvl;
+        checks_count++;
+        if (!open_levelpack(PACK_FILE) || LoadGameLevel(0, &lvl))
+        {
+            failures_count++;
+            printf("level without checkpoints: not indexed or loaded\n");
+        }
+        close_levelpack();
+    }
+
+    CheckBroken("[]", "array at the top");
+    CheckBroken("{\"levels\": []}", "no requirements");
+    CheckBroken("{\"requirements\": {}}", "no levels");
+    CheckBroken("{\"requirements\": {}, \"levels\": {}}", "levels not an array");
+    CheckBroken("{\"about\": {\"requirements\": {}, \"levels\": []}}", "nested members only");
+
+    remove(PACK_FILE);
+    for (int i=0; i<LEVELS_COUNT; i++)
+        FreeLevel(&levels[i]);
+    g_object_unref(parser);
+    free(levelpack_file);
+
+    printf("%d levelpack checks, %d failed\n", checks_count, failures_count);
+    return (failures_count == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,241 @@
+/*  levelcheck.c
+ *
+ *  Check of the rendered level cache.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Stores level images in the memory and the disk cache and requires them to
+ * come back byte for byte by the content of their level, whatever its number,
+ * and to be missed for an edited level, another surface and another prefix.
+ * The least recently used image must be the one dropped from memory. Run by
+ * `make check'.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../levelcache.h"
+#include "../gfxcache.h"
+
+#define CACHE_DIR "levelcheck.cache"
+#define IMAGE_W 37
+#define IMAGE_H 20
+#define IMAGE_PITCH 80
+
+static int checks_count = 0;
+static int failures_count = 0;
+
+//------------------------------------------------------------------------------
+
+static Box boxes[3][2] = {
+    { {1, 2, 30, 4}, {5, 6, 7, 18} },
+    { {2, 2, 30, 4}, {5, 6, 7, 18} },
+    { {3, 2, 30, 4}, {5, 6, 7, 18} }
+};
+static Point holes[] = { {10, 11}, {12, 13} };
+static Point fins[] = { {20, 10} };
+static Point keys[] = { {25, 5} };
+
+static Level MakeLevel(int n)
+{
+    Level lvl;
+    memset(&lvl, 0, sizeof(lvl));
+    lvl.boxes_count = 2;
+    lvl.boxes = boxes[n];
+    lvl.holes_count = 2;
+    lvl.holes = holes;
+    lvl.fins_count = 1;
+    lvl.fins = fins;
+    return lvl;
+}
+
+// rows with padding, which must not be relied on
+static SDL_Surface *CreateImage(Uint32 rmask, Uint32 bmask)
+{
+    void *pixels = calloc(IMAGE_PITCH, IMAGE_H);
+    return SDL_CreateRGBSurfaceFrom(pixels, IMAGE_W, IMAGE_H, 16, IMAGE_PITCH, rmask, 0x07e0, bmask, 0);
+}
+
+static void FreeImage(SDL_Surface *s)
+{
+    void *pixels = s->pixels;
+    SDL_FreeSurface(s);
+    free(pixels);
+}
+
+static void FillImage(SDL_Surface *s, int seed)
+{
+    for (int i=0; i<IMAGE_PITCH*IMAGE_H; i++)
+        ((Uint8*)s->pixels)[i] = i*7 + seed*13;
+}
+
+static bool SameImage(const SDL_Surface *a, const SDL_Surface *b)
+{
+    for (int y=0; y<IMAGE_H; y++)
+        if (memcmp((Uint8*)a->pixels + y*a->pitch, (Uint8*)b->pixels + y*b->pitch, IMAGE_W*2))
+            return false;
+    return true;
+}
+
+static void Check(bool ok, const char *what)
+{
+    checks_count++;
+    if (ok)
+        return;
+    failures_count++;
+    printf("%s\n", what);
+}
+
+static void RemoveDir(const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (!d)
+        return;
+    struct dirent *entry;
+    while ((entry = readdir(d)))
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+        char fname[512];
+        snprintf(fname, sizeof(fname), "%s/%s", dir, entry->d_name);
+        unlink(fname);
+    }
+    closedir(d);
+    rmdir(dir);
+}
+
+//------------------------------------------------------------------------------
+
+static void CheckMemory()
+{
+    SDL_Surface *img[3], *to = CreateImage(0xf800, 0x001f);
+    Level lvl[3];
+    for (int i=0; i<3; i++)
+    {
+        img[i] = CreateImage(0xf800, 0x001f);
+        FillImage(img[i], i);
+        lvl[i] = MakeLevel(i);
+    }
+
+    Check(!level_cache_load(1, &lvl[0], to), "image loaded before the cache is set up");
+
+    level_cache_init(2, false, "check");
+    Check(!level_cache_load(1, &lvl[0], to), "image of an empty cache loaded");
+    level_cache_store(1, &lvl[0], img[0]);
+    level_cache_store(2, &lvl[1], img[1]);
+    Check(level_cache_load(1, &lvl[0], to) && SameImage(to, img[0]), "stored image differs");
+    Check(level_cache_load(9, &lvl[1], to) && SameImage(to, img[1]), "image of the same level under another number differs");
+
+    //the first level was used less recently than the second one
+    level_cache_load(2, &lvl[1], to);
+    level_cache_store(3, &lvl[2], img[2]);
+    Check(!level_cache_load(1, &lvl[0], to), "least recently used image kept");
+    Check(level_cache_load(2, &lvl[1], to) && SameImage(to, img[1]), "recently used image dropped");
+    Check(level_cache_load(3, &lvl[2], to) && SameImage(to, img[2]), "new image differs");
+
+    //an image stored again replaces the old one of its level
+    level_cache_store(3, &lvl[2], img[0]);
+    Check(level_cache_load(3, &lvl[2], to) && SameImage(to, img[0]), "replaced image differs");
+
+    //everything the image is drawn from is in the hash, the keys only by
+    //whether there are any
+    Level edited = lvl[1];
+    Point moved_fin = { fins[0].x + 1, fins[0].y };
+    edited.fins = &moved_fin;
+    Check(!level_cache_load(2, &edited, to), "image of a level with a moved checkpoint loaded");
+    edited = lvl[1];
+    edited.holes_count = 1;
+    Check(!level_cache_load(2, &edited, to), "image of a level with a hole less loaded");
+    edited = lvl[1];
+    edited.keys_count = 1;
+    edited.keys = keys;
+    Check(!level_cache_load(2, &edited, to), "image of a level with keys loaded");
+    edited.init.x = 99;
+    level_cache_store(2, &edited, img[1]);
+    Point moved_key = { keys[0].x + 1, keys[0].y };
+    edited.keys = &moved_key;
+    Check(level_cache_load(2, &edited, to), "image missed for a moved key, which isn't drawn into it");
+
+    //another surface size
+    SDL_Surface *small = SDL_CreateRGBSurface(SDL_SWSURFACE, IMAGE_W - 1, IMAGE_H, 16, 0xf800, 0x07e0, 0x001f, 0);
+    Check(!level_cache_load(2, &lvl[1], small), "image loaded into a smaller surface");
+    SDL_FreeSurface(small);
+
+    //the images of another prefix are dropped
+    level_cache_init(2, false, "other");
+    Check(!level_cache_load(2, &lvl[1], to), "image of another prefix loaded");
+    level_cache_free();
+
+    for (int i=0; i<3; i++)
+        FreeImage(img[i]);
+    FreeImage(to);
+}
+
+static void CheckDisk()
+{
+    SDL_Surface *img = CreateImage(0xf800, 0x001f);
+    SDL_Surface *to = CreateImage(0xf800, 0x001f);
+    SDL_Surface *swapped = CreateImage(0x001f, 0xf800);
+    Level lvl = MakeLevel(0);
+    FillImage(img, 5);
+
+    //the game creates the directory before it opens the cache
+    mkdir(CACHE_DIR, 0755);
+    gfx_cache_open(CACHE_DIR);
+    level_cache_init(2, true, "check");
+    level_cache_store(1, &lvl, img);
+    level_cache_free();
+    gfx_cache_close();
+
+    //a new run, nothing in memory
+    gfx_cache_open(CACHE_DIR);
+    level_cache_init(2, true, "check");
+    Check(level_cache_load(4, &lvl, to) && SameImage(to, img), "image loaded from disk differs");
+    level_cache_free();
+    level_cache_init(2, true, "check");
+    Check(!level_cache_load(1, &lvl, swapped), "image for another pixel format loaded from disk");
+    level_cache_init(2, true, "other");
+    Check(!level_cache_load(1, &lvl, to), "image of another prefix loaded from disk");
+
+    //the disk isn't used when it's not asked for
+    level_cache_init(2, false, "check");
+    Check(!level_cache_load(1, &lvl, to), "image loaded from disk when disabled");
+    level_cache_free();
+    gfx_cache_close();
+
+    FreeImage(img);
+    FreeImage(to);
+    FreeImage(swapped);
+}
+
+int main()
+{
+    RemoveDir(CACHE_DIR);
+    CheckMemory();
+    CheckDisk();
+    RemoveDir(CACHE_DIR);
+
+    printf("%d level cache checks, %d failed\n", checks_count, failures_count);
+    return (failures_count == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
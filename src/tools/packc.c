@@ -0,0 +1,117 @@
+/*  packc.c
+ *
+ *  Compiler of JSON level packs into the binary format.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Converts a JSON level pack into the binary format that mokomaze maps into
+ * memory instead of parsing, see levelpack.h. The game uses
+ * `<name>.levelpack.bin' next to `<name>.levelpack.json' when it's not older
+ * than the JSON file. The binary file keeps the byte order of the machine
+ * it's made on, so it should be compiled on the target device.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <argtable2.h>
+#include "../paramsloader.h"
+#include "../levelpack.h"
+
+#define LOG_MODULE "Packc"
+#include "../logging.h"
+
+// `dir/main.levelpack.json' -> `dir/main.levelpack.bin'
+static char* binary_name(const char *fname)
+{
+    size_t len = strlen(fname);
+    size_t ext_len = strlen(LEVELPACK_JSON_EXT);
+    if (len >= ext_len && !strcmp(fname + len - ext_len, LEVELPACK_JSON_EXT))
+        len -= ext_len;
+    char *res = (char*)malloc(len + strlen(LEVELPACK_BINARY_EXT) + 1);
+    memcpy(res, fname, len);
+    strcpy(res + len, LEVELPACK_BINARY_EXT);
+    return res;
+}
+
+int main(int argc, char *argv[])
+{
+    struct arg_file *output  = arg_file0("o","output","<file>", "binary level pack to write (default: <name>" LEVELPACK_BINARY_EXT ")");
+    struct arg_file *pack    = arg_file1(NULL,NULL,"<levelpack file>", "JSON level pack");
+    struct arg_lit  *help    = arg_lit0(NULL,"help", "print this help and exit");
+    struct arg_end  *end     = arg_end (20);
+    void* argtable[] = {output,pack,help,end};
+    const char* progname = "mokomaze-packc";
+
+    if (arg_nullcheck(argtable) != 0)
+    {
+        printf("%s: insufficient memory\n",progname);
+        return EXIT_FAILURE;
+    }
+
+    int nerrors = arg_parse(argc,argv,argtable);
+    if (help->count > 0)
+    {
+        printf("Mokomaze level pack compiler\n");
+        printf("Usage: %s", progname);
+        arg_print_syntax(stdout,argtable,"\n");
+        arg_print_glossary(stdout,argtable,"  %-25s %s\n");
+        return EXIT_SUCCESS;
+    }
+    if (nerrors > 0)
+    {
+        arg_print_errors(stdout,end,progname);
+        printf("Try '%s --help' for more information.\n",progname);
+        return EXIT_FAILURE;
+    }
+
+    const char *pack_fname = pack->filename[0];
+    if (levelpack_is_binary(pack_fname))
+    {
+        log_error("`%s' is already compiled", pack_fname);
+        return EXIT_FAILURE;
+    }
+    if (!LoadLevelpack(pack_fname) || GetGameLevelsCount() == 0)
+    {
+        log_error("Failed to load level pack `%s'.", pack_fname);
+        return EXIT_FAILURE;
+    }
+
+    //a level without checkpoints can't be finished, the game refuses it
+    const Level *levels = GetGameLevels();
+    for (int i=0; i<GetGameLevelsCount(); i++)
+    {
+        if (levels[i].fins_count < 1)
+        {
+            log_error("level %d of `%s' has no checkpoints", i+1, pack_fname);
+            return EXIT_FAILURE;
+        }
+    }
+
+    char *out_fname = (output->count > 0 ? strdup(output->filename[0]) : binary_name(pack_fname));
+    MazeConfig config = GetGameConfig();
+    bool written = levelpack_write_binary(out_fname, &config, levels, GetGameLevelsCount());
+    if (written)
+        log_info("%d levels written to `%s'", GetGameLevelsCount(), out_fname);
+
+    free(out_fname);
+    arg_freetable(argtable,sizeof(argtable)/sizeof(argtable[0]));
+    return (written ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,337 @@
+/*  packcheck.c
+ *
+ *  Check of the binary levelpack format.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Writes a binary pack, reads every level back through both the mapped and
+ * the indexed loader and compares it field by field, then damages copies of
+ * the file and requires the loaders to reject them. Run by `make check'.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "../levelpack.c"
+
+#define PACK_FILE "packcheck.bin"
+#define DAMAGED_FILE "packcheck-damaged.bin"
+#define LEVELS_COUNT 6
+
+static const MazeConfig pack_config = { 480, 640, 16, 18, 12, 3 };
+
+static int checks_count = 0;
+static int failures_count = 0;
+
+//------------------------------------------------------------------------------
+
+// levels of different sizes, some of them without holes or keys
+static void MakeLevel(int n, Level *lvl)
+{
+    memset(lvl, 0, sizeof(Level));
+    lvl->boxes_count = 1 + n % 4;
+    lvl->boxes = (Box*)malloc(sizeof(Box) * lvl->boxes_count);
+    for (int i=0; i<lvl->boxes_count; i++)
+    {
+        Box *box = &lvl->boxes[i];
+        box->x1 = 10*n + i;
+        box->y1 = 20*n + 2*i;
+        box->x2 = box->x1 + 30 + i;
+        box->y2 = box->y1 + 40 - n;
+    }
+    lvl->holes_count = n % 3;
+    lvl->holes = (Point*)malloc(sizeof(Point) * (lvl->holes_count + 1));
+    for (int i=0; i<lvl->holes_count; i++)
+    {
+        lvl->holes[i].x = 100 + n + i;
+        lvl->holes[i].y = 200 - n - i;
+    }
+    lvl->keys_count = (n % 2 ? 2 : 0);
+    lvl->keys = (Point*)malloc(sizeof(Point) * (lvl->keys_count + 1));
+    for (int i=0; i<lvl->keys_count; i++)
+    {
+        lvl->keys[i].x = 300 + i;
+        lvl->keys[i].y = 310 + n;
+    }
+    lvl->fins_count = 1 + n % 2;
+    lvl->fins = (Point*)malloc(sizeof(Point) * lvl->fins_count);
+    for (int i=0; i<lvl->fins_count; i++)
+    {
+        lvl->fins[i].x = 400 - n;
+        lvl->fins[i].y = 410 + i;
+    }
+    lvl->init.x = 5 + n;
+    lvl->init.y = 600 - n;
+}
+
+static void FreeLevel(Level *lvl)
+{
+    free(lvl->boxes);
+    free(lvl->holes);
+    free(lvl->keys);
+    free(lvl->fins);
+    memset(lvl, 0, sizeof(Level));
+}
+
+static bool SamePoints(const Point *a, const Point *b, int count)
+{
+    for (int i=0; i<count; i++)
+        if (a[i].x != b[i].x || a[i].y != b[i].y)
+            return false;
+    return true;
+}
+
+static bool SameLevel(const Level *a, const Level *b)
+{
+    if (a->boxes_count != b->boxes_count || a->holes_count != b->holes_count ||
+        a->keys_count != b->keys_count || a->fins_count != b->fins_count)
+        return false;
+    for (int i=0; i<a->boxes_count; i++)
+        if (a->boxes[i].x1 != b->boxes[i].x1 || a->boxes[i].y1 != b->boxes[i].y1 ||
+            a->boxes[i].x2 != b->boxes[i].x2 || a->boxes[i].y2 != b->boxes[i].y2)
+            return false;
+    return SamePoints(a->holes, b->holes, a->holes_count) &&
+           SamePoints(a->keys, b->keys, a->keys_count) &&
+           SamePoints(a->fins, b->fins, a->fins_count) &&
+           a->init.x == b->init.x && a->init.y == b->init.y;
+}
+
+static bool SameConfig(const MazeConfig *a, const MazeConfig *b)
+{
+    return a->wnd_w == b->wnd_w && a->wnd_h == b->wnd_h && a->ball_r == b->ball_r &&
+           a->hole_r == b->hole_r && a->key_r == b->key_r && a->shadow == b->shadow;
+}
+
+static void Check(bool ok, const char *what)
+{
+    checks_count++;
+    if (ok)
+        return;
+    failures_count++;
+    printf("%s\n", what);
+}
+
+//------------------------------------------------------------------------------
+
+static void CheckRoundTrip(const Level *levels)
+{
+    Check(levelpack_write_binary(PACK_FILE, &pack_config, levels, LEVELS_COUNT), "pack not written");
+    Check(levelpack_is_binary(PACK_FILE), "pack not recognized");
+
+    //the mapping of the loaded levels stays for the process
+    MazeConfig config;
+    Level *loaded = NULL;
+    int count = 0;
+    bool ok = levelpack_load_binary(PACK_FILE, &config, &loaded, &count);
+    Check(ok, "pack not loaded");
+    if (ok)
+    {
+        Check(SameConfig(&config, &pack_config), "loaded requirements differ");
+        Check(count == LEVELS_COUNT, "loaded levels count differs");
+        for (int i=0; i<count && i<LEVELS_COUNT; i++)
+            Check(SameLevel(&loaded[i], &levels[i]), "loaded level differs");
+        free(loaded);
+    }
+
+    memset(&config, 0, sizeof(config));
+    ok = levelpack_open_binary(PACK_FILE, &config, &count);
+    Check(ok, "pack not opened");
+    if (!ok)
+        return;
+    Check(SameConfig(&config, &pack_config), "opened requirements differ");
+    Check(count == LEVELS_COUNT, "opened levels count differs");
+    for (int i=0; i<count && i<LEVELS_COUNT; i++)
+    {
+        Level lvl;
+        ok = levelpack_read_binary_level(i, &lvl);
+        Check(ok && SameLevel(&lvl, &levels[i]), "read level differs");
+        if (!ok)
+            continue;
+        //the levels are copies, changing one doesn't touch the pack
+        lvl.boxes[0].x1 = -1;
+        FreeLevel(&lvl);
+        ok = levelpack_read_binary_level(i, &lvl);
+        Check(ok && SameLevel(&lvl, &levels[i]), "level read again differs");
+        if (ok)
+            FreeLevel(&lvl);
+    }
+    Level lvl;
+    Check(!levelpack_read_binary_level(-1, &lvl), "level before the first read");
+    Check(!levelpack_read_binary_level(LEVELS_COUNT, &lvl), "level past the end read");
+    levelpack_close_binary();
+}
+
+//------------------------------------------------------------------------------
+
+static char *ReadFile(const char *fname, size_t *size)
+{
+    FILE *f = fopen(fname, "rb");
+    if (!f)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *data = (char*)malloc(*size);
+    if (fread(data, 1, *size, f) != *size)
+    {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+static void WriteFile(const char *fname, const char *data, size_t size)
+{
+    FILE *f = fopen(fname, "wb");
+    if (!f)
+        return;
+    fwrite(data, 1, size, f);
+    fclose(f);
+}
+
+// the whole damaged pack must be refused; when only the level is damaged the
+// indexed pack opens, but that level isn't read
+static void CheckRejected(const char *data, size_t size, int damaged_level, const char *what)
+{
+    char msg[128];
+    WriteFile(DAMAGED_FILE, data, size);
+
+    MazeConfig config;
+    Level *loaded = NULL;
+    int count = 0;
+    snprintf(msg, sizeof(msg), "%s: pack loaded", what);
+    bool loaded_ok = levelpack_load_binary(DAMAGED_FILE, &config, &loaded, &count);
+    Check(!loaded_ok, msg);
+    if (loaded_ok)
+        free(loaded);
+
+    bool opened = levelpack_open_binary(DAMAGED_FILE, &config, &count);
+    if (damaged_level < 0)
+    {
+        snprintf(msg, sizeof(msg), "%s: pack opened", what);
+        Check(!opened, msg);
+    }
+    else if (opened)
+    {
+        Level lvl;
+        snprintf(msg, sizeof(msg), "%s: damaged level read", what);
+        bool read = levelpack_read_binary_level(damaged_level, &lvl);
+        Check(!read, msg);
+        if (read)
+            FreeLevel(&lvl);
+    }
+    levelpack_close_binary();
+}
+
+static void CheckDamaged()
+{
+    size_t size = 0;
+    char *good = ReadFile(PACK_FILE, &size);
+    Check(good != NULL, "pack not read back");
+    if (!good)
+        return;
+    char *data = (char*)malloc(size);
+    LevelpackHeader *hdr = (LevelpackHeader*)data;
+    LevelpackLevel *table = (LevelpackLevel*)(hdr + 1);
+    int last = LEVELS_COUNT - 1;
+
+    //cut inside the header, the table and the arrays of the last level
+    memcpy(data, good, size);
+    CheckRejected(data, sizeof(LevelpackHeader) - 1, -1, "truncated header");
+    CheckRejected(data, sizeof(LevelpackHeader) + sizeof(LevelpackLevel) * LEVELS_COUNT - 1, -1,
+                  "truncated table");
+    CheckRejected(data, size - sizeof(int32_t), last, "truncated arrays");
+
+    memcpy(data, good, size);
+    hdr->byte_order = 0x04030201;
+    CheckRejected(data, size, -1, "wrong byte order");
+
+    memcpy(data, good, size);
+    hdr->version++;
+    CheckRejected(data, size, -1, "wrong version");
+
+    memcpy(data, good, size);
+    hdr->levels_count = size;
+    CheckRejected(data, size, -1, "levels count past the end");
+
+    memcpy(data, good, size);
+    table[1].boxes.offset += 2;
+    CheckRejected(data, size, 1, "misaligned boxes");
+
+    memcpy(data, good, size);
+    table[1].fins.offset += 1;
+    CheckRejected(data, size, 1, "misaligned checkpoints");
+
+    memcpy(data, good, size);
+    table[2].holes.offset = size + sizeof(int32_t);
+    CheckRejected(data, size, 2, "holes past the end");
+
+    memcpy(data, good, size);
+    table[2].boxes.count = 0xffffffff;
+    CheckRejected(data, size, 2, "boxes count past the end");
+
+    memcpy(data, good, size);
+    table[3].fins.count = 0;
+    CheckRejected(data, size, 3, "level without checkpoints");
+
+    //the other levels of a pack with a damaged one are still read
+    WriteFile(DAMAGED_FILE, data, size);
+    MazeConfig config;
+    int count;
+    if (levelpack_open_binary(DAMAGED_FILE, &config, &count))
+    {
+        Level lvl;
+        bool read = levelpack_read_binary_level(0, &lvl);
+        Check(read, "level next to a damaged one not read");
+        if (read)
+            FreeLevel(&lvl);
+    }
+    else
+        Check(false, "pack with a damaged level not opened");
+    levelpack_close_binary();
+
+    memcpy(data, good, size);
+    memcpy(hdr->magic, "MKPJ", 4);
+    WriteFile(DAMAGED_FILE, data, size);
+    Check(!levelpack_is_binary(DAMAGED_FILE), "wrong magic recognized");
+
+    free(data);
+    free(good);
+}
+
+int main()
+{
+    Level levels[LEVELS_COUNT];
+    for (int i=0; i<LEVELS_COUNT; i++)
+        MakeLevel(i, &levels[i]);
+
+    CheckRoundTrip(levels);
+    CheckDamaged();
+
+    remove(PACK_FILE);
+    remove(DAMAGED_FILE);
+    for (int i=0; i<LEVELS_COUNT; i++)
+        FreeLevel(&levels[i]);
+
+    printf("%d levelpack checks, %d failed\n", checks_count, failures_count);
+    return (failures_count == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
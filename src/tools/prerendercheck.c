@@ -0,0 +1,160 @@
+/*  prerendercheck.c
+ *
+ *  Check of the level prerendering thread.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Walks back and forth through the levels, asking for the neighbours of the
+ * current one to be prerendered and taking them at the change, with a level
+ * renderer that is slow and fails for some levels. A taken image must be the
+ * one of the level asked for, complete, and must not change afterwards; a
+ * level that can't be rendered must not be taken. Run by `make check'.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "../render.h"
+#include "../prerender.h"
+
+#define IMAGE_W 32
+#define IMAGE_H 24
+#define LEVELS_COUNT 20
+#define WALK_STEPS 2000
+
+static int checks_count = 0;
+static int failures_count = 0;
+
+//------------------------------------------------------------------------------
+// The renderer the prerender thread calls
+
+static bool BrokenLevel(int level)
+{
+    return (level % 9 == 8);
+}
+
+static Uint8 LevelByte(int level, int i)
+{
+    return (Uint8)(level * 31 + i % 11);
+}
+
+SDL_Surface *CreateSurface(Uint32 flags, int width, int height, const SDL_Surface *display)
+{
+    const SDL_PixelFormat *f = display->format;
+    return SDL_CreateRGBSurface(flags, width, height, f->BitsPerPixel, f->Rmask, f->Gmask, f->Bmask, f->Amask);
+}
+
+// row by row, slowly, so a level changes while its image is drawn
+bool RenderLevelTo(SDL_Surface *to, int level)
+{
+    if (BrokenLevel(level))
+        return false;
+    for (int y=0; y<to->h; y++)
+    {
+        Uint8 *row = (Uint8*)to->pixels + y*to->pitch;
+        for (int x=0; x<to->pitch; x++)
+            row[x] = LevelByte(level, y*to->pitch + x);
+        if (y % 8 == 0)
+            usleep(100);
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+static bool LevelImage(const SDL_Surface *s, int level)
+{
+    for (int i=0; i<s->pitch*s->h; i++)
+        if (((const Uint8*)s->pixels)[i] != LevelByte(level, i))
+            return false;
+    return true;
+}
+
+static void Check(bool ok, const char *what, int level)
+{
+    checks_count++;
+    if (ok)
+        return;
+    failures_count++;
+    printf("%s: level %d\n", what, level + 1);
+}
+
+static int Neighbour(int level, int d)
+{
+    return (level + d + LEVELS_COUNT) % LEVELS_COUNT;
+}
+
+int main()
+{
+    SDL_Surface *cur = SDL_CreateRGBSurface(SDL_SWSURFACE, IMAGE_W, IMAGE_H, 16, 0xf800, 0x07e0, 0x001f, 0);
+    prerender_init(cur);
+    Check(!prerender_take(0, &cur), "level taken before it was asked for", 0);
+
+    srand(1);
+    int level = 0, taken = 0;
+    RenderLevelTo(cur, level);
+    prerender_request(Neighbour(level, -1), Neighbour(level, 1));
+    for (int i=0; i<WALK_STEPS; i++)
+    {
+        //mostly forwards, and changes both right away and after the
+        //prerender had time
+        level = Neighbour(level, (rand() % 3 ? 1 : -1));
+        if (rand() % 2)
+            usleep(rand() % 3000);
+
+        SDL_Surface *old = cur;
+        bool hit = prerender_take(level, &cur);
+        if (BrokenLevel(level))
+            Check(!hit, "level that can't be rendered taken", level);
+        else if (hit)
+        {
+            taken++;
+            Check(cur != old, "surface not exchanged", level);
+            Check(LevelImage(cur, level), "taken image differs", level);
+        }
+        else
+            RenderLevelTo(cur, level);
+
+        prerender_request(Neighbour(level, -1), Neighbour(level, 1));
+        //the taken surface is out of the reach of the thread
+        if (hit && rand() % 4 == 0)
+        {
+            usleep(1000);
+            Check(LevelImage(cur, level), "taken image changed", level);
+        }
+    }
+
+    //a level asked for and waited for is always taken
+    level = 3;
+    prerender_request(-1, level);
+    usleep(100000);
+    Check(prerender_take(level, &cur) && LevelImage(cur, level), "prerendered level not taken", level);
+    Check(!prerender_take(level, &cur), "level taken twice", level);
+
+    prerender_shutdown();
+    SDL_FreeSurface(cur);
+
+    Check(taken > 0, "no level taken from the prerender", -1);
+    printf("%d prerender checks, %d failed, %d of %d levels taken\n",
+           checks_count, failures_count, taken, WALK_STEPS);
+    return (failures_count == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,271 @@
+/*  rawcheck.c
+ *
+ *  Check of the raw image files of the graphics cache.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Saves surfaces of the display formats as raw images and requires them to
+ * be loaded back byte for byte, with the pixels used in place from the
+ * mapping, and only for the display format they were written for. Damaged
+ * files must be rejected, and images loaded and freed by several threads
+ * at once must all be unmapped. Run by `make check'.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "../misc/rawimage.c"
+
+#define IMAGE_FILE "rawcheck.raw"
+#define IMAGE_W 45
+#define IMAGE_H 31
+#define THREADS_COUNT 4
+#define THREAD_RUNS 200
+
+static int checks_count = 0;
+static int failures_count = 0;
+
+//------------------------------------------------------------------------------
+
+static void Check(bool ok, const char *what)
+{
+    checks_count++;
+    if (ok)
+        return;
+    failures_count++;
+    printf("%s\n", what);
+}
+
+// rows with padding, so the pitch is kept apart from the width
+static SDL_Surface *CreateImage(int bpp, Uint32 r, Uint32 g, Uint32 b, Uint32 a, int seed)
+{
+    int pitch = IMAGE_W * bpp/8 + 12;
+    Uint8 *pixels = (Uint8*)malloc(pitch * IMAGE_H);
+    for (int i=0; i<pitch*IMAGE_H; i++)
+        pixels[i] = i*7 + seed;
+    return SDL_CreateRGBSurfaceFrom(pixels, IMAGE_W, IMAGE_H, bpp, pitch, r, g, b, a);
+}
+
+static void FreeImage(SDL_Surface *s)
+{
+    void *pixels = s->pixels;
+    SDL_FreeSurface(s);
+    free(pixels);
+}
+
+static bool SameImage(const SDL_Surface *a, const SDL_Surface *b)
+{
+    if (a->w != b->w || a->h != b->h || a->pitch != b->pitch ||
+        a->format->BitsPerPixel != b->format->BitsPerPixel ||
+        a->format->Rmask != b->format->Rmask || a->format->Gmask != b->format->Gmask ||
+        a->format->Bmask != b->format->Bmask || a->format->Amask != b->format->Amask)
+        return false;
+    return !memcmp(a->pixels, b->pixels, (size_t)a->pitch * a->h);
+}
+
+static bool Mapped(const SDL_Surface *s)
+{
+    for (RawImageMapping *m = mappings; m; m = m->next)
+        if (m->surface == s)
+            return (s->pixels == (Uint8*)m->data + sizeof(RawImageHeader));
+    return false;
+}
+
+static long FileSize(const char *fname)
+{
+    struct stat st;
+    return (stat(fname, &st) == 0 ? (long)st.st_size : -1);
+}
+
+//------------------------------------------------------------------------------
+
+static void CheckRoundTrip(SDL_Surface *img, const SDL_PixelFormat *opaque, const SDL_PixelFormat *alpha,
+                           const SDL_PixelFormat *other, const char *name)
+{
+    char msg[128];
+    snprintf(msg, sizeof(msg), "%s: not saved", name);
+    Check(raw_image_save(img, IMAGE_FILE) == 0 && FileSize(IMAGE_FILE) == raw_image_file_size(img), msg);
+
+    SDL_Surface *res = raw_image_load(IMAGE_FILE, IMAGE_W, IMAGE_H, opaque, alpha);
+    snprintf(msg, sizeof(msg), "%s: loaded image differs", name);
+    Check(res && SameImage(res, img), msg);
+    snprintf(msg, sizeof(msg), "%s: pixels not used from the mapping", name);
+    Check(res && Mapped(res), msg);
+
+    //the mapping is private, drawing into the image leaves the file alone
+    if (res)
+    {
+        memset(res->pixels, 0, (size_t)res->pitch * res->h);
+        raw_image_free(res);
+    }
+    res = raw_image_load(IMAGE_FILE, IMAGE_W, IMAGE_H, opaque, alpha);
+    snprintf(msg, sizeof(msg), "%s: file changed through the image", name);
+    Check(res && SameImage(res, img), msg);
+    raw_image_free(res);
+
+    //for another display
+    res = (img->format->Amask ? raw_image_load(IMAGE_FILE, IMAGE_W, IMAGE_H, opaque, other) :
+                                raw_image_load(IMAGE_FILE, IMAGE_W, IMAGE_H, other, alpha));
+    snprintf(msg, sizeof(msg), "%s: loaded for another format", name);
+    Check(!res, msg);
+    raw_image_free(res);
+    res = raw_image_load(IMAGE_FILE, IMAGE_W, IMAGE_H, NULL, NULL);
+    snprintf(msg, sizeof(msg), "%s: loaded without a format", name);
+    Check(!res, msg);
+    raw_image_free(res);
+    res = raw_image_load(IMAGE_FILE, IMAGE_W + 1, IMAGE_H, opaque, alpha);
+    snprintf(msg, sizeof(msg), "%s: loaded for another size", name);
+    Check(!res, msg);
+    raw_image_free(res);
+}
+
+static void WriteDamaged(const RawImageHeader *hdr, const void *pixels, size_t size)
+{
+    FILE *f = fopen(IMAGE_FILE, "wb");
+    if (!f)
+        return;
+    fwrite(hdr, sizeof(*hdr), 1, f);
+    fwrite(pixels, size, 1, f);
+    fclose(f);
+}
+
+static void CheckDamaged(SDL_Surface *img)
+{
+    const SDL_PixelFormat *f = img->format;
+    RawImageHeader good;
+    memset(&good, 0, sizeof(good));
+    memcpy(good.magic, RAW_IMAGE_MAGIC, 4);
+    good.version = RAW_IMAGE_VERSION;
+    good.width = img->w;
+    good.height = img->h;
+    good.bpp = f->BitsPerPixel;
+    good.pitch = img->pitch;
+    good.rmask = f->Rmask;
+    good.gmask = f->Gmask;
+    good.bmask = f->Bmask;
+    good.amask = f->Amask;
+    size_t size = (size_t)img->pitch * img->h;
+
+    //the header built here is the one written
+    WriteDamaged(&good, img->pixels, size);
+    SDL_Surface *res = raw_image_load(IMAGE_FILE, IMAGE_W, IMAGE_H, f, NULL);
+    Check(res && SameImage(res, img), "image with the written header not loaded");
+    raw_image_free(res);
+
+    RawImageHeader hdr = good;
+    WriteDamaged(&hdr, img->pixels, size - 1);
+    Check(!raw_image_load(IMAGE_FILE, IMAGE_W, IMAGE_H, f, NULL), "truncated image loaded");
+
+    WriteDamaged(&hdr, img->pixels, 0);
+    truncate(IMAGE_FILE, sizeof(RawImageHeader) - 1);
+    Check(!raw_image_load(IMAGE_FILE, IMAGE_W, IMAGE_H, f, NULL), "image with a truncated header loaded");
+
+    hdr = good;
+    memcpy(hdr.magic, "MKRJ", 4);
+    WriteDamaged(&hdr, img->pixels, size);
+    Check(!raw_image_load(IMAGE_FILE, IMAGE_W, IMAGE_H, f, NULL), "image with a wrong magic loaded");
+
+    hdr = good;
+    hdr.version++;
+    WriteDamaged(&hdr, img->pixels, size);
+    Check(!raw_image_load(IMAGE_FILE, IMAGE_W, IMAGE_H, f, NULL), "image of another version loaded");
+
+    hdr = good;
+    hdr.pitch = IMAGE_W * f->BytesPerPixel - 1;
+    WriteDamaged(&hdr, img->pixels, size);
+    Check(!raw_image_load(IMAGE_FILE, IMAGE_W, IMAGE_H, f, NULL), "image with rows shorter than the width loaded");
+
+    hdr = good;
+    hdr.pitch = 0x40000000;
+    WriteDamaged(&hdr, img->pixels, size);
+    Check(!raw_image_load(IMAGE_FILE, IMAGE_W, IMAGE_H, f, NULL), "image with rows past the end loaded");
+
+    remove(IMAGE_FILE);
+    Check(!raw_image_load(IMAGE_FILE, IMAGE_W, IMAGE_H, f, NULL), "missing image loaded");
+    Check(mappings == NULL, "rejected image left mapped");
+}
+
+//------------------------------------------------------------------------------
+
+static const SDL_PixelFormat *thread_format = NULL;
+
+static void *LoadWork(void *data)
+{
+    int *loaded = (int*)data;
+    for (int i=0; i<THREAD_RUNS; i++)
+    {
+        SDL_Surface *res = raw_image_load(IMAGE_FILE, IMAGE_W, IMAGE_H, thread_format, NULL);
+        *loaded += (res != NULL);
+        raw_image_free(res);
+    }
+    return NULL;
+}
+
+static void CheckThreads(SDL_Surface *img)
+{
+    raw_image_save(img, IMAGE_FILE);
+    thread_format = img->format;
+    pthread_t threads[THREADS_COUNT];
+    int loaded[THREADS_COUNT] = {0};
+    for (int i=0; i<THREADS_COUNT; i++)
+        pthread_create(&threads[i], NULL, LoadWork, &loaded[i]);
+    int total = 0;
+    for (int i=0; i<THREADS_COUNT; i++)
+    {
+        pthread_join(threads[i], NULL);
+        total += loaded[i];
+    }
+    Check(total == THREADS_COUNT * THREAD_RUNS, "image not loaded by a thread");
+    Check(mappings == NULL, "image loaded by a thread left mapped");
+    remove(IMAGE_FILE);
+}
+
+int main()
+{
+    SDL_Surface *opaque16 = CreateImage(16, 0xf800, 0x07e0, 0x001f, 0, 1);
+    SDL_Surface *bgr16 = CreateImage(16, 0x001f, 0x07e0, 0xf800, 0, 2);
+    SDL_Surface *opaque32 = CreateImage(32, 0xff0000, 0x00ff00, 0x0000ff, 0, 3);
+    SDL_Surface *alpha32 = CreateImage(32, 0xff0000, 0x00ff00, 0x0000ff, 0xff000000, 4);
+    SDL_Surface *other_alpha32 = CreateImage(32, 0x0000ff, 0x00ff00, 0xff0000, 0xff000000, 5);
+
+    CheckRoundTrip(opaque16, opaque16->format, alpha32->format, bgr16->format, "16bpp");
+    CheckRoundTrip(opaque32, opaque32->format, alpha32->format, opaque16->format, "32bpp");
+    CheckRoundTrip(alpha32, opaque32->format, alpha32->format, other_alpha32->format, "32bpp with alpha");
+    Check(mappings == NULL, "freed image left mapped");
+
+    //a surface not loaded from a file is just freed
+    SDL_Surface *plain = SDL_CreateRGBSurface(SDL_SWSURFACE, 4, 4, 16, 0xf800, 0x07e0, 0x001f, 0);
+    raw_image_free(plain);
+    raw_image_free(NULL);
+
+    CheckDamaged(opaque16);
+    CheckThreads(opaque32);
+
+    FreeImage(opaque16);
+    FreeImage(bgr16);
+    FreeImage(opaque32);
+    FreeImage(alpha32);
+    FreeImage(other_alpha32);
+    remove(IMAGE_FILE);
+
+    printf("%d raw image checks, %d failed\n", checks_count, failures_count);
+    return (failures_count == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
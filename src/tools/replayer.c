@@ -0,0 +1,246 @@
+/*  replayer.c
+ *
+ *  Headless replayer of recorded games for bug reports and physics benchmarking.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Plays a file recorded with `mokomaze --record' through mazecore without
+ * video and reports the game states the world went through and the cost of
+ * every maze_world_step().
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <argtable2.h>
+#include "../mazecore/mazecore.h"
+#include "../mazecore/mazehelpers.h"
+#include "../paramsloader.h"
+#include "../replay.h"
+
+#define LOG_MODULE "Replayer"
+#include "../logging.h"
+
+static const char *state_names[] = {
+    "normal",
+    "failed",
+    "win",
+    "saved"
+};
+
+static double get_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[])
+{
+    struct arg_str  *pack    = arg_str0("p","levelpack","<file>", "level pack file (default: the one from the replay)");
+    struct arg_file *output  = arg_file0("o","output","<file>", "write per-frame step cost (CSV) to <file>");
+    struct arg_int  *repeat  = arg_int0("n","repeat",NULL, "play the replay <n> times, the cost is of the fastest run");
+    struct arg_file *replay_f = arg_file1(NULL,NULL,"<replay file>", "file recorded with `mokomaze --record'");
+    struct arg_lit  *help    = arg_lit0(NULL,"help", "print this help and exit");
+    struct arg_end  *end     = arg_end (20);
+    void* argtable[] = {pack,output,repeat,replay_f,help,end};
+    const char* progname = "mokomaze-replay";
+
+    if (arg_nullcheck(argtable) != 0)
+    {
+        printf("%s: insufficient memory\n",progname);
+        return EXIT_FAILURE;
+    }
+
+    int nerrors = arg_parse(argc,argv,argtable);
+    if (help->count > 0)
+    {
+        printf("Mokomaze headless replayer\n");
+        printf("Usage: %s", progname);
+        arg_print_syntax(stdout,argtable,"\n");
+        arg_print_glossary(stdout,argtable,"  %-25s %s\n");
+        return EXIT_SUCCESS;
+    }
+    if (nerrors > 0)
+    {
+        arg_print_errors(stdout,end,progname);
+        printf("Try '%s --help' for more information.\n",progname);
+        return EXIT_FAILURE;
+    }
+
+    ReplayHeader hdr;
+    Replay *r = replay_open(replay_f->filename[0], &hdr);
+    if (!r)
+        return EXIT_FAILURE;
+
+    // the events are read once, timing should not include the file reading
+    ReplayEvent *events = NULL;
+    int events_count = 0, events_size = 0, frames_count = 0;
+    ReplayEvent ev;
+    while (replay_read(r, &ev))
+    {
+        if (events_count == events_size)
+        {
+            events_size = (events_size ? events_size * 2 : 1024);
+            events = (ReplayEvent*)realloc(events, events_size * sizeof(ReplayEvent));
+        }
+        events[events_count++] = ev;
+        if (ev.type == REPLAY_FRAME)
+            frames_count++;
+    }
+    replay_close(r);
+
+    const char *pack_fname = (pack->count > 0 ? pack->sval[0] : hdr.levelpack);
+    if (!LoadLevelpack(pack_fname) || GetGameLevelsCount() == 0)
+    {
+        log_error("Failed to load level pack `%s'.", pack_fname);
+        return EXIT_FAILURE;
+    }
+    Level *levels = GetGameLevels();
+    int levels_count = GetGameLevelsCount();
+    for (int i=0; i<levels_count; i++)
+        transform_level(&levels[i], hdr.scale, hdr.rot, hdr.scaled_width);
+
+    FILE *out = NULL;
+    if (output->count > 0)
+    {
+        out = fopen(output->filename[0], "w");
+        if (!out)
+        {
+            log_error("can't open output file `%s'", output->filename[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    maze_init();
+
+    int runs = (repeat->count > 0 ? repeat->ival[0] : 1);
+    clamp_min(runs, 1);
+    double *cost = (double*)malloc((frames_count + 1) * sizeof(double));
+    double *best = (double*)malloc((frames_count + 1) * sizeof(double));
+    int *ticks = (int*)malloc((frames_count + 1) * sizeof(int));
+    GameState *states = (GameState*)malloc((frames_count + 1) * sizeof(GameState));
+    double best_total = -1;
+    MazeStats stats;
+
+    for (int run=0; run<runs; run++)
+    {
+        MazeWorld *w = maze_world_create(hdr.config, levels, levels_count);
+        maze_world_set_fixed_step(w, hdr.fixed_step);
+
+        int frame = 0;
+        int level = -1;
+        double total = 0;
+        for (int i=0; i<events_count; i++)
+        {
+            ReplayEvent *e = &events[i];
+            switch (e->type)
+            {
+            case REPLAY_LEVEL:
+                if ((e->level < 0) || (e->level >= levels_count))
+                {
+                    log_error("level %d is not in the level pack", e->level + 1);
+                    return EXIT_FAILURE;
+                }
+                level = e->level;
+                maze_world_set_level(w, level);
+                break;
+            case REPLAY_RESTART:
+                maze_world_restart_level(w);
+                break;
+            case REPLAY_RELOAD:
+                maze_world_reload_level(w);
+                break;
+            case REPLAY_SPEED:
+                maze_world_set_speed(w, e->speed);
+                break;
+            case REPLAY_FRAME:
+            {
+                if (level < 0)
+                    break;
+                maze_world_set_tilt(w, e->tilt_x, e->tilt_y, 0);
+                double start = get_time();
+                GameState state = maze_world_step(w, e->delta_ticks);
+                cost[frame] = get_time() - start;
+                total += cost[frame];
+                ticks[frame] = e->delta_ticks;
+                states[frame] = state;
+                frame++;
+                break;
+            }
+            }
+        }
+        frames_count = frame;
+
+        maze_world_get_stats(w, &stats);
+        maze_world_destroy(w);
+        if (best_total < 0 || total < best_total)
+        {
+            best_total = total;
+            memcpy(best, cost, frames_count * sizeof(double));
+        }
+    }
+
+    // the game states are the same on every run
+    int game_ms = 0;
+    for (int i=0; i<frames_count; i++)
+    {
+        game_ms += ticks[i];
+        if (states[i] != GAME_STATE_NORMAL)
+            printf("frame %d (%.3f s): %s\n", i + 1, game_ms / 1000.0, state_names[states[i]]);
+    }
+
+    if (out)
+    {
+        fprintf(out, "frame,delta_ticks,state,step_us\n");
+        for (int i=0; i<frames_count; i++)
+            fprintf(out, "%d,%d,%s,%.3f\n", i + 1, ticks[i], state_names[states[i]], best[i] * 1e6);
+        fclose(out);
+    }
+
+    log_info("%d frames, %.1f s of game time, %lu physics steps, %lu NaN rollbacks",
+             frames_count, game_ms / 1000.0, stats.steps, stats.nan_rollbacks);
+    log_info("%lu collision pairs tested, %lu contacts made",
+             stats.pairs_tested, stats.contacts_made);
+    if (frames_count > 0)
+    {
+        qsort(best, frames_count, sizeof(double), compare_double);
+        log_info("step cost: total %.3f ms, mean %.1f us, median %.1f us, p99 %.1f us, max %.1f us",
+                 best_total * 1000, best_total / frames_count * 1e6,
+                 best[frames_count / 2] * 1e6, best[frames_count * 99 / 100] * 1e6,
+                 best[frames_count - 1] * 1e6);
+    }
+
+    free(states);
+    free(ticks);
+    free(best);
+    free(cost);
+    free(events);
+    maze_quit();
+    arg_freetable(argtable,sizeof(argtable)/sizeof(argtable[0]));
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,211 @@
+/*  scrollcheck.c
+ *
+ *  Check of the incremental update of the scrolling viewport.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Changes parts of a level-sized surface and moves a smaller viewport over
+ * it the way the scrolling mode does: not at all, a few pixels, or further
+ * than the viewport. After every frame the display must hold exactly the
+ * viewed part of the level, only the uncovered strips and the changed parts
+ * may be copied, and every changed pixel of the display must be presented.
+ * Run by `make check'.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <SDL/SDL.h>
+
+// the updates are recorded instead of presented
+static void RecordUpdateRects(SDL_Surface *surf, int count, SDL_Rect *update);
+static int RecordFlip(SDL_Surface *surf);
+#define SDL_UpdateRects RecordUpdateRects
+#define SDL_Flip RecordFlip
+#include "../dirtyrects.c"
+#undef SDL_UpdateRects
+#undef SDL_Flip
+
+#define WORLD_W 480
+#define WORLD_H 640
+#define DISP_W 200
+#define DISP_H 150
+#define FRAMES 3000
+
+static SDL_Rect updated[DIRTY_MAX_RECTS];
+static int updated_count = 0;
+static bool flipped = false;
+
+static int checks_count = 0;
+static int failures_count = 0;
+
+static void RecordUpdateRects(SDL_Surface *surf, int count, SDL_Rect *update)
+{
+    (void)surf;
+    memcpy(updated, update, count * sizeof(SDL_Rect));
+    updated_count = count;
+}
+
+static int RecordFlip(SDL_Surface *surf)
+{
+    (void)surf;
+    flipped = true;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static void Check(bool ok, const char *what, int frame)
+{
+    checks_count++;
+    if (ok)
+        return;
+    failures_count++;
+    printf("%s: frame %d\n", what, frame);
+}
+
+static Uint32 *Pixel(SDL_Surface *s, int x, int y)
+{
+    return (Uint32*)((Uint8*)s->pixels + y*s->pitch) + x;
+}
+
+// new content for a part of the level, reported as dirty; returns its
+// area within the view
+static long ChangeWorld(SDL_Surface *world, const SDL_Rect *view)
+{
+    int w = 1 + rand() % 40, h = 1 + rand() % 40;
+    int x = rand() % (WORLD_W - w), y = rand() % (WORLD_H - h);
+    Uint32 col = ((Uint32)rand() << 8) ^ (Uint32)rand();
+    for (int yy=y; yy<y+h; yy++)
+        for (int xx=x; xx<x+w; xx++)
+            *Pixel(world, xx, yy) = col + xx;
+    dirty_add(x, y, w, h);
+
+    int x1 = max(x, view->x), y1 = max(y, view->y);
+    int x2 = min(x + w, view->x + view->w), y2 = min(y + h, view->y + view->h);
+    return (x1 < x2 && y1 < y2 ? (long)(x2 - x1) * (y2 - y1) : 0);
+}
+
+static void MoveView(SDL_Rect *view)
+{
+    switch (rand() % 6)
+    {
+    case 0:
+    case 1:
+        break;
+    case 2:
+        view->x = rand() % (WORLD_W - DISP_W + 1);
+        view->y = rand() % (WORLD_H - DISP_H + 1);
+        break;
+    default:
+        view->x += rand() % 17 - 8;
+        view->y += rand() % 17 - 8;
+    }
+    clamp(view->x, 0, WORLD_W - DISP_W);
+    clamp(view->y, 0, WORLD_H - DISP_H);
+}
+
+static bool SameView(SDL_Surface *world, const SDL_Rect *view, SDL_Surface *disp)
+{
+    for (int y=0; y<DISP_H; y++)
+        if (memcmp(Pixel(disp, 0, y), Pixel(world, view->x, view->y + y), DISP_W * sizeof(Uint32)))
+            return false;
+    return true;
+}
+
+// the display pixels changed by the frame are all presented
+static bool ChangesPresented(SDL_Surface *disp, SDL_Surface *before)
+{
+    if (flipped)
+        return true;
+    for (int y=0; y<DISP_H; y++)
+        for (int x=0; x<DISP_W; x++)
+        {
+            if (*Pixel(disp, x, y) == *Pixel(before, x, y))
+                continue;
+            bool presented = false;
+            for (int i=0; i<updated_count && !presented; i++)
+                presented = (x >= updated[i].x && x < updated[i].x + updated[i].w &&
+                             y >= updated[i].y && y < updated[i].y + updated[i].h);
+            if (!presented)
+                return false;
+        }
+    return true;
+}
+
+int main()
+{
+    SDL_Surface *world = SDL_CreateRGBSurface(SDL_SWSURFACE, WORLD_W, WORLD_H, 32, 0xff0000, 0x00ff00, 0x0000ff, 0);
+    SDL_Surface *disp = SDL_CreateRGBSurface(SDL_SWSURFACE, DISP_W, DISP_H, 32, 0xff0000, 0x00ff00, 0x0000ff, 0);
+    SDL_Surface *before = SDL_CreateRGBSurface(SDL_SWSURFACE, DISP_W, DISP_H, 32, 0xff0000, 0x00ff00, 0x0000ff, 0);
+    for (int y=0; y<WORLD_H; y++)
+        for (int x=0; x<WORLD_W; x++)
+            *Pixel(world, x, y) = (Uint32)(y * WORLD_W + x);
+
+    srand(1);
+    SDL_Rect view = { 0, 0, DISP_W, DISP_H };
+    long incremental_copied = 0, incremental_frames = 0;
+    for (int frame=0; frame<FRAMES; frame++)
+    {
+        SDL_Rect prev = view;
+        memcpy(before->pixels, disp->pixels, (size_t)DISP_H * disp->pitch);
+
+        //the first frame draws everything, as after any full redraw
+        bool redraw_all = (frame == 0 || rand() % 50 == 0);
+        MoveView(&view);
+        long changed = 0;
+        for (int i=rand() % 4; i>0; i--)
+            changed += ChangeWorld(world, &view);
+        if (redraw_all)
+            dirty_add_all();
+
+        updated_count = 0;
+        flipped = false;
+        dirty_copy_view(world, &view, disp);
+        dirty_flush(disp);
+
+        Check(SameView(world, &view, disp), "display differs from the view", frame);
+        Check(ChangesPresented(disp, before), "changed pixels not presented", frame);
+
+        int dx = abs(view.x - prev.x), dy = abs(view.y - prev.y);
+        DirtyStats stats = dirty_get_stats();
+        if (redraw_all || dx >= DISP_W || dy >= DISP_H)
+            continue;
+        //only the uncovered strips and the changed parts are copied
+        long strips = (long)dx * DISP_H + (long)dy * DISP_W;
+        Check(stats.copied <= strips + changed, "more copied than changed", frame);
+        if (dx == 0 && dy == 0)
+            Check(!stats.full, "display flipped without a scroll", frame);
+        else
+            Check(stats.full, "scrolled display not flipped", frame);
+        incremental_copied += stats.copied;
+        incremental_frames++;
+    }
+
+    Check(incremental_frames > FRAMES / 2, "too few incremental frames", FRAMES);
+    SDL_FreeSurface(before);
+    SDL_FreeSurface(disp);
+    SDL_FreeSurface(world);
+
+    printf("%d scrolling checks, %d failed, %ld pixels copied per incremental frame of %d\n",
+           checks_count, failures_count, incremental_copied / max(incremental_frames, 1), DISP_W * DISP_H);
+    return (failures_count == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
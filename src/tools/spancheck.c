@@ -0,0 +1,174 @@
+/*  spancheck.c
+ *
+ *  Check of the vector span kernels against the scalar ones.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runs every span kernel the renderer uses, with the vector code and its
+ * scalar tail, and the plain scalar kernel on copies of the same random and
+ * edge-case spans, and requires byte-identical results. Run by `make check'.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "../render_span.c"
+
+#define MAX_SPAN 67
+#define RANDOM_RUNS 2000
+
+static int checks_count = 0;
+static int failures_count = 0;
+
+static const uint8_t edge_aa[] = { 0, 1, SPAN_AA_MAX-1, SPAN_AA_MAX };
+static const float edge_k[] = { 0, 1, 0.5f, 1.0f/SPAN_AA_MAX, 0.999f };
+
+static void InitFormat(SpanFormat *fmt, int bpp, Uint32 r, Uint32 g, Uint32 b, Uint32 a)
+{
+    SDL_PixelFormat pf;
+    memset(&pf, 0, sizeof(pf));
+    pf.BitsPerPixel = bpp;
+    pf.Rmask = r; pf.Gmask = g; pf.Bmask = b; pf.Amask = a;
+    for (pf.Rshift = 0; r && !((r >> pf.Rshift) & 1); pf.Rshift++);
+    for (pf.Gshift = 0; g && !((g >> pf.Gshift) & 1); pf.Gshift++);
+    for (pf.Bshift = 0; b && !((b >> pf.Bshift) & 1); pf.Bshift++);
+    for (pf.Ashift = 0; a && !((a >> pf.Ashift) & 1); pf.Ashift++);
+    InitSpanFormat(fmt, &pf);
+}
+
+// every channel at 0, at its maximum or random, and fully random pixels
+static Uint32 RandomPixel(const SpanFormat *fmt)
+{
+    Uint32 mask = (fmt->bpp == 32 ? 0xffffffff : 0xffff);
+    switch (rand() % 4)
+    {
+    case 0: return 0;
+    case 1: return (fmt->rmask | fmt->gmask | fmt->bmask | fmt->amask) & mask;
+    case 2: return (fmt->amask & (rand() % 2 ? 0xffffffff : 0)) | (rand() & (fmt->rmask | fmt->gmask | fmt->bmask));
+    default: return ((Uint32)rand() << 16 ^ (Uint32)rand()) & mask;
+    }
+}
+
+static float RandomK()
+{
+    if (rand() % 3 == 0)
+        return edge_k[rand() % (sizeof(edge_k)/sizeof(edge_k[0]))];
+    return (float)rand() / RAND_MAX;
+}
+
+static uint8_t RandomAA()
+{
+    if (rand() % 2 == 0)
+        return edge_aa[rand() % (sizeof(edge_aa)/sizeof(edge_aa[0]))];
+    return rand() % (SPAN_AA_MAX + 1);
+}
+
+// the whole buffers are compared, the pixels around the span must stay too
+static void Check(const char *kernel, const SpanFormat *fmt, int count, const void *vec, const void *ref)
+{
+    checks_count++;
+    if (memcmp(vec, ref, (MAX_SPAN + 4) * (fmt->bpp/8)) != 0)
+    {
+        failures_count++;
+        printf("%s: %dbpp span of %d pixels differs from the scalar kernel\n", kernel, fmt->bpp, count);
+    }
+}
+
+// the spans start at any pixel offset, the vector code uses unaligned access
+static void CheckSpan(const SpanFormat *fmt, int count)
+{
+    Uint32 src[MAX_SPAN + 4], vec[MAX_SPAN + 4], ref[MAX_SPAN + 4];
+    float k[MAX_SPAN];
+    uint8_t aa[MAX_SPAN];
+    int offset = rand() % 4;
+    int psize = fmt->bpp/8;
+
+    for (int i=0; i<MAX_SPAN + 4; i++)
+    {
+        Uint32 p = RandomPixel(fmt);
+        if (fmt->bpp == 32)
+            src[i] = p;
+        else
+            ((Uint16*)src)[i] = p;
+    }
+    for (int i=0; i<count; i++)
+    {
+        k[i] = RandomK();
+        aa[i] = RandomAA();
+    }
+    uint8_t *v = (uint8_t*)vec + offset*psize;
+    uint8_t *r = (uint8_t*)ref + offset*psize;
+
+    memcpy(vec, src, sizeof(src)); memcpy(ref, src, sizeof(src));
+    ShadeSpanK(fmt, v, k, count);
+    ShadeSpanKScalar(fmt, r, k, count);
+    Check("ShadeSpanK", fmt, count, vec, ref);
+
+    memcpy(vec, src, sizeof(src)); memcpy(ref, src, sizeof(src));
+    ShadeSpanAA(fmt, v, aa, count);
+    ShadeSpanAAScalar(fmt, r, aa, count);
+    Check("ShadeSpanAA", fmt, count, vec, ref);
+
+    SDL_Color mix;
+    mix.r = (rand() % 2 ? 255 : rand() % 256);
+    mix.g = (rand() % 2 ? 0 : rand() % 256);
+    mix.b = rand() % 256;
+    mix.unused = 0;
+    memcpy(vec, src, sizeof(src)); memcpy(ref, src, sizeof(src));
+    MixSpanAA(fmt, v, aa, count, mix);
+    MixSpanAAScalar(fmt, r, aa, count, mix);
+    Check("MixSpanAA", fmt, count, vec, ref);
+
+    if (fmt->bpp == 32 && fmt->amask)
+    {
+        float kk = RandomK();
+        memset(vec, 0, sizeof(vec)); memset(ref, 0, sizeof(ref));
+        ScaleAlphaSpan(fmt, src + offset, vec + offset, count, kk);
+        ScaleAlphaSpanScalar(fmt, src + offset, ref + offset, count, kk);
+        Check("ScaleAlphaSpan", fmt, count, vec, ref);
+    }
+}
+
+int main()
+{
+    SpanFormat formats[4];
+    InitFormat(&formats[0], 16, 0xf800, 0x07e0, 0x001f, 0);
+    InitFormat(&formats[1], 32, 0xff0000, 0x00ff00, 0x0000ff, 0);
+    InitFormat(&formats[2], 32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000);
+    InitFormat(&formats[3], 32, 0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000);
+
+#ifndef SPAN_SSE2
+    printf("no vector kernels in this build, the scalar ones are checked against themselves\n");
+#endif
+
+    srand(1);
+    for (int f=0; f<4; f++)
+    {
+        // all the tail lengths, then bulk plus tail
+        for (int count=0; count<8; count++)
+            for (int run=0; run<50; run++)
+                CheckSpan(&formats[f], count);
+        for (int run=0; run<RANDOM_RUNS; run++)
+            CheckSpan(&formats[f], rand() % (MAX_SPAN + 1));
+    }
+
+    printf("%d span checks, %d failed\n", checks_count, failures_count);
+    return (failures_count == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
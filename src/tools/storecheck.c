@@ -0,0 +1,197 @@
+/*  storecheck.c
+ *
+ *  Check of the level store under concurrent use.
+ *
+ *  (c) 2009-2012 Anton Olkhovik <ant007h@gmail.com>
+ *
+ *  This file is part of Mokomaze - labyrinth game.
+ *
+ *  Mokomaze is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Mokomaze is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Mokomaze.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Several threads get and put back random levels, some held a while, through
+ * a store smaller than the set of levels, so they are evicted and decoded
+ * again all the time. Every level given out must have its own content, the
+ * levels that can't be decoded must come back as NULL, and the store must be
+ * within its capacity once everything is given back. Run by `make check'.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "../levelstore.c"
+
+#define STORE_CAPACITY 4
+#define LEVELS_COUNT 24
+#define THREADS_COUNT 4
+#define THREAD_RUNS 20000
+#define HELD_MAX 3
+
+static SDL_mutex *stats_lock = NULL;
+static int loads_count = 0;
+static int checks_count = 0;
+static int failures_count = 0;
+
+//------------------------------------------------------------------------------
+
+// every seventh level can't be decoded
+static bool BrokenLevel(int n)
+{
+    return (n % 7 == 6);
+}
+
+static bool LoadLevel(int n, Level *lvl)
+{
+    SDL_LockMutex(stats_lock);
+    loads_count++;
+    SDL_UnlockMutex(stats_lock);
+    if (BrokenLevel(n))
+        return false;
+
+    lvl->boxes_count = 1 + n % 5;
+    lvl->boxes = (Box*)malloc(sizeof(Box) * lvl->boxes_count);
+    for (int i=0; i<lvl->boxes_count; i++)
+    {
+        lvl->boxes[i].x1 = lvl->boxes[i].y1 = n;
+        lvl->boxes[i].x2 = lvl->boxes[i].y2 = n + i;
+    }
+    lvl->fins_count = 1;
+    lvl->fins = (Point*)malloc(sizeof(Point));
+    lvl->fins[0].x = lvl->fins[0].y = n;
+    lvl->init.x = n;
+    lvl->init.y = 0;
+    return true;
+}
+
+static void TransformLevel(Level *lvl)
+{
+    lvl->init.y++;
+}
+
+// decoded and transformed exactly once
+static bool LevelIntact(const Level *lvl, int n)
+{
+    if (lvl->init.x != n || lvl->init.y != 1 || lvl->boxes_count != 1 + n % 5 ||
+        lvl->fins_count != 1 || lvl->fins[0].x != n)
+        return false;
+    for (int i=0; i<lvl->boxes_count; i++)
+        if (lvl->boxes[i].x1 != n || lvl->boxes[i].x2 != n + i)
+            return false;
+    return true;
+}
+
+static void Check(bool ok, const char *what, int n)
+{
+    SDL_LockMutex(stats_lock);
+    checks_count++;
+    if (!ok)
+    {
+        failures_count++;
+        printf("%s: level %d\n", what, n + 1);
+    }
+    SDL_UnlockMutex(stats_lock);
+}
+
+//------------------------------------------------------------------------------
+
+static int StoreWork(void *data)
+{
+    unsigned int seed = *(unsigned int*)data;
+    Level *held[HELD_MAX];
+    int held_n[HELD_MAX];
+    int held_count = 0;
+
+    for (int run=0; run<THREAD_RUNS; run++)
+    {
+        int n = rand_r(&seed) % LEVELS_COUNT;
+        Level *lvl = level_store_get(n);
+        if (BrokenLevel(n))
+        {
+            Check(!lvl, "broken level given out", n);
+            if (lvl)
+                level_store_put(lvl);
+            continue;
+        }
+        Check(lvl && LevelIntact(lvl, n), "level content differs", n);
+        if (!lvl)
+            continue;
+
+        if (held_count < HELD_MAX && rand_r(&seed) % 2)
+        {
+            held[held_count] = lvl;
+            held_n[held_count++] = n;
+        }
+        else
+            level_store_put(lvl);
+
+        // a held level must survive the eviction of the others
+        if (held_count > 0 && (held_count == HELD_MAX || rand_r(&seed) % 4 == 0))
+        {
+            held_count--;
+            Check(LevelIntact(held[held_count], held_n[held_count]), "held level changed", held_n[held_count]);
+            level_store_put(held[held_count]);
+        }
+    }
+
+    while (held_count > 0)
+    {
+        held_count--;
+        Check(LevelIntact(held[held_count], held_n[held_count]), "held level changed", held_n[held_count]);
+        level_store_put(held[held_count]);
+    }
+    return 0;
+}
+
+int main()
+{
+    stats_lock = SDL_CreateMutex();
+    level_store_init(STORE_CAPACITY, LoadLevel, TransformLevel);
+
+    //more levels held than the capacity, the store goes over it
+    Level *all[LEVELS_COUNT];
+    for (int i=0; i<LEVELS_COUNT; i++)
+        all[i] = level_store_get(i);
+    for (int i=0; i<LEVELS_COUNT; i++)
+    {
+        Check(BrokenLevel(i) ? !all[i] : (all[i] && LevelIntact(all[i], i)), "level over the capacity differs", i);
+        if (all[i])
+            level_store_put(all[i]);
+    }
+    Check(entries_count <= entries_capacity, "store not back within the capacity", -1);
+    Check(entries_capacity == STORE_CAPACITY, "capacity changed", -1);
+
+    SDL_Thread *threads[THREADS_COUNT];
+    unsigned int seeds[THREADS_COUNT];
+    for (int i=0; i<THREADS_COUNT; i++)
+    {
+        seeds[i] = 1234 + i;
+        threads[i] = SDL_CreateThread(StoreWork, &seeds[i]);
+    }
+    for (int i=0; i<THREADS_COUNT; i++)
+        SDL_WaitThread(threads[i], NULL);
+
+    Check(entries_count <= entries_capacity, "store not back within the capacity", -1);
+    Check(entries_capacity == STORE_CAPACITY, "capacity changed", -1);
+    for (int i=0; i<entries_count; i++)
+        Check(entries[i]->holders == 0, "level still held", entries[i]->level);
+    Check(loads_count > LEVELS_COUNT, "no level evicted and decoded again", -1);
+
+    level_store_free();
+    SDL_DestroyMutex(stats_lock);
+
+    printf("%d level store checks, %d failed, %d levels decoded\n", checks_count, failures_count, loads_count);
+    return (failures_count == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -47,6 +47,8 @@ typedef struct {
     int frame_delay;
     InputType input_type;
     float ball_speed;
+    bool fixed_step;
+    bool level_cache_disk;
     float bump_min_speed;
     float bump_max_speed;
     InputCalibrationData input_calibration_data;
@@ -75,6 +77,7 @@ typedef struct {
     bool fullscreen_mode_set;
     bool cal_auto;
     bool cal_reset;
+    char *record_file;
 } Prompt;
 
 #endif /* TYPES_H */